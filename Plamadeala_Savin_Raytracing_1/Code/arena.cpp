@@ -0,0 +1,63 @@
+#include "arena.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    // Large enough to make the blocks few, and to have malloc map them
+    // separately, so freeing them returns the memory to the system.
+    size_t const BLOCK_SIZE = 1 << 20;
+}
+
+Arena::Arena()
+    :
+    d_free(0),
+    d_end(0),
+    d_capacity(0),
+    d_bytes(0),
+    d_values(0) {}
+
+shared_ptr<Arena> Arena::create() {
+    return shared_ptr<Arena>(new Arena);
+}
+
+Arena::~Arena() {
+    // the blocks go after this, in one go each
+    for (auto destructor = d_destructors.rbegin();
+         destructor != d_destructors.rend(); ++destructor)
+        destructor->destroy(destructor->value);
+}
+
+size_t Arena::values() {
+    lock_guard<mutex> lock(d_mutex);
+    return d_values;
+}
+
+size_t Arena::bytes() {
+    lock_guard<mutex> lock(d_mutex);
+    return d_bytes;
+}
+
+size_t Arena::capacity() {
+    lock_guard<mutex> lock(d_mutex);
+    return d_capacity;
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+    // new[] only guarantees the fundamental alignment, so values are
+    // aligned by their address rather than their offset in the block
+    uintptr_t aligned = (d_free + alignment - 1) & ~(alignment - 1);
+    if (aligned + size > d_end) {
+        size_t blockSize = max(BLOCK_SIZE, size + alignment);
+        d_blocks.emplace_back(new unsigned char[blockSize]);
+        d_free = reinterpret_cast<uintptr_t>(d_blocks.back().get());
+        d_end = d_free + blockSize;
+        d_capacity += blockSize;
+        aligned = (d_free + alignment - 1) & ~(alignment - 1);
+    }
+
+    d_free = aligned + size;
+    d_bytes += size;
+    return reinterpret_cast<void *>(aligned);
+}
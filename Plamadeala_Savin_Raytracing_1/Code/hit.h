@@ -4,6 +4,9 @@
 #include "triple.h"
 #include <limits>
 
+// Returned by Object::distance() when the ray misses the object
+double const NO_DISTANCE = std::numeric_limits<double>::quiet_NaN();
+
 class Hit {
 public:
     double t;   // distance of hit
@@ -36,7 +36,18 @@ public:
     void write_png(std::string const &filename) const;
     void read_png(std::string const &filename);
 
+    // Compare with a reference image of the same size, on the 8-bit
+    // values write_png stores. Returns the PSNR in dB (infinity if the
+    // images are identical); maxError is set to the largest difference
+    // of a single channel (0 - 255).
+    double compare(Image const &reference, unsigned &maxError) const;
+
+    // per channel absolute difference to reference, multiplied by gain
+    Image difference(Image const &reference, double gain = 10.0) const;
+
 private:
+    static unsigned char toByte(double value);
+
     inline unsigned index(unsigned x, unsigned y) const {
         return y * d_width + x;
     }
@@ -1,15 +1,81 @@
+#include "image.h"
 #include "raytracer.h"
 
+#include <exception>
 #include <iostream>
 #include <string>
 
 using namespace std;
 
+namespace {
+    // Thresholds for --check, on 8-bit channel values
+    double const MIN_PSNR = 40.0;       // dB
+    unsigned const MAX_ERROR = 16;      // largest single channel difference
+
+    // Render a scene and compare it with a known good image, to catch
+    // visual regressions. The render is written to outName (if given),
+    // and on failure a difference image next to it (out_diff.png).
+    // Returns 1 on failure.
+    int checkScene(string const &sceneName, string const &referenceName,
+                   string const &outName)
+    try {
+        Image reference(referenceName);
+        if (reference.size() == 0) {
+            cerr << "Error: could not read reference image "
+                 << referenceName << ".\n";
+            return 1;
+        }
+
+        Raytracer raytracer;
+        if (!raytracer.readScene(sceneName)) {
+            cerr << "Error: reading scene from " << sceneName << " failed.\n";
+            return 1;
+        }
+
+        Image img = raytracer.render();
+        if (!outName.empty())
+            img.write_png(outName);
+
+        if (img.width() != reference.width()
+            || img.height() != reference.height()) {
+            cout << "FAIL " << sceneName << ": size " << img.width() << 'x'
+                 << img.height() << ", reference " << reference.width()
+                 << 'x' << reference.height() << '\n';
+            return 1;
+        }
+
+        unsigned maxError;
+        double psnr = img.compare(reference, maxError);
+        bool passed = psnr >= MIN_PSNR && maxError <= MAX_ERROR;
+
+        cout << (passed ? "PASS " : "FAIL ") << sceneName
+             << ": PSNR " << psnr << " dB, max error " << maxError << '\n';
+
+        if (!passed && !outName.empty()) {
+            string diffName = outName.substr(0, outName.find_last_of('.'))
+                              + "_diff.png";
+            img.difference(reference).write_png(diffName);
+            cout << "Difference written to " << diffName << '\n';
+        }
+
+        return passed ? 0 : 1;
+    }
+    catch (exception const &ex) {
+        cerr << "Error: " << ex.what() << '\n';
+        return 1;
+    }
+}
+
 int main(int argc, char *argv[]) {
     cout << "Computer Graphics - Ray tracer\n\n";
 
+    if ((argc == 4 || argc == 5) && string(argv[1]) == "--check")
+        return checkScene(argv[2], argv[3], argc == 5 ? argv[4] : "");
+
     if (argc < 2 || argc > 3) {
-        cerr << "Usage: " << argv[0] << " in-file [out-file.png]\n";
+        cerr << "Usage: " << argv[0] << " in-file [out-file.png]\n"
+             << "       " << argv[0]
+             << " --check in-file reference.png [out-file.png]\n";
         return 1;
     }
 
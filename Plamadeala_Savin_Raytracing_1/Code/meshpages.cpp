@@ -0,0 +1,776 @@
+#include "meshpages.h"
+
+#include "shapes/mesh.h"
+#include "vertex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct MeshPages::Header {
+    char magic[8];
+    uint64_t modelSize;         // of the model file it was built from
+    int64_t modelTime;          // its modification time, in ns
+    double placement[9];        // position, rotation and scale
+    uint32_t pageTriangles;
+    uint32_t triangles;
+    uint32_t pages;
+    uint32_t topNodes;
+    uint64_t fileSize;
+};
+
+struct MeshPages::PageEntry {
+    uint64_t offset;            // of its nodes, its triangles follow them
+    uint64_t bytes;             // including the padding up to the next
+    uint32_t nodes;
+    uint32_t triangles;
+};
+
+namespace {
+    char const MAGIC[8] = {'R', 'T', 'P', 'A', 'G', 'E', 'S', '1'};
+
+    unsigned const LEAF_TRIANGLES = 4;
+
+    // page states
+    uint8_t const RELEASED = 0;
+    uint8_t const RESIDENT = 1;
+    uint8_t const USED = 2;         // resident, used since the hand passed
+
+    // Boxes are widened by this fraction of the mesh size, so rounding in
+    // the box test never drops a triangle the box holds.
+    double const BOX_SLACK = 1e-7;
+
+    // The build sorts this many triangles in memory at once, into runs in
+    // a file that are merged after
+    size_t const CHUNK_TRIANGLES = 1 << 18;
+
+    // The merged triangles are cut into pages this many pages' worth at
+    // a time
+    size_t const WINDOW_PAGES = 64;
+
+    // triangles read ahead from each run while merging them
+    size_t const RUN_BUFFER = 256;
+
+    typedef MeshPages::Node Node;
+    typedef MeshPages::Face Face;
+
+    // the coordinates of a vertex in the model file
+    struct Coordinate {
+        float x;
+        float y;
+        float z;
+    };
+
+    double centroid(Face const &face, int axis) {
+        return face.v[0][axis] + face.v[1][axis] + face.v[2][axis];
+    }
+
+    Node bounds(vector<Face> const &faces, vector<uint32_t> const &order,
+                size_t first, size_t last, double slack) {
+        Node node{};
+        for (int axis = 0; axis != 3; ++axis) {
+            node.lo[axis] = numeric_limits<double>::infinity();
+            node.hi[axis] = -numeric_limits<double>::infinity();
+        }
+        for (size_t idx = first; idx != last; ++idx)
+            for (auto const &vertex : faces[order[idx]].v)
+                for (int axis = 0; axis != 3; ++axis) {
+                    node.lo[axis] = min(node.lo[axis], vertex[axis]);
+                    node.hi[axis] = max(node.hi[axis], vertex[axis]);
+                }
+        for (int axis = 0; axis != 3; ++axis) {
+            node.lo[axis] -= slack;
+            node.hi[axis] += slack;
+        }
+        return node;
+    }
+
+    // Splits the range in halves along the longest axis of the triangle
+    // centroids, returns where the second half starts.
+    size_t split(vector<Face> const &faces, vector<uint32_t> &order,
+                 size_t first, size_t last) {
+        double lo[3];
+        double hi[3];
+        for (int axis = 0; axis != 3; ++axis) {
+            lo[axis] = numeric_limits<double>::infinity();
+            hi[axis] = -numeric_limits<double>::infinity();
+        }
+        for (size_t idx = first; idx != last; ++idx)
+            for (int axis = 0; axis != 3; ++axis) {
+                double center = centroid(faces[order[idx]], axis);
+                lo[axis] = min(lo[axis], center);
+                hi[axis] = max(hi[axis], center);
+            }
+
+        int axis = 0;
+        for (int other = 1; other != 3; ++other)
+            if (hi[other] - lo[other] > hi[axis] - lo[axis])
+                axis = other;
+
+        size_t mid = first + (last - first) / 2;
+        nth_element(order.begin() + first, order.begin() + mid,
+                    order.begin() + last,
+                    [&](uint32_t lhs, uint32_t rhs) {
+                        return centroid(faces[lhs], axis)
+                               < centroid(faces[rhs], axis);
+                    });
+        return mid;
+    }
+
+    // Cuts order[first .. last) into pages of at most pageTriangles
+    // triangles by splitting it in halves, as the nodes in a page are.
+    void splitPages(vector<Face> const &faces, vector<uint32_t> &order,
+                    size_t first, size_t last, size_t pageTriangles,
+                    vector<pair<size_t, size_t>> &pages) {
+        if (last - first <= pageTriangles) {
+            pages.push_back(make_pair(first, last));
+            return;
+        }
+        size_t mid = split(faces, order, first, last);
+        splitPages(faces, order, first, mid, pageTriangles, pages);
+        splitPages(faces, order, mid, last, pageTriangles, pages);
+    }
+
+    // Hierarchy over order[first .. last) of a page in nodes, with leaves
+    // of at most LEAF_TRIANGLES triangles. Leaves hold their first
+    // triangle relative to base, where the page starts.
+    void buildNodes(vector<Face> const &faces, vector<uint32_t> &order,
+                    size_t first, size_t last, size_t base, double slack,
+                    vector<Node> &nodes) {
+        size_t idx = nodes.size();
+        nodes.push_back(bounds(faces, order, first, last, slack));
+
+        if (last - first <= LEAF_TRIANGLES) {
+            nodes[idx].next = first - base;
+            nodes[idx].count = last - first;
+            return;
+        }
+
+        size_t mid = split(faces, order, first, last);
+        buildNodes(faces, order, first, mid, base, slack, nodes);
+        nodes[idx].next = nodes.size();
+        buildNodes(faces, order, mid, last, base, slack, nodes);
+    }
+
+    // Hierarchy over the pages order[first .. last) in nodes, given their
+    // bounds, split in halves along the longest axis of their centers like
+    // the triangles in a page. Its leaves are single pages.
+    void buildTop(vector<Node> const &pages, vector<uint32_t> &order,
+                  size_t first, size_t last, vector<Node> &nodes) {
+        size_t idx = nodes.size();
+        if (last - first == 1) {
+            nodes.push_back(pages[order[first]]);
+            nodes[idx].next = order[first];
+            nodes[idx].count = 1;
+            return;
+        }
+
+        auto center = [&](uint32_t page, int axis) {
+            return pages[page].lo[axis] + pages[page].hi[axis];
+        };
+        Node node{};
+        double lo[3];
+        double hi[3];
+        for (int axis = 0; axis != 3; ++axis) {
+            node.lo[axis] = lo[axis] = numeric_limits<double>::infinity();
+            node.hi[axis] = hi[axis] = -numeric_limits<double>::infinity();
+        }
+        for (size_t page = first; page != last; ++page)
+            for (int axis = 0; axis != 3; ++axis) {
+                Node const &box = pages[order[page]];
+                node.lo[axis] = min(node.lo[axis], box.lo[axis]);
+                node.hi[axis] = max(node.hi[axis], box.hi[axis]);
+                lo[axis] = min(lo[axis], center(order[page], axis));
+                hi[axis] = max(hi[axis], center(order[page], axis));
+            }
+        nodes.push_back(node);
+
+        int axis = 0;
+        for (int other = 1; other != 3; ++other)
+            if (hi[other] - lo[other] > hi[axis] - lo[axis])
+                axis = other;
+
+        size_t mid = first + (last - first) / 2;
+        nth_element(order.begin() + first, order.begin() + mid,
+                    order.begin() + last,
+                    [&](uint32_t lhs, uint32_t rhs) {
+                        return center(lhs, axis) < center(rhs, axis);
+                    });
+        buildTop(pages, order, first, mid, nodes);
+        nodes[idx].next = nodes.size();
+        buildTop(pages, order, mid, last, nodes);
+    }
+
+    // the lower 21 bits of value, spread out to every third bit
+    uint64_t spread(uint64_t value) {
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffffull;
+        value = (value | value << 16) & 0x1f0000ff0000ffull;
+        value = (value | value << 8) & 0x100f00f00f00f00full;
+        value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+        value = (value | value << 2) & 0x1249249249249249ull;
+        return value;
+    }
+
+    // Position of the triangle's centroid along a Morton (Z-order) curve
+    // through the box from lo, so that triangles close in the order are
+    // close in space. scale maps the box's sides to 21 bits.
+    uint64_t mortonKey(Face const &face, double const (&lo)[3],
+                       double const (&scale)[3]) {
+        uint64_t key = 0;
+        for (int axis = 0; axis != 3; ++axis) {
+            double cell = (centroid(face, axis) / 3 - lo[axis])
+                          * scale[axis];
+            cell = min(max(cell, 0.0), double(0x1fffff));
+            key |= spread(static_cast<uint64_t>(cell)) << axis;
+        }
+        return key;
+    }
+
+    // A sorted run of triangles in the runs file, read a buffer at a time
+    struct Run {
+        uint64_t offset;            // of the next triangle not in buffer
+        uint64_t end;
+        vector<Face> buffer;
+        size_t pos;
+
+        // the next triangle, false once the run is used up
+        bool next(int fd, Face &face) {
+            if (pos == buffer.size()) {
+                size_t count = min<uint64_t>(RUN_BUFFER,
+                                             (end - offset) / sizeof(Face));
+                if (count == 0)
+                    return false;
+                buffer.resize(count);
+                size_t bytes = count * sizeof(Face);
+                if (pread(fd, buffer.data(), bytes, offset)
+                    != static_cast<ssize_t>(bytes))
+                    throw runtime_error("Could not read sorted triangles");
+                offset += bytes;
+                pos = 0;
+            }
+            face = buffer[pos++];
+            return true;
+        }
+    };
+
+    size_t aligned(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    size_t systemPageSize() {
+        return max<long>(sysconf(_SC_PAGESIZE), 4096);
+    }
+
+    double msSince(chrono::steady_clock::time_point start) {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+}
+
+// --- Public ------------------------------------------------------------------
+
+MeshPages::MeshPages(string const &objFile, string const &pageFile,
+                     Point const &position, Vector const &rotation,
+                     Vector const &scale, unsigned pageTriangles,
+                     size_t budget)
+    :
+    d_fd(-1),
+    d_base(nullptr),
+    d_size(0),
+    d_header(nullptr),
+    d_pages(nullptr),
+    d_top(nullptr),
+    d_budget(budget),
+    d_visits(0),
+    d_hand(0),
+    d_residentBytes(0) {
+    struct stat info;
+    if (stat(objFile.c_str(), &info) != 0)
+        throw runtime_error("Could not open " + objFile);
+    uint64_t modelSize = info.st_size;
+    int64_t modelTime = info.st_mtim.tv_sec * 1000000000ll
+                        + info.st_mtim.tv_nsec;
+
+    double const placement[9] = {
+        position.x, position.y, position.z,
+        rotation.x, rotation.y, rotation.z,
+        scale.x, scale.y, scale.z
+    };
+    pageTriangles = max(pageTriangles, 1u);
+
+    if (!map(pageFile, modelSize, modelTime, placement, pageTriangles)) {
+        build(objFile, pageFile, modelSize, modelTime, placement,
+              pageTriangles);
+        if (!map(pageFile, modelSize, modelTime, placement, pageTriangles))
+            throw runtime_error("Could not map " + pageFile);
+    }
+
+    // pages are read in when touched, not ahead
+    madvise(d_base, d_size, MADV_RANDOM);
+
+    d_state.reset(new atomic<uint8_t>[numPages()]);
+    for (unsigned idx = 0; idx != numPages(); ++idx)
+        d_state[idx].store(RELEASED);
+
+    cout << "Mapped " << pageFile << ": " << numTriangles()
+         << " triangles in " << numPages() << " pages of at most "
+         << pageBytes() / 1024 << " KB\n";
+}
+
+MeshPages::~MeshPages() {
+    unmap();
+}
+
+unsigned MeshPages::numTriangles() const {
+    return d_header->triangles;
+}
+
+unsigned MeshPages::numPages() const {
+    return d_header->pages;
+}
+
+unsigned MeshPages::pageTriangles() const {
+    return d_header->pageTriangles;
+}
+
+size_t MeshPages::pageBytes() const {
+    size_t largest = 0;
+    for (unsigned idx = 0; idx != numPages(); ++idx)
+        largest = max<size_t>(largest, d_pages[idx].bytes);
+    return largest;
+}
+
+MeshPages::Node const *MeshPages::top() const {
+    return d_header->topNodes == 0 ? nullptr : d_top;
+}
+
+MeshPages::Node const *MeshPages::page(unsigned idx, Face const *&faces) {
+    d_visits.fetch_add(1, memory_order_relaxed);
+    // only written when the state changes, so pages in use by every
+    // thread do not bounce between their caches
+    if (d_state[idx].load(memory_order_relaxed) != USED
+        && d_state[idx].exchange(USED, memory_order_relaxed) == RELEASED)
+        fault(idx);
+
+    PageEntry const &entry = d_pages[idx];
+    Node const *nodes = reinterpret_cast<Node const *>(d_base + entry.offset);
+    faces = reinterpret_cast<Face const *>(nodes + entry.nodes);
+    return nodes;
+}
+
+MeshPages::Stats MeshPages::stats() {
+    lock_guard<mutex> lock(d_mutex);
+    Stats stats = d_stats;
+    stats.visits = d_visits.load();
+    stats.residentBytes = d_residentBytes;
+    return stats;
+}
+
+// --- Private -----------------------------------------------------------------
+
+bool MeshPages::map(string const &pageFile, uint64_t modelSize,
+                    int64_t modelTime, double const (&placement)[9],
+                    unsigned pageTriangles) {
+    d_fd = open(pageFile.c_str(), O_RDONLY);
+    if (d_fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(d_fd, &info) != 0
+        || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+        unmap();
+        return false;
+    }
+    d_size = info.st_size;
+
+    void *base = mmap(nullptr, d_size, PROT_READ, MAP_PRIVATE, d_fd, 0);
+    if (base == MAP_FAILED) {
+        unmap();
+        return false;
+    }
+    d_base = static_cast<unsigned char *>(base);
+    d_header = reinterpret_cast<Header const *>(d_base);
+
+    Header const &header = *d_header;
+    size_t topEnd = sizeof(Header) + header.pages * sizeof(PageEntry)
+                    + header.topNodes * sizeof(Node);
+    bool matches = memcmp(header.magic, MAGIC, sizeof MAGIC) == 0
+                   && header.modelSize == modelSize
+                   && header.modelTime == modelTime
+                   && memcmp(header.placement, placement,
+                             sizeof header.placement) == 0
+                   && header.pageTriangles == pageTriangles
+                   && header.fileSize == d_size
+                   && topEnd <= d_size;
+    if (!matches) {
+        unmap();
+        return false;
+    }
+
+    d_pages = reinterpret_cast<PageEntry const *>(d_base + sizeof(Header));
+    d_top = reinterpret_cast<Node const *>(d_pages + header.pages);
+    for (unsigned idx = 0; idx != header.pages; ++idx)
+        if (d_pages[idx].offset + d_pages[idx].bytes > d_size) {
+            unmap();
+            return false;
+        }
+    return true;
+}
+
+void MeshPages::unmap() {
+    if (d_base)
+        munmap(d_base, d_size);
+    if (d_fd >= 0)
+        close(d_fd);
+    d_fd = -1;
+    d_base = nullptr;
+    d_size = 0;
+    d_header = nullptr;
+    d_pages = nullptr;
+    d_top = nullptr;
+}
+
+void MeshPages::fault(unsigned idx) {
+    lock_guard<mutex> lock(d_mutex);
+    ++d_stats.faults;
+    d_residentBytes += d_pages[idx].bytes;
+    ++d_stats.resident;
+    d_stats.peakResident = max(d_stats.peakResident, d_stats.resident);
+
+    // Release pages not used since the hand last passed them, giving the
+    // others another round. Another thread may still be reading a released
+    // page; it is then simply read in again. The hand goes round at most
+    // twice, in case other threads keep using every page.
+    for (unsigned step = 0; step != 2 * numPages()
+                            && d_budget != 0 && d_residentBytes > d_budget
+                            && d_stats.resident > 1; ++step) {
+        unsigned victim = d_hand;
+        d_hand = d_hand + 1 == numPages() ? 0 : d_hand + 1;
+        if (victim == idx)
+            continue;
+
+        uint8_t state = USED;
+        if (d_state[victim].compare_exchange_strong(state, RESIDENT)
+            || state != RESIDENT
+            || !d_state[victim].compare_exchange_strong(state, RELEASED))
+            continue;
+
+        PageEntry const &entry = d_pages[victim];
+        madvise(d_base + entry.offset, entry.bytes, MADV_DONTNEED);
+        d_residentBytes -= entry.bytes;
+        --d_stats.resident;
+        ++d_stats.evictions;
+    }
+}
+
+void MeshPages::build(string const &objFile, string const &pageFile,
+                      uint64_t modelSize, int64_t modelTime,
+                      double const (&placement)[9], unsigned pageTriangles) {
+    auto start = chrono::steady_clock::now();
+    cout << "Building " << pageFile << " from " << objFile << "...\n";
+
+    Point position(placement[0], placement[1], placement[2]);
+    Vector rotation(placement[3], placement[4], placement[5]);
+    Vector scale(placement[6], placement[7], placement[8]);
+
+    // The model is read twice, as OBJLoader would read it, but without
+    // keeping it: first the vertex coordinates, which the triangles refer
+    // to, then the triangles.
+    vector<Coordinate> coordinates;
+    double lo[3];
+    double hi[3];
+    for (int axis = 0; axis != 3; ++axis) {
+        lo[axis] = numeric_limits<double>::infinity();
+        hi[axis] = -numeric_limits<double>::infinity();
+    }
+    {
+        ifstream model(objFile);
+        if (!model)
+            throw runtime_error("Could not open " + objFile);
+        string line;
+        string token;
+        while (getline(model, line)) {
+            istringstream tokens(line);
+            if (line[0] == '#' || !(tokens >> token) || token != "v")
+                continue;
+            Coordinate coordinate;
+            tokens >> token;
+            coordinate.x = stof(token);
+            tokens >> token;
+            coordinate.y = stof(token);
+            tokens >> token;
+            coordinate.z = stof(token);
+            coordinates.push_back(coordinate);
+
+            Vertex vertex{coordinate.x, coordinate.y, coordinate.z};
+            Point v = Mesh::place(vertex, position, rotation, scale);
+            for (int axis = 0; axis != 3; ++axis) {
+                lo[axis] = min(lo[axis], v.data[axis]);
+                hi[axis] = max(hi[axis], v.data[axis]);
+            }
+        }
+    }
+
+    // the same scale on every axis, so the cells of the curve are cubes
+    double size = 0.0;
+    for (int axis = 0; axis != 3; ++axis)
+        size = max(size, hi[axis] - lo[axis]);
+    double keyScale[3] = {0.0, 0.0, 0.0};
+    for (int axis = 0; axis != 3 && size > 0.0; ++axis)
+        keyScale[axis] = 0x1fffff / size;
+
+    // The triangles are sorted along a Morton curve through their
+    // centroids, a chunk at a time into runs in a file, which are merged
+    // into the pages after. Each page thus takes the next pageTriangles
+    // spatially close triangles.
+    string runsFile = pageFile + ".runs";
+    vector<Run> runs;
+    uint64_t triangles = 0;
+    double extent[3][2];
+    for (int axis = 0; axis != 3; ++axis) {
+        extent[axis][0] = numeric_limits<double>::infinity();
+        extent[axis][1] = -numeric_limits<double>::infinity();
+    }
+    {
+        ofstream out(runsFile, ios::binary);
+        if (!out)
+            throw runtime_error("Could not write " + runsFile);
+
+        vector<Face> chunk;
+        vector<uint64_t> keys;
+        vector<uint32_t> order;
+        chunk.reserve(CHUNK_TRIANGLES);
+        keys.reserve(CHUNK_TRIANGLES);
+        auto writeRun = [&]() {
+            order.resize(chunk.size());
+            for (size_t idx = 0; idx != order.size(); ++idx)
+                order[idx] = idx;
+            sort(order.begin(), order.end(),
+                 [&](uint32_t lhs, uint32_t rhs) {
+                     return keys[lhs] != keys[rhs] ? keys[lhs] < keys[rhs]
+                                                   : lhs < rhs;
+                 });
+
+            Run run{};
+            run.offset = runs.empty() ? 0 : runs.back().end;
+            run.end = run.offset + chunk.size() * sizeof(Face);
+            runs.push_back(run);
+            for (uint32_t idx : order)
+                out.write(reinterpret_cast<char const *>(&chunk[idx]),
+                          sizeof(Face));
+            chunk.clear();
+            keys.clear();
+        };
+
+        ifstream model(objFile);
+        if (!model)
+            throw runtime_error("Could not open " + objFile);
+        string line;
+        string token;
+        Face face{};
+        int corner = 0;
+        while (getline(model, line)) {
+            istringstream tokens(line);
+            if (line[0] == '#' || !(tokens >> token) || token != "f")
+                continue;
+
+            // the corners of a face line, three at a time across the
+            // lines, form the triangles
+            while (tokens >> token) {
+                size_t coord = stoul(token.substr(0, token.find('/'))) - 1;
+                if (coord >= coordinates.size())
+                    throw runtime_error(objFile + ": a face refers to a "
+                                        "missing vertex");
+
+                Coordinate const &c = coordinates[coord];
+                Vertex vertex{c.x, c.y, c.z};
+                Point v = Mesh::place(vertex, position, rotation, scale);
+                for (int axis = 0; axis != 3; ++axis) {
+                    face.v[corner][axis] = v.data[axis];
+                    extent[axis][0] = min(extent[axis][0], v.data[axis]);
+                    extent[axis][1] = max(extent[axis][1], v.data[axis]);
+                }
+                if (++corner != 3)
+                    continue;
+
+                corner = 0;
+                face.index = triangles++;
+                chunk.push_back(face);
+                keys.push_back(mortonKey(face, lo, keyScale));
+                if (chunk.size() == CHUNK_TRIANGLES)
+                    writeRun();
+            }
+        }
+        if (!chunk.empty())
+            writeRun();
+        out.close();
+        if (!out)
+            throw runtime_error("Could not write " + runsFile);
+    }
+    coordinates = vector<Coordinate>();
+
+    double slack = 0.0;
+    for (int axis = 0; axis != 3 && triangles != 0; ++axis)
+        slack = max(slack, extent[axis][1] - extent[axis][0]);
+    slack *= BOX_SLACK;
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.modelSize = modelSize;
+    header.modelTime = modelTime;
+    memcpy(header.placement, placement, sizeof header.placement);
+    header.pageTriangles = pageTriangles;
+    header.triangles = triangles;
+
+    // The merged triangles are taken a window of at most WINDOW_PAGES
+    // pages at a time, cut where the curve leaves the largest cell of the
+    // octree its keys come from, in the second half of the window, so the
+    // window covers a compact part of the mesh. The window is split into
+    // pages like the whole mesh was before there was a curve. Room is
+    // kept in front for the most pages that can give.
+    size_t window = WINDOW_PAGES * pageTriangles;
+    size_t maxPages = triangles == 0 ? 0 : 3 * triangles / pageTriangles + 2;
+
+    // the pages start at page boundaries, so each can be released alone
+    size_t alignment = systemPageSize();
+    vector<PageEntry> entries;
+    vector<Node> pageBounds;
+    size_t offset = aligned(sizeof(Header) + maxPages * sizeof(PageEntry)
+                            + 2 * maxPages * sizeof(Node), alignment);
+
+    string tmpFile = pageFile + ".tmp";
+    ofstream out(tmpFile, ios::binary);
+    if (!out)
+        throw runtime_error("Could not write " + tmpFile);
+
+    int fd = open(runsFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Could not read " + runsFile);
+
+    // the first triangle of every run, the smallest on top
+    typedef tuple<uint64_t, uint64_t, size_t> Head;     // key, index, run
+    priority_queue<Head, vector<Head>, greater<Head>> heads;
+    vector<Face> next(runs.size());
+    for (size_t run = 0; run != runs.size(); ++run)
+        if (runs[run].next(fd, next[run]))
+            heads.emplace(mortonKey(next[run], lo, keyScale),
+                          next[run].index, run);
+
+    vector<Face> faces;
+    vector<uint64_t> keys;
+    vector<uint32_t> order;
+    vector<pair<size_t, size_t>> ranges;
+    vector<Node> nodes;
+    faces.reserve(window);
+    keys.reserve(window);
+    out.seekp(offset);
+    while (true) {
+        while (faces.size() != window && !heads.empty()) {
+            size_t run = get<2>(heads.top());
+            keys.push_back(get<0>(heads.top()));
+            heads.pop();
+            faces.push_back(next[run]);
+            if (runs[run].next(fd, next[run]))
+                heads.emplace(mortonKey(next[run], lo, keyScale),
+                              next[run].index, run);
+        }
+        if (faces.empty())
+            break;
+
+        // the latest cut where a higher bit of the key changes than at
+        // any later one
+        size_t cut = faces.size();
+        if (!heads.empty()) {
+            uint64_t largest = keys.back() ^ get<0>(heads.top());
+            for (size_t tri = faces.size() - 1; tri >= window / 2; --tri) {
+                uint64_t change = keys[tri - 1] ^ keys[tri];
+                if (change > largest && (change ^ largest) > largest) {
+                    largest = change;
+                    cut = tri;
+                }
+            }
+        }
+
+        order.resize(cut);
+        for (size_t tri = 0; tri != cut; ++tri)
+            order[tri] = tri;
+        ranges.clear();
+        splitPages(faces, order, 0, cut, pageTriangles, ranges);
+
+        for (auto const &range : ranges) {
+            size_t first = range.first;
+            size_t last = range.second;
+            nodes.clear();
+            buildNodes(faces, order, first, last, first, slack, nodes);
+            pageBounds.push_back(nodes[0]);
+
+            PageEntry entry;
+            entry.offset = offset;
+            entry.nodes = nodes.size();
+            entry.triangles = last - first;
+            size_t bytes = nodes.size() * sizeof(Node)
+                           + (last - first) * sizeof(Face);
+            entry.bytes = aligned(bytes, alignment);
+            entries.push_back(entry);
+
+            out.write(reinterpret_cast<char const *>(nodes.data()),
+                      nodes.size() * sizeof(Node));
+            for (size_t tri = first; tri != last; ++tri)
+                out.write(reinterpret_cast<char const *>(&faces[order[tri]]),
+                          sizeof(Face));
+            offset += entry.bytes;
+            out.seekp(offset);
+        }
+
+        faces.erase(faces.begin(), faces.begin() + cut);
+        keys.erase(keys.begin(), keys.begin() + cut);
+    }
+    close(fd);
+    unlink(runsFile.c_str());
+
+    header.pages = entries.size();
+    header.topNodes = entries.empty() ? 0 : 2 * entries.size() - 1;
+
+    vector<Node> top;
+    order.resize(pageBounds.size());
+    for (size_t page = 0; page != order.size(); ++page)
+        order[page] = page;
+    if (!pageBounds.empty())
+        buildTop(pageBounds, order, 0, order.size(), top);
+
+    header.fileSize = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<char const *>(&header), sizeof header);
+    out.write(reinterpret_cast<char const *>(entries.data()),
+              entries.size() * sizeof(PageEntry));
+    out.write(reinterpret_cast<char const *>(top.data()),
+              top.size() * sizeof(Node));
+    out.close();
+
+    // the last page is padded too
+    if (!out || truncate(tmpFile.c_str(), offset) != 0
+        || rename(tmpFile.c_str(), pageFile.c_str()) != 0)
+        throw runtime_error("Could not write " + pageFile);
+
+    cout << "Built " << pageFile << " in " << msSince(start) << " ms: "
+         << triangles << " triangles in " << entries.size()
+         << " pages\n";
+}
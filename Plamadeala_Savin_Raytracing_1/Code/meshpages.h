@@ -0,0 +1,117 @@
+#ifndef MESHPAGES_H_
+#define MESHPAGES_H_
+
+#include "triple.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// The triangles of a mesh and a bounding volume hierarchy over them, in a
+// memory mapped file, for meshes that do not fit in memory.
+//
+// The hierarchy is cut into subtrees of at most pageTriangles triangles.
+// A subtree and its triangles form a page: an aligned, contiguous range of
+// the file holding spatially close geometry. The nodes above the pages are
+// stored at the start of the file. The OS reads a page in when it is first
+// touched; once the touched pages exceed the resident budget, pages not
+// used recently are released again (madvise), to be read back in from the
+// file when needed. They are picked by a clock hand going round the pages:
+// a page used since the hand last passed gets another round.
+//
+// The file is built from the model file on first use and rebuilt when the
+// model or its placement changes. The build streams the model: besides 12
+// bytes per vertex it keeps a bounded number of triangles in memory,
+// sorting them along a space filling curve in chunks through a temporary
+// file (see ray_pagebench for the peak), so the model need not fit.
+class MeshPages {
+public:
+    struct Node {
+        double lo[3];
+        double hi[3];
+        uint32_t next;      // inner node: index of its second child, the
+                            // first follows it. Leaf: its first triangle
+                            // in the page, or above the pages, the page.
+        uint32_t count;     // 0 for inner nodes; triangles in a leaf, or
+                            // 1 above the pages
+    };
+
+    struct Face {
+        double v[3][3];     // the vertices, placed in the scene
+        uint64_t index;     // in the model file
+    };
+
+    struct Stats {
+        uint64_t visits = 0;        // page lookups
+        uint64_t faults = 0;        // lookups of pages not resident
+        uint64_t evictions = 0;
+        unsigned resident = 0;      // pages counted against the budget
+        unsigned peakResident = 0;
+        size_t residentBytes = 0;   // of those pages
+    };
+
+private:
+    struct Header;
+    struct PageEntry;
+
+    int d_fd;
+    unsigned char *d_base;
+    size_t d_size;
+    Header const *d_header;
+    PageEntry const *d_pages;
+    Node const *d_top;
+
+    size_t d_budget;                        // bytes, 0 for no limit
+    std::unique_ptr<std::atomic<uint8_t>[]> d_state;    // per page
+    std::atomic<uint64_t> d_visits;
+
+    std::mutex d_mutex;                     // guards the members below
+    unsigned d_hand;                        // the next page to look at
+    size_t d_residentBytes;
+    Stats d_stats;
+
+public:
+    // Map pageFile, (re)building it from objFile first if needed. Throws
+    // on failure. budget is in bytes, 0 for no limit.
+    MeshPages(std::string const &objFile, std::string const &pageFile,
+              Point const &position, Vector const &rotation,
+              Vector const &scale, unsigned pageTriangles, size_t budget);
+    ~MeshPages();
+
+    MeshPages(MeshPages const &) = delete;
+    MeshPages &operator=(MeshPages const &) = delete;
+
+    unsigned numTriangles() const;
+    unsigned numPages() const;
+    unsigned pageTriangles() const;
+    size_t pageBytes() const;       // largest page
+
+    // nodes above the pages, the root first; nullptr for an empty mesh
+    Node const *top() const;
+
+    // The nodes and triangles of page idx, marking it as used. Safe to
+    // call from several threads.
+    Node const *page(unsigned idx, Face const *&faces);
+
+    Stats stats();
+
+private:
+    // returns false if the file is missing or does not match
+    bool map(std::string const &pageFile, uint64_t modelSize,
+             int64_t modelTime, double const (&placement)[9],
+             unsigned pageTriangles);
+    void unmap();
+
+    // account for page idx being read in, releasing others over budget
+    void fault(unsigned idx);
+
+    static void build(std::string const &objFile,
+                      std::string const &pageFile, uint64_t modelSize,
+                      int64_t modelTime, double const (&placement)[9],
+                      unsigned pageTriangles);
+};
+
+#endif
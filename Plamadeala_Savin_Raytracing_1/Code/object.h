@@ -18,8 +18,14 @@ public:
 
     virtual ~Object() = default;
 
-    virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
-    // in derived class
+    // Closest-hit test, must be implemented in derived class.
+    // Returns the distance along the ray to the first intersection, or
+    // NO_DISTANCE if there is none. No normal is computed here; composite
+    // objects store which of their parts was hit in primitive.
+    virtual double distance(Ray const &ray, unsigned &primitive) = 0;
+
+    // Attribute stage, only called for the winning hit of distance()
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive) = 0;
 };
 
 #endif
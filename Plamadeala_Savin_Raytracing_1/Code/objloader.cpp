@@ -31,36 +31,41 @@ vector<Vertex> OBJLoader::vertex_data() const {
     vector<Vertex> data;
 
     // For all vertices in the model, interleave the data
-    for (Vertex_idx const &vertex : d_vertices) {
-        // Add coordinate data
-        Vertex vert;
-
-        vec3 const coord = d_coordinates.at(vertex.d_coord);
-        vert.x = coord.x;
-        vert.y = coord.y;
-        vert.z = coord.z;
-
-        // Add normal data
-        vec3 const norm = d_normals.at(vertex.d_norm);
-        vert.nx = norm.x;
-        vert.ny = norm.y;
-        vert.nz = norm.z;
-
-        // Add texture data (if available)
-        if (d_hasTexCoords) {
-            vec2 const tex = d_texCoords.at(vertex.d_tex);
-            vert.u = tex.u;      // u coordinate
-            vert.v = tex.v;      // v coordinate
-        } else {
-            vert.u = 0;
-            vert.v = 0;
-        }
-        data.push_back(vert);
-    }
+    for (size_t idx = 0; idx != d_vertices.size(); ++idx)
+        data.push_back(vertex(idx));
 
     return data;    // copy elision
 }
 
+Vertex OBJLoader::vertex(size_t idx) const {
+    Vertex_idx const &indices = d_vertices.at(idx);
+
+    // Add coordinate data
+    Vertex vert;
+
+    vec3 const coord = d_coordinates.at(indices.d_coord);
+    vert.x = coord.x;
+    vert.y = coord.y;
+    vert.z = coord.z;
+
+    // Add normal data
+    vec3 const norm = d_normals.at(indices.d_norm);
+    vert.nx = norm.x;
+    vert.ny = norm.y;
+    vert.nz = norm.z;
+
+    // Add texture data (if available)
+    if (d_hasTexCoords) {
+        vec2 const tex = d_texCoords.at(indices.d_tex);
+        vert.u = tex.u;      // u coordinate
+        vert.v = tex.v;      // v coordinate
+    } else {
+        vert.u = 0;
+        vert.v = 0;
+    }
+    return vert;
+}
+
 unsigned OBJLoader::numTriangles() const {
     return d_vertices.size() / 3U;
 }
@@ -61,6 +61,14 @@ public:
      */
     std::vector<Vertex> vertex_data() const;
 
+    /**
+     * @brief vertex
+     * @param idx index of a vertex, three per triangle
+     * @return one element of vertex_data(), without building the
+     *  others
+     */
+    Vertex vertex(size_t idx) const;
+
     unsigned numTriangles() const;
 
     bool hasTexCoords() const;
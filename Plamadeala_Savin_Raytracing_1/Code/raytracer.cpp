@@ -11,6 +11,7 @@
 
 #include "shapes/cylinder.h"
 #include "shapes/mesh.h"
+#include "shapes/pagedmesh.h"
 #include "shapes/quad.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
@@ -28,6 +29,12 @@
 using namespace std;        // no std:: required
 using json = nlohmann::json;
 
+namespace {
+    // defaults for paged meshes
+    unsigned const PAGE_TRIANGLES = 4096;
+    double const RESIDENT_MB = 256.0;
+}
+
 bool Raytracer::parseObjectNode(json const &node) {
     ObjectPtr obj = nullptr;
 
@@ -38,29 +45,41 @@ bool Raytracer::parseObjectNode(json const &node) {
     if (node["type"] == "sphere") {
         Point pos(node["position"]);
         double radius = node["radius"];
-        obj = ObjectPtr(new Sphere(pos, radius));
+        obj = scene.make<Sphere>(pos, radius);
     } else if (node["type"] == "triangle") {
         Point v0(node["v0"]);
         Point v1(node["v1"]);
         Point v2(node["v2"]);
-        obj = ObjectPtr(new Triangle(v0, v1, v2));
+        obj = scene.make<Triangle>(v0, v1, v2);
     } else if (node["type"] == "cylinder") {
         Point position(node["position"]);
         Vector direction(node["direction"]);
         double radius = node["radius"];
-        obj = ObjectPtr(new Cylinder(position, direction, radius));
+        obj = scene.make<Cylinder>(position, direction, radius);
     } else if (node["type"] == "mesh") {
         string filename = node["filename"];
         Point position(node["position"]);
         Vector rotation(node["rotation"]);
         Vector scale(node["scale"]);
-        obj = ObjectPtr(new Mesh(filename, position, rotation, scale));
+        if (node.value("paged", false)) {
+            string pageFile = node.value("pageFile", filename + ".pages");
+            unsigned pageTriangles = node.value("pageTriangles",
+                                                PAGE_TRIANGLES);
+            double residentMB = node.value("residentMB", RESIDENT_MB);
+            shared_ptr<PagedMesh> mesh = scene.make<PagedMesh>(filename,
+                pageFile, position, rotation, scale, pageTriangles,
+                residentMB * 1024 * 1024);
+            pagedMeshes.push_back(mesh);
+            obj = mesh;
+        } else {
+            obj = scene.make<Mesh>(filename, position, rotation, scale);
+        }
     } else if (node["type"] == "quad") {
         Point v0(node["v0"]);
         Point v1(node["v1"]);
         Point v2(node["v2"]);
         Point v3(node["v3"]);
-        obj = ObjectPtr(new Quad(v0, v1, v2, v3));
+        obj = scene.make<Quad>(v0, v1, v2, v3);
     } else {
         cerr << "Unknown object type: " << node["type"] << ".\n";
     }
@@ -129,11 +148,25 @@ catch (exception const &ex) {
     return false;
 }
 
-void Raytracer::renderToFile(string const &ofname) {
+Image Raytracer::render() {
     // TODO: the size may be a settings in your file
     Image img(400, 400);
     cout << "Tracing...\n";
     scene.render(img);
+
+    for (auto const &mesh : pagedMeshes) {
+        MeshPages::Stats stats = mesh->stats();
+        cout << "Paged mesh " << mesh->filename() << ": " << stats.visits
+             << " page lookups, " << stats.faults << " faults, "
+             << stats.evictions << " evictions, " << stats.resident
+             << " pages (" << stats.residentBytes / 1024
+             << " KB) resident, at most " << stats.peakResident << '\n';
+    }
+    return img;
+}
+
+void Raytracer::renderToFile(string const &ofname) {
+    Image img = render();
     cout << "Writing image to " << ofname << "...\n";
     img.write_png(ofname);
     cout << "Done.\n";
@@ -3,20 +3,26 @@
 
 #include "scene.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
 // Forward declerations
+class Image;
 class Light;
 class Material;
+class PagedMesh;
 
 #include "json/json_fwd.h"
 
 class Raytracer {
     Scene scene;
+    std::vector<std::shared_ptr<PagedMesh>> pagedMeshes;   // for their stats
 
 public:
 
     bool readScene(std::string const &ifname);
+    Image render();
     void renderToFile(std::string const &ofname);
 
 private:
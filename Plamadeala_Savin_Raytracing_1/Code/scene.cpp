@@ -12,13 +12,17 @@ using namespace std;
 
 Color Scene::trace(Ray const &ray) {
     // Find hit object and distance
-    Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != objects.size(); ++idx) {
-        Hit hit(objects[idx]->intersect(ray));
-        if (hit.t < min_hit.t) {
-            min_hit = hit;
-            obj = objects[idx];
+    // The objects vector owns the objects, keep a plain pointer to the closest.
+    double min_t = numeric_limits<double>::infinity();
+    unsigned primitive = 0;
+    Object *obj = nullptr;
+    for (ObjectPtr const &object : objects) {
+        unsigned part = 0;
+        double t = object->distance(ray, part);
+        if (t < min_t) {
+            min_t = t;
+            primitive = part;
+            obj = object.get();
         }
     }
 
@@ -26,9 +30,9 @@ Color Scene::trace(Ray const &ray) {
     if (!obj)
         return Color(0.0, 0.0, 0.0);
 
-    Material material = obj->material;          // the hit objects material
-    Point hit = ray.at(min_hit.t);              // the hit point
-    Vector N = min_hit.N;                       // the normal at hit point
+    Material const &material = obj->material;   // the hit objects material
+    Point hit = ray.at(min_t);                  // the hit point
+    Vector N = obj->normal(ray, min_t, primitive); // only for the closest hit
     Vector V = -ray.D;                          // the view vector
 
     /****************************************************
@@ -98,7 +102,7 @@ void Scene::addObject(ObjectPtr obj) {
 }
 
 void Scene::addLight(Light const &light) {
-    lights.push_back(LightPtr(new Light(light)));
+    lights.push_back(make<Light>(light));
 }
 
 void Scene::setEye(Triple const &position) {
@@ -1,10 +1,13 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "arena.h"
 #include "light.h"
 #include "object.h"
 #include "triple.h"
 
+#include <memory>
+#include <utility>
 #include <vector>
 
 // Forward declerations
@@ -12,6 +15,9 @@ class Ray;
 class Image;
 
 class Scene {
+    // The objects and lights made with make() share its arena; objects
+    // may also come from elsewhere.
+    std::shared_ptr<Arena> arena = Arena::create();
     std::vector<ObjectPtr> objects;
     std::vector<LightPtr> lights;   // no ptr needed, but kept for consistency
     Point eye;
@@ -24,6 +30,13 @@ public:
     // render the scene to the given image
     void render(Image &img);
 
+    // a new T, from args, in the memory of the scene, which is released
+    // as a whole once the scene and all of these pointers are gone
+    template <typename T, typename ...Args>
+    std::shared_ptr<T> make(Args &&...args) {
+        return arena->make<T>(std::forward<Args>(args)...);
+    }
+
     void addObject(ObjectPtr obj);
     void addLight(Light const &light);
     void setEye(Triple const &position);
@@ -4,8 +4,12 @@
 
 using namespace std;
 
-Hit Cylinder::intersect(Ray const &ray) {
-    return Hit::NO_HIT(); // placeholder
+double Cylinder::distance(Ray const &ray, unsigned &primitive) {
+    return NO_DISTANCE; // placeholder
+}
+
+Vector Cylinder::normal(Ray const &ray, double t, unsigned primitive) {
+    return Vector(); // placeholder
 }
 
 Cylinder::Cylinder(Point const &pos, Vector const &direction, double radius)
@@ -11,7 +11,8 @@ class Cylinder : public Object {
 public:
     Cylinder(Point const &pos, Vector const &direction, double radius);
 
-    virtual Hit intersect(Ray const &ray);
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
 };
 
 #endif
@@ -10,97 +10,83 @@
 
 using namespace std;
 
-Hit Mesh::intersect(Ray const &ray) {
-    // Find hit object and distance
-    Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != d_tris.size(); ++idx) {
-        Hit hit(d_tris[idx]->intersect(ray));
-        if (hit.t < min_hit.t) {
-            min_hit = hit;
-            obj = d_tris[idx];
+double Mesh::distance(Ray const &ray, unsigned &primitive) {
+    // Find the closest triangle, primitive is its index in d_faces
+    double min_t = numeric_limits<double>::infinity();
+    bool found = false;
+    for (unsigned idx = 0; idx != d_faces.size(); ++idx) {
+        Face const &face = d_faces[idx];
+        double t = Triangle::distance(face.v0, face.v1, face.v2, ray);
+        if (t < min_t) {
+            min_t = t;
+            primitive = idx;
+            found = true;
         }
     }
-    if (!obj) {
-        return Hit::NO_HIT();
+    if (!found) {
+        return NO_DISTANCE;
     }
 
-    return min_hit;
+    return min_t;
+}
+
+Vector Mesh::normal(Ray const &ray, double t, unsigned primitive) {
+    // as Triangle
+    Vector const &N = d_faces[primitive].N;
+    if (N.dot(ray.D) > 0) {
+        return -1 * N;
+    } else return N;
+}
+
+unsigned Mesh::numTriangles() const {
+    return d_faces.size();
+}
+
+size_t Mesh::bytes() const {
+    return sizeof(Mesh) + d_faces.capacity() * sizeof(Face);
 }
 
 Mesh::Mesh(string const &filename, Point const &position, Vector const &rotation, Vector const &scale) {
     OBJLoader model(filename);
-    d_tris.reserve(model.numTriangles());
+    d_faces.reserve(model.numTriangles());
     vector<Vertex> vertices = model.vertex_data();
     for (size_t tri = 0; tri != model.numTriangles(); ++tri) {
-        Vertex one = vertices[tri * 3];
-        Point v0(one.x, one.y, one.z);
-
-        Vertex two = vertices[tri * 3 + 1];
-        Point v1(two.x, two.y, two.z);
-
-        Vertex three = vertices[tri * 3 + 2];
-        Point v2(three.x, three.y, three.z);
-
-        // Apply non-uniform scaling, rotation and translation to the three points
-        // of the triangle (v0, v1, and v2) here.
-
-        // Non-uniform scaling
-        v0 = v0 * scale;
-        v1 = v1 * scale;
-        v2 = v2 * scale;
-
-        // Rotation
-        Point v0_old = v0;
-        Point v1_old = v1;
-        Point v2_old = v2;
-
-        // around the x axis
-        v0.y = (cos(rotation.x) * v0_old.y - sin(rotation.x) * v0_old.z);
-        v0.z = (sin(rotation.x) * v0_old.y + cos(rotation.x) * v0_old.z);
-
-        v1.y = (cos(rotation.x) * v1_old.y - sin(rotation.x) * v1_old.z);
-        v1.z = (sin(rotation.x) * v1_old.y + cos(rotation.x) * v1_old.z);
-
-        v2.y = (cos(rotation.x) * v2_old.y - sin(rotation.x) * v2_old.z);
-        v2.z = (sin(rotation.x) * v2_old.y + cos(rotation.x) * v2_old.z);
-
-        v0_old = v0;
-        v1_old = v1;
-        v2_old = v2;
-
-        // around the y axis
-        v0.x = (cos(rotation.y) * v0_old.x + sin(rotation.y) * v0_old.z);
-        v0.z = (-sin(rotation.y) * v0_old.x + cos(rotation.y) * v0_old.z);
-
-        v1.x = (cos(rotation.y) * v1_old.x + sin(rotation.y) * v1_old.z);
-        v1.z = (-sin(rotation.y) * v1_old.x + cos(rotation.y) * v1_old.z);
-
-        v2.x = (cos(rotation.y) * v2_old.x + sin(rotation.y) * v2_old.z);
-        v2.z = (-sin(rotation.y) * v2_old.x + cos(rotation.y) * v2_old.z);
+        Face face;
+        face.v0 = place(vertices[tri * 3], position, rotation, scale);
+        face.v1 = place(vertices[tri * 3 + 1], position, rotation, scale);
+        face.v2 = place(vertices[tri * 3 + 2], position, rotation, scale);
+        face.N = (face.v1 - face.v0).cross(face.v2 - face.v0).normalized();
+        d_faces.push_back(face);
+    }
 
-        v0_old = v0;
-        v1_old = v1;
-        v2_old = v2;
+    cout << "Loaded model: " << filename << " with " <<
+         model.numTriangles() << " triangles, " <<
+         (d_faces.empty() ? 0 : bytes() / d_faces.size()) <<
+         " bytes per triangle.\n";
+}
 
-        // around the z axis
-        v0.x = (cos(rotation.z) * v0_old.x - sin(rotation.z) * v0_old.y);
-        v0.y = (sin(rotation.z) * v0_old.x + cos(rotation.z) * v0_old.y);
+Point Mesh::place(Vertex const &vertex, Point const &position,
+                  Vector const &rotation, Vector const &scale) {
+    Point v(vertex.x, vertex.y, vertex.z);
 
-        v1.x = (cos(rotation.z) * v1_old.x - sin(rotation.z) * v1_old.y);
-        v1.y = (sin(rotation.z) * v1_old.x + cos(rotation.z) * v1_old.y);
+    // Non-uniform scaling
+    v = v * scale;
 
-        v2.x = (cos(rotation.z) * v2_old.x - sin(rotation.z) * v2_old.y);
-        v2.y = (sin(rotation.z) * v2_old.x + cos(rotation.z) * v2_old.y);
+    // Rotation around the x axis
+    Point old = v;
+    v.y = (cos(rotation.x) * old.y - sin(rotation.x) * old.z);
+    v.z = (sin(rotation.x) * old.y + cos(rotation.x) * old.z);
 
-        // Translation
-        v0 = v0 + position;
-        v1 = v1 + position;
-        v2 = v2 + position;
+    // around the y axis
+    old = v;
+    v.x = (cos(rotation.y) * old.x + sin(rotation.y) * old.z);
+    v.z = (-sin(rotation.y) * old.x + cos(rotation.y) * old.z);
 
-        d_tris.push_back(ObjectPtr(new Triangle(v0, v1, v2)));
-    }
+    // around the z axis
+    old = v;
+    v.x = (cos(rotation.z) * old.x - sin(rotation.z) * old.y);
+    v.y = (sin(rotation.z) * old.x + cos(rotation.z) * old.y);
 
-    cout << "Loaded model: " << filename << " with " <<
-         model.numTriangles() << " triangles.\n";
+    // Translation
+    return v + position;
 }
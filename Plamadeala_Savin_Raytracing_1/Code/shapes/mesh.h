@@ -2,12 +2,23 @@
 #define MESH_H_
 
 #include "../object.h"
+#include "../vertex.h"
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
+// A triangle mesh from a model file. Its triangles are plain geometry, all
+// shaded with the material of the mesh.
 class Mesh : public Object {
-    std::vector<ObjectPtr> d_tris;
+    struct Face {
+        Point v0;           // placed in the scene
+        Point v1;
+        Point v2;
+        Vector N;           // as Triangle
+    };
+
+    std::vector<Face> d_faces;
 
 public:
     Mesh(std::string const &filename,
@@ -15,7 +26,18 @@ public:
          Vector const &rotation,
          Vector const &scale);
 
-    virtual Hit intersect(Ray const &ray);
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
+
+    unsigned numTriangles() const;
+
+    // memory taken by the mesh and its triangles
+    size_t bytes() const;
+
+    // a vertex of the model file scaled, rotated (around x, then y, then
+    // z) and moved into the scene
+    static Point place(Vertex const &vertex, Point const &position,
+                       Vector const &rotation, Vector const &scale);
 };
 
 #endif
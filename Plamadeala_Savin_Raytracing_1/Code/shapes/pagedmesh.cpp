@@ -0,0 +1,141 @@
+#include "pagedmesh.h"
+
+#include "triangle.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace {
+    typedef MeshPages::Node Node;
+    typedef MeshPages::Face Face;
+
+    // the hierarchies are balanced, far less deep than this
+    unsigned const STACK_SIZE = 64;
+
+    // Whether the ray passes through the box of node no further than
+    // tmax; tnear is where it enters.
+    bool hits(Node const &node, Ray const &ray, Vector const &invD,
+              double tmax, double &tnear) {
+        tnear = 0.0;
+        double tfar = tmax;
+        for (int axis = 0; axis != 3; ++axis) {
+            double t1 = (node.lo[axis] - ray.O.data[axis]) * invD.data[axis];
+            double t2 = (node.hi[axis] - ray.O.data[axis]) * invD.data[axis];
+            tnear = fmax(tnear, fmin(t1, t2));
+            tfar = fmin(tfar, fmax(t1, t2));
+        }
+        return tnear <= tfar;
+    }
+
+    // Walks the hierarchy at nodes front to back and calls leaf(node) for
+    // the leaves the ray passes closer than best.
+    template <typename Leaf>
+    void traverse(Node const *nodes, Ray const &ray, Vector const &invD,
+                  double const &best, Leaf leaf) {
+        unsigned stack[STACK_SIZE];
+        unsigned size = 0;
+        double tnear;
+        if (hits(nodes[0], ray, invD, best, tnear))
+            stack[size++] = 0;
+
+        while (size != 0) {
+            Node const &node = nodes[stack[--size]];
+            if (node.count != 0) {
+                leaf(node);
+                continue;
+            }
+
+            // push the far child first, so the near one is popped first
+            unsigned first = &node - nodes + 1;
+            unsigned second = node.next;
+            double tfirst;
+            double tsecond;
+            bool hitFirst = hits(nodes[first], ray, invD, best, tfirst);
+            bool hitSecond = hits(nodes[second], ray, invD, best, tsecond);
+            if (hitFirst && hitSecond && tsecond < tfirst) {
+                stack[size++] = first;
+                stack[size++] = second;
+                continue;
+            }
+            if (hitSecond)
+                stack[size++] = second;
+            if (hitFirst)
+                stack[size++] = first;
+        }
+    }
+
+    Point vertex(Face const &face, int corner) {
+        return Point(face.v[corner][0], face.v[corner][1], face.v[corner][2]);
+    }
+}
+
+double PagedMesh::distance(Ray const &ray, unsigned &primitive) {
+    Node const *top = d_pages->top();
+    if (!top)
+        return NO_DISTANCE;
+
+    Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+    double best = numeric_limits<double>::infinity();
+    uint64_t bestIndex = 0;
+
+    // Of equally distant triangles the first in the model file wins, as
+    // in Mesh, which tests them in file order.
+    traverse(top, ray, invD, best, [&](Node const &pageNode) {
+        unsigned page = pageNode.next;
+        Face const *faces;
+        Node const *nodes = d_pages->page(page, faces);
+        traverse(nodes, ray, invD, best, [&](Node const &leaf) {
+            for (unsigned tri = leaf.next; tri != leaf.next + leaf.count;
+                 ++tri) {
+                Face const &face = faces[tri];
+                double t = Triangle::distance(vertex(face, 0),
+                                              vertex(face, 1),
+                                              vertex(face, 2), ray);
+                if (t < best || (t == best && face.index < bestIndex)) {
+                    best = t;
+                    bestIndex = face.index;
+                    primitive = page * d_pages->pageTriangles() + tri;
+                }
+            }
+        });
+    });
+
+    if (std::isinf(best))
+        return NO_DISTANCE;
+    return best;
+}
+
+Vector PagedMesh::normal(Ray const &ray, double t, unsigned primitive) {
+    Face const *faces;
+    d_pages->page(primitive / d_pages->pageTriangles(), faces);
+    Face const &face = faces[primitive % d_pages->pageTriangles()];
+
+    // as Triangle
+    Point v0 = vertex(face, 0);
+    Vector N = (vertex(face, 1) - v0).cross(vertex(face, 2) - v0).normalized();
+    if (N.dot(ray.D) > 0) {
+        return -1 * N;
+    } else return N;
+}
+
+string const &PagedMesh::filename() const {
+    return d_filename;
+}
+
+MeshPages::Stats PagedMesh::stats() const {
+    return d_pages->stats();
+}
+
+PagedMesh::PagedMesh(string const &filename,
+                     string const &pageFile,
+                     Point const &position,
+                     Vector const &rotation,
+                     Vector const &scale,
+                     unsigned pageTriangles,
+                     size_t budget)
+    :
+    d_filename(filename),
+    d_pages(new MeshPages(filename, pageFile, position, rotation, scale,
+                          pageTriangles, budget)) {}
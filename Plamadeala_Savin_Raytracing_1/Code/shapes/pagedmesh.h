@@ -0,0 +1,35 @@
+#ifndef PAGEDMESH_H_
+#define PAGEDMESH_H_
+
+#include "../meshpages.h"
+#include "../object.h"
+
+#include <memory>
+#include <string>
+
+// A mesh kept out of core: its triangles are traced straight from a
+// memory mapped page file (see MeshPages) instead of being loaded as
+// Triangle objects, and only the pages in use count against the resident
+// budget.
+class PagedMesh : public Object {
+    std::string d_filename;
+    std::unique_ptr<MeshPages> d_pages;
+
+public:
+    // budget in bytes, 0 for no limit
+    PagedMesh(std::string const &filename,
+              std::string const &pageFile,
+              Point const &position,
+              Vector const &rotation,
+              Vector const &scale,
+              unsigned pageTriangles,
+              size_t budget);
+
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
+
+    std::string const &filename() const;
+    MeshPages::Stats stats() const;
+};
+
+#endif
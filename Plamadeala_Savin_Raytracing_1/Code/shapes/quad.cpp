@@ -5,23 +5,32 @@
 
 using namespace std;
 
-Hit Quad::intersect(Ray const &ray) {
-    Hit min_hit(numeric_limits<double>::infinity(), Vector());
+double Quad::distance(Ray const &ray, unsigned &primitive) {
+    double min_t = numeric_limits<double>::infinity();
 
-    Hit first_triangle_hit = first_triangle->intersect(ray);
-    Hit second_triangle_hit = second_triangle->intersect(ray);
+    // primitive 0 is the first triangle, 1 the second one
+    unsigned part = 0;
+    double first_triangle_t = first_triangle->distance(ray, part);
+    double second_triangle_t = second_triangle->distance(ray, part);
 
-    if (first_triangle_hit.t < min_hit.t) {
-        min_hit = first_triangle_hit;
+    if (first_triangle_t < min_t) {
+        min_t = first_triangle_t;
+        primitive = 0;
     }
-    if (second_triangle_hit.t < min_hit.t) {
-        min_hit = second_triangle_hit;
+    if (second_triangle_t < min_t) {
+        min_t = second_triangle_t;
+        primitive = 1;
     }
 
-    if (min_hit.t < numeric_limits<double>::infinity()) {
-        return min_hit;
+    if (min_t < numeric_limits<double>::infinity()) {
+        return min_t;
     }
-    return Hit::NO_HIT();
+    return NO_DISTANCE;
+}
+
+Vector Quad::normal(Ray const &ray, double t, unsigned primitive) {
+    Triangle *triangle = primitive == 0 ? first_triangle : second_triangle;
+    return triangle->normal(ray, t, 0);
 }
 
 Quad::Quad(Point const &v0,
@@ -12,7 +12,8 @@ public:
          Point const &v2,
          Point const &v3);
 
-    virtual Hit intersect(Ray const &ray);
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
 };
 
 #endif
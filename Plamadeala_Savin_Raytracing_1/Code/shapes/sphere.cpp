@@ -19,7 +19,7 @@ bool solveABC(double &a, double &b, double &c, double &x0, double &x1) {
     return true;
 }
 
-Hit Sphere::intersect(Ray const &ray) {
+double Sphere::distance(Ray const &ray, unsigned &primitive) {
     /****************************************************
     * RT1.1: INTERSECTION CALCULATION
     *
@@ -47,10 +47,10 @@ Hit Sphere::intersect(Ray const &ray) {
     double c = (OC.dot(OC)) - (r * r);
 
     if (!solveABC(a, b, c, x0, x1)) {
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
     } else {
         if (x0 < 0 && x1 < 0) {
-            return Hit::NO_HIT();
+            return NO_DISTANCE;
         }
 
         if (x0 > x1 && x1 > 0 && x0 > 0) {
@@ -60,6 +60,10 @@ Hit Sphere::intersect(Ray const &ray) {
         t = x0;
     }
 
+    return t;
+}
+
+Vector Sphere::normal(Ray const &ray, double t, unsigned primitive) {
     /****************************************************
     * RT1.2: NORMAL CALCULATION
     *
@@ -70,9 +74,7 @@ Hit Sphere::intersect(Ray const &ray) {
     ****************************************************/
 
     Vector hitPoint = ray.O + ray.D * t;
-    Vector N = (hitPoint - position).normalized();
-
-    return Hit(t, N);
+    return (hitPoint - position).normalized();
 }
 
 Sphere::Sphere(Point const &pos, double radius)
@@ -7,7 +7,8 @@ class Sphere : public Object {
 public:
     Sphere(Point const &pos, double radius);
 
-    virtual Hit intersect(Ray const &ray);
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
 
     Point const position;
     double const r;
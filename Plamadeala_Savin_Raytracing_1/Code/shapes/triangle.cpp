@@ -1,6 +1,11 @@
 #include "triangle.h"
 
-Hit Triangle::intersect(Ray const &ray) {
+double Triangle::distance(Ray const &ray, unsigned &primitive) {
+    return distance(v0, v1, v2, ray);
+}
+
+double Triangle::distance(Point const &v0, Point const &v1, Point const &v2,
+                          Ray const &ray) {
     // as seen on page 79
     Vector small_a = v0;
     Vector small_b = v1;
@@ -24,24 +29,28 @@ Hit Triangle::intersect(Ray const &ray) {
     double t = -((f * (a * k - j * b) + e * (j * c - a * l) + d * (b * l - k * c)) / M);
 
     if (t < 0) {
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
     }
 
     double gamma = (i * (a * k - j * b) + h * (j * c - a * l) + g * (b * l - k * c)) / M;
 
     if (gamma < 0 || gamma > 1) {
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
     }
 
     double beta = (j * (e * i - h * f) + k * (g * f - d * i) + l * (d * h - e * g)) / M;
 
     if (beta < 0 || beta > 1 - gamma) {
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
     }
 
+    return t;
+}
+
+Vector Triangle::normal(Ray const &ray, double t, unsigned primitive) {
     if (N.dot(ray.D) > 0) {
-        return {t, -1 * N};
-    } else return {t, N};
+        return -1 * N;
+    } else return N;
 }
 
 Triangle::Triangle(Point const &v0,
@@ -9,7 +9,12 @@ public:
              Point const &v1,
              Point const &v2);
 
-    virtual Hit intersect(Ray const &ray);
+    virtual double distance(Ray const &ray, unsigned &primitive);
+    virtual Vector normal(Ray const &ray, double t, unsigned primitive);
+
+    // distance() for a triangle that is not stored as an object
+    static double distance(Point const &v0, Point const &v1, Point const &v2,
+                           Ray const &ray);
 
     Point v0;
     Point v1;
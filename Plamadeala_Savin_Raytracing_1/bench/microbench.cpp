@@ -0,0 +1,306 @@
+// Micro-benchmarks for the intersection kernels.
+//
+// Usage: ray_microbench [out.json]
+//
+// Times Triangle::distance (Cramer's rule) in ns per test, for random and
+// coherent ray distributions with a controlled fraction of hits. It runs
+// against a second, independent implementation (Moller-Trumbore) and the
+// two must agree within tolerance; the program exits with status 1 if they
+// do not. Results are written as JSON to the given file, or to stdout.
+//
+// This tracer's Triple is scalar only, so there is no SIMD variant here;
+// see Raytracing_2's ray_microbench for those.
+
+#include "shapes/triangle.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    size_t const RAYS_PER_WORKLOAD = 1 << 16;
+    double const MIN_SECONDS = 0.05;        // per measurement
+    double const TOLERANCE = 1e-9;          // relative, between variants
+
+    double const NaN = numeric_limits<double>::quiet_NaN();
+
+// --- Workloads ---------------------------------------------------------------
+
+    struct Workload
+    {
+        string distribution;    // "random" or "coherent"
+        double hitRatio;
+        vector<Ray> rays;
+    };
+
+    // Returns a point that the ray from origin must pass through to hit
+    // (hit == true) or miss the shape.
+    typedef function<Point(Point const &origin, bool hit, mt19937 &rng)>
+        TargetFn;
+
+    // Random: origins scattered around the shape.
+    // Coherent: one shared origin and rays in scanline order, like the
+    // primary rays of a camera.
+    vector<Workload> makeWorkloads(function<Point(mt19937 &)> randomOrigin,
+                                   Point const &eye, TargetFn target)
+    {
+        vector<Workload> workloads;
+        mt19937 rng(2022);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+
+        for (string distribution : {"random", "coherent"})
+            for (double hitRatio : {0.0, 0.5, 1.0})
+            {
+                Workload work{distribution, hitRatio, {}};
+                work.rays.reserve(RAYS_PER_WORKLOAD);
+                for (size_t idx = 0; idx != RAYS_PER_WORKLOAD; ++idx)
+                {
+                    Point origin = distribution == "random" ?
+                                   randomOrigin(rng) : eye;
+                    bool hit = unit(rng) < hitRatio;
+                    Point through = target(origin, hit, rng);
+                    work.rays.push_back(
+                        Ray(origin, (through - origin).normalized()));
+                }
+
+                if (distribution == "coherent")
+                    sort(work.rays.begin(), work.rays.end(),
+                        [](Ray const &lhs, Ray const &rhs)
+                        {
+                            int lrow = static_cast<int>(lhs.D.y * 256);
+                            int rrow = static_cast<int>(rhs.D.y * 256);
+                            return lrow != rrow ? lrow < rrow
+                                                : lhs.D.x < rhs.D.x;
+                        });
+
+                workloads.push_back(move(work));
+            }
+
+        return workloads;
+    }
+
+// --- Reference kernel -------------------------------------------------------
+
+    // Moller-Trumbore, on plain doubles
+    double mollerTrumbore(Ray const &ray, Triangle const &tri)
+    {
+        double e1x = tri.v1.x - tri.v0.x;
+        double e1y = tri.v1.y - tri.v0.y;
+        double e1z = tri.v1.z - tri.v0.z;
+        double e2x = tri.v2.x - tri.v0.x;
+        double e2y = tri.v2.y - tri.v0.y;
+        double e2z = tri.v2.z - tri.v0.z;
+
+        double px = ray.D.y * e2z - ray.D.z * e2y;
+        double py = ray.D.z * e2x - ray.D.x * e2z;
+        double pz = ray.D.x * e2y - ray.D.y * e2x;
+
+        double det = e1x * px + e1y * py + e1z * pz;
+        if (det == 0.0)
+            return NaN;
+        double invDet = 1.0 / det;
+
+        double sx = ray.O.x - tri.v0.x;
+        double sy = ray.O.y - tri.v0.y;
+        double sz = ray.O.z - tri.v0.z;
+
+        double u = (sx * px + sy * py + sz * pz) * invDet;
+        if (u < 0.0 or u > 1.0)
+            return NaN;
+
+        double qx = sy * e1z - sz * e1y;
+        double qy = sz * e1x - sx * e1z;
+        double qz = sx * e1y - sy * e1x;
+
+        double v = (ray.D.x * qx + ray.D.y * qy + ray.D.z * qz) * invDet;
+        if (v < 0.0 or u + v > 1.0)
+            return NaN;
+
+        double t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+        return t < 0.0 ? NaN : t;
+    }
+
+// --- Measurement -------------------------------------------------------------
+
+    typedef function<double(size_t)> Kernel;  // test number idx, returns t
+
+    double nsPerTest(size_t count, Kernel const &kernel)
+    {
+        double volatile sink = 0.0;
+        size_t tests = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed(0);
+
+        while (elapsed.count() < MIN_SECONDS)
+        {
+            double sum = 0.0;
+            for (size_t idx = 0; idx != count; ++idx)
+            {
+                double t = kernel(idx);
+                if (t == t)     // skip misses (NaN)
+                    sum += t;
+            }
+            sink = sink + sum;
+            tests += count;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+
+        return elapsed.count() * 1e9 / tests;
+    }
+
+    bool agree(double lhs, double rhs)
+    {
+        bool lhsMiss = lhs != lhs or lhs == numeric_limits<double>::infinity();
+        bool rhsMiss = rhs != rhs or rhs == numeric_limits<double>::infinity();
+        if (lhsMiss or rhsMiss)
+            return lhsMiss == rhsMiss;
+        return abs(lhs - rhs) <= TOLERANCE * max(1.0, abs(rhs));
+    }
+
+    struct Bench
+    {
+        json results = json::array();
+        json validation = json::array();
+        bool valid = true;
+
+        // time all variants of one kernel on a workload and cross-check them
+        void run(string const &name, Workload const &work, size_t count,
+                 vector<pair<string, Kernel>> const &variants)
+        {
+            size_t hits = 0;
+            for (size_t idx = 0; idx != count; ++idx)
+                if (not agree(variants.front().second(idx), NaN))
+                    ++hits;
+
+            for (auto const &variant : variants)
+                results.push_back({
+                    {"kernel", name},
+                    {"variant", variant.first},
+                    {"distribution", work.distribution},
+                    {"hit_ratio", work.hitRatio},
+                    {"measured_hit_ratio", static_cast<double>(hits) / count},
+                    {"ns_per_test", nsPerTest(count, variant.second)}
+                });
+
+            size_t mismatches = 0;
+            for (size_t idx = 0; idx != count; ++idx)
+                for (size_t var = 1; var != variants.size(); ++var)
+                    if (not agree(variants[var].second(idx),
+                                  variants.front().second(idx)))
+                        ++mismatches;
+
+            validation.push_back({
+                {"kernel", name},
+                {"distribution", work.distribution},
+                {"hit_ratio", work.hitRatio},
+                {"tests", count},
+                {"mismatches", mismatches}
+            });
+
+            if (mismatches != 0)
+            {
+                cerr << name << " (" << work.distribution << ", hit ratio "
+                     << work.hitRatio << "): " << mismatches
+                     << " results differ between variants\n";
+                valid = false;
+            }
+        }
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "Usage: " << argv[0] << " [out.json]\n";
+        return 1;
+    }
+
+    Bench bench;
+
+    // -- Triangle in the z = 0 plane --------------------------------------
+
+    Triangle triangle(Point(-100, -100, 0), Point(100, -100, 0),
+                      Point(0, 100, 0));
+    auto triangleOrigin = [](mt19937 &rng)
+    {
+        uniform_real_distribution<double> side(-1000.0, 1000.0);
+        uniform_real_distribution<double> height(200.0, 1000.0);
+        return Point(side(rng), side(rng), height(rng));
+    };
+    // Pick barycentric coordinates well inside the triangle for a hit, or
+    // with one of them clearly negative for a miss.
+    auto triangleTarget = [&](Point const &, bool hit, mt19937 &rng)
+    {
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        double beta;
+        double gamma;
+        if (hit)
+        {
+            do
+            {
+                beta = 0.05 + 0.9 * unit(rng);
+                gamma = 0.05 + 0.9 * unit(rng);
+            }
+            while (beta + gamma > 0.95);
+        }
+        else
+        {
+            beta = -0.05 - unit(rng);
+            gamma = 2.0 * unit(rng) - 0.5;
+            if (unit(rng) < 0.5)
+                swap(beta, gamma);
+        }
+        return triangle.v0 + beta * (triangle.v1 - triangle.v0)
+                           + gamma * (triangle.v2 - triangle.v0);
+    };
+
+    for (Workload const &work : makeWorkloads(triangleOrigin,
+                                              Point(0, 0, 1000),
+                                              triangleTarget))
+    {
+        vector<Ray> const &rays = work.rays;
+        Object &object = triangle;
+        bench.run("triangle", work, rays.size(), {
+            {"cramer", [&](size_t idx)
+                {
+                    unsigned primitive;
+                    return object.distance(rays[idx], primitive);
+                }},
+            {"moller_trumbore", [&](size_t idx)
+                {
+                    return mollerTrumbore(rays[idx], triangle);
+                }}
+        });
+    }
+
+    json report = {
+        {"rays_per_workload", RAYS_PER_WORKLOAD},
+        {"tolerance", TOLERANCE},
+        {"results", bench.results},
+        {"validation", bench.validation}
+    };
+
+    if (argc == 2)
+    {
+        ofstream out(argv[1]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return bench.valid ? 0 : 1;
+}
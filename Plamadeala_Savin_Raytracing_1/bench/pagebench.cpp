@@ -0,0 +1,302 @@
+// Paged (out-of-core) meshes under different resident budgets.
+//
+// Usage: ray_pagebench [triangles] [out.json]
+//
+// Writes a generated terrain of the given number of triangles (default
+// 500000) as a model file in the temporary directory and renders it as a
+// paged mesh with several resident budgets, reporting the time to build
+// and map the page file, the render time, the page lookups, faults and
+// evictions and the growth of the resident set. The peak resident set of
+// the build, which keeps the vertices and a bounded number of triangles in
+// memory, is reported too (in all and per triangle). For comparison, the
+// memory a regular Mesh takes for the same model (in all and per
+// triangle) and the time to load and destroy it are measured (it is too
+// slow to render at this size, having no hierarchy).
+//
+// A small terrain is rendered both ways first: the images must be
+// identical, with the smallest budget too; the program exits with status 1
+// if they are not. Results are written as JSON to the given file, or to
+// stdout.
+
+#include "image.h"
+#include "light.h"
+#include "scene.h"
+
+#include "shapes/mesh.h"
+#include "shapes/pagedmesh.h"
+
+#include "json/json.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const DEFAULT_TRIANGLES = 500000;
+    unsigned const VALIDATION_TRIANGLES = 8192;
+    unsigned const VALIDATION_SIZE = 64;        // of the compared images
+    unsigned const SIZE = 256;                  // of the timed images
+    unsigned const PAGE_TRIANGLES = 4096;
+
+    // resident budgets in MB, 0 for no limit
+    double const BUDGETS[] = {0.0, 16.0, 4.0, 1.0};
+
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // resident set size of the process
+    size_t residentKB()
+    {
+        ifstream statm("/proc/self/statm");
+        size_t pages = 0;
+        size_t resident = 0;
+        statm >> pages >> resident;
+        return resident * sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    // Peak resident set size of the process since resetPeakResident(), or
+    // since it started if the kernel does not allow resetting it.
+    size_t peakResidentKB()
+    {
+        ifstream status("/proc/self/status");
+        string field;
+        while (status >> field)
+            if (field == "VmHWM:")
+            {
+                size_t kb = 0;
+                status >> kb;
+                return kb;
+            }
+        return 0;
+    }
+
+    void resetPeakResident()
+    {
+        ofstream("/proc/self/clear_refs") << "5";
+    }
+
+    // Silences the progress output while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+
+    // A bumpy square of about the given number of triangles, two per grid
+    // cell, written to filename.
+    void writeTerrain(string const &filename, unsigned triangles)
+    {
+        unsigned cells = max(1.0, floor(sqrt(triangles / 2.0)));
+        mt19937 rng(2022);
+        uniform_real_distribution<double> bump(-0.02, 0.02);
+
+        ofstream out(filename);
+        out << "vn 0 0 1\n";
+        for (unsigned y = 0; y <= cells; ++y)
+            for (unsigned x = 0; x <= cells; ++x)
+            {
+                double u = double(x) / cells;
+                double v = double(y) / cells;
+                double height = 0.1 * sin(6.0 * u) * cos(4.0 * v) + bump(rng);
+                out << "v " << u << ' ' << v << ' ' << height << '\n';
+            }
+
+        for (unsigned y = 0; y != cells; ++y)
+            for (unsigned x = 0; x != cells; ++x)
+            {
+                unsigned corner = y * (cells + 1) + x + 1;  // from 1
+                unsigned above = corner + cells + 1;
+                out << "f " << corner << "//1 " << corner + 1 << "//1 "
+                    << above + 1 << "//1\n"
+                    << "f " << corner << "//1 " << above + 1 << "//1 "
+                    << above << "//1\n";
+            }
+    }
+
+    // the terrain fills the view, sloping away from the eye
+    Point const POSITION(0.0, 0.0, -300.0);
+    Vector const ROTATION(-0.6, 0.0, 0.0);
+
+    Image render(ObjectPtr const &mesh, unsigned size)
+    {
+        Scene scene;
+        scene.setEye(Point(size / 2.0, size / 2.0, 1000.0));
+        scene.addLight(Light(Point(-200.0, 600.0, 1500.0),
+                             Color(1.0, 1.0, 1.0)));
+        mesh->material = Material(Color(0.4, 0.8, 0.3), 0.2, 0.7, 0.3, 8.0);
+        scene.addObject(mesh);
+
+        Image img(size, size);
+        scene.render(img);
+        return img;
+    }
+
+    Vector scaleFor(unsigned size)
+    {
+        return Vector(size * 1.4, size * 1.4, size * 1.4);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " [triangles] [out.json]\n";
+        return 1;
+    }
+    unsigned triangles = argc >= 2 ? stoul(argv[1]) : DEFAULT_TRIANGLES;
+
+    string dir = P_tmpdir;
+    string stem = dir + "/ray_pagebench_" + to_string(getpid());
+    string smallModel = stem + "_small.obj";
+    string model = stem + ".obj";
+    bool valid = true;
+
+    // -- Validation against Mesh ------------------------------------------
+    json validation = json::array();
+    writeTerrain(smallModel, VALIDATION_TRIANGLES);
+    {
+        Image reference;
+        {
+            Quiet quiet;
+            ObjectPtr mesh(new Mesh(smallModel, POSITION, ROTATION,
+                                    scaleFor(VALIDATION_SIZE)));
+            reference = render(mesh, VALIDATION_SIZE);
+        }
+
+        for (double budget : {0.0, 0.001})
+        {
+            Quiet quiet;
+            ObjectPtr mesh(new PagedMesh(smallModel, smallModel + ".pages",
+                                         POSITION, ROTATION,
+                                         scaleFor(VALIDATION_SIZE), 256,
+                                         budget * 1024 * 1024));
+            unsigned maxError;
+            render(mesh, VALIDATION_SIZE).compare(reference, maxError);
+            validation.push_back({
+                {"budget_mb", budget},
+                {"max_error", maxError}
+            });
+            if (maxError != 0)
+            {
+                cerr << "Budget " << budget << " MB: the paged mesh renders "
+                     << "differently than Mesh\n";
+                valid = false;
+            }
+        }
+    }
+    remove(smallModel.c_str());
+    remove((smallModel + ".pages").c_str());
+
+    // -- Budgets ----------------------------------------------------------
+    writeTerrain(model, triangles);
+    string pageFile = model + ".pages";
+    json results = json::array();
+    double buildMs = 0.0;
+    size_t buildPeakKB = 0;
+    for (double budget : BUDGETS)
+    {
+        size_t before = residentKB();
+        resetPeakResident();
+        auto start = chrono::steady_clock::now();
+        Quiet quiet;
+        shared_ptr<PagedMesh> mesh(new PagedMesh(model, pageFile, POSITION,
+                                                 ROTATION, scaleFor(SIZE),
+                                                 PAGE_TRIANGLES,
+                                                 budget * 1024 * 1024));
+        double openMs = msSince(start);
+        if (results.empty())
+        {
+            buildMs = openMs;
+            buildPeakKB = peakResidentKB() - min(before, peakResidentKB());
+        }
+
+        start = chrono::steady_clock::now();
+        render(mesh, SIZE);
+        double renderMs = msSince(start);
+
+        MeshPages::Stats stats = mesh->stats();
+        results.push_back({
+            {"budget_mb", budget},
+            {"open_ms", openMs},
+            {"render_ms", renderMs},
+            {"page_lookups", stats.visits},
+            {"faults", stats.faults},
+            {"evictions", stats.evictions},
+            {"peak_resident_pages", stats.peakResident},
+            {"resident_kb", stats.residentBytes / 1024},
+            {"rss_growth_kb", residentKB() - min(before, residentKB())}
+        });
+    }
+
+    // -- Mesh, for its memory ---------------------------------------------
+    size_t before = residentKB();
+    auto start = chrono::steady_clock::now();
+    double meshLoadMs;
+    size_t meshKB;
+    size_t meshBytes;
+    {
+        Quiet quiet;
+        unique_ptr<Mesh> mesh(new Mesh(model, POSITION, ROTATION,
+                                       scaleFor(SIZE)));
+        meshLoadMs = msSince(start);
+        meshKB = residentKB() - min(before, residentKB());
+        meshBytes = mesh->bytes();
+        start = chrono::steady_clock::now();
+    }
+    double meshTeardownMs = msSince(start);
+
+    json report = {
+        {"triangles", triangles},
+        {"page_triangles", PAGE_TRIANGLES},
+        {"image_size", SIZE},
+        {"page_file_build_ms", buildMs},
+        {"page_file_build_peak_rss_growth_kb", buildPeakKB},
+        {"page_file_build_bytes_per_triangle",
+         1024.0 * buildPeakKB / triangles},
+        {"mesh_load_ms", meshLoadMs},
+        {"mesh_rss_growth_kb", meshKB},
+        {"mesh_bytes_per_triangle", double(meshBytes) / triangles},
+        {"mesh_teardown_ms", meshTeardownMs},
+        {"results", results},
+        {"validation", validation}
+    };
+    remove(model.c_str());
+    remove(pageFile.c_str());
+
+    if (argc == 3)
+    {
+        ofstream out(argv[2]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
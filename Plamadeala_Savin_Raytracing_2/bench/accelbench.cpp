@@ -0,0 +1,328 @@
+// Every acceleration backend on every scene.
+//
+// Usage: ray_accelbench [spheres] [scene.json ...]
+//
+// Renders three generated scenes of spheres (default 2000): equal spheres
+// spread uniformly, spheres of widely varying size over a ground quad,
+// and equal spheres in a few dense clusters. The given scene files are
+// rendered as well. Each scene is rendered with the linear, grid, BVH and
+// automatic acceleration, repeatedly for a while, reporting the fastest
+// first render (which builds the structure) and the fastest second one in
+// ms, and which backend the automatic choice picked and how much slower
+// its renders are than the fastest ones. The images must be identical to
+// the linear ones; the program exits with status 1 if they are not. Scenes
+// that cannot be read are reported and skipped. Results are written as
+// JSON to stdout.
+
+#include "image.h"
+#include "light.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "threadpool.h"
+
+#include "shapes/quad.h"
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const DEFAULT_SPHERES = 2000;
+    unsigned const SIZE = 200;              // of the generated images
+    double const EXTENT = SIZE;             // of the cube holding the spheres
+    double const MIN_SECONDS = 0.5;         // per scene and backend
+
+    Scene::Acceleration const BACKENDS[] = {
+        Scene::Acceleration::Linear,
+        Scene::Acceleration::Grid,
+        Scene::Acceleration::Bvh,
+        Scene::Acceleration::Auto
+    };
+
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // Silences the progress output of Scene while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+
+// --- Scenes ------------------------------------------------------------------
+
+    // A scene set up with one acceleration, rendered repeatedly.
+    class Subject
+    {
+        public:
+            virtual ~Subject() = default;
+            virtual Image render(ThreadPool &pool) = 0;
+            // the acceleration the last render used
+            virtual Scene::Acceleration used() const = 0;
+    };
+
+    class FileSubject: public Subject
+    {
+        Raytracer d_raytracer;
+
+        public:
+            FileSubject(string const &filename,
+                        Scene::Acceleration acceleration)
+            {
+                if (not d_raytracer.readScene(filename))
+                    throw runtime_error("cannot read " + filename);
+                d_raytracer.setAcceleration(acceleration);
+            }
+
+            Image render(ThreadPool &pool) override
+            {
+                return d_raytracer.render(pool);
+            }
+
+            Scene::Acceleration used() const override
+            {
+                return d_raytracer.acceleration();
+            }
+    };
+
+    class GeneratedSubject: public Subject
+    {
+        Scene d_scene;
+
+        public:
+            GeneratedSubject(string const &kind, unsigned count,
+                             Scene::Acceleration acceleration)
+            {
+                d_scene.setEye(Point(0.5, 0.5, 2.0) * EXTENT);
+                d_scene.addLight(Light(Point(0.5, 3.0, 3.0) * EXTENT,
+                                       Color(1.0, 1.0, 1.0)));
+                d_scene.setRenderShadows(true);
+                d_scene.setAcceleration(acceleration);
+
+                mt19937 rng(2022);
+                uniform_real_distribution<double> unit(0.0, 1.0);
+                normal_distribution<double> gauss;
+
+                // spheres in the cube behind the image plane, with a
+                // radius giving roughly the same coverage for any count
+                double radius = 0.5 * EXTENT / cbrt(count);
+                vector<Point> centers;
+                for (unsigned idx = 0; idx != 8; ++idx)
+                    centers.push_back(Point(unit(rng), unit(rng), -unit(rng))
+                                      * EXTENT);
+
+                for (unsigned idx = 0; idx != count; ++idx)
+                {
+                    Point position(unit(rng) * EXTENT, unit(rng) * EXTENT,
+                                   -unit(rng) * EXTENT);
+                    double r = radius * 0.5;
+                    if (kind == "mixed")
+                        r = radius * pow(10.0, 1.5 * unit(rng) - 1.0);
+                    else if (kind == "clustered")
+                        position = centers[idx % centers.size()]
+                            + Vector(gauss(rng), gauss(rng), gauss(rng))
+                              * (0.03 * EXTENT);
+                    add(new Sphere(position, r), unit(rng));
+                }
+
+                // a ground quad, much larger than the spheres
+                if (kind == "mixed")
+                    add(new Quad(Point(-1.0, -0.1, 1.0) * EXTENT,
+                                 Point(2.0, -0.1, 1.0) * EXTENT,
+                                 Point(2.0, -0.1, -2.0) * EXTENT,
+                                 Point(-1.0, -0.1, -2.0) * EXTENT), 0.5);
+            }
+
+            Image render(ThreadPool &pool) override
+            {
+                Image img(SIZE, SIZE);
+                d_scene.render(img, pool);
+                return img;
+            }
+
+            Scene::Acceleration used() const override
+            {
+                return d_scene.getAcceleration();
+            }
+
+        private:
+            void add(Object *obj, double hue)
+            {
+                obj->material = Material(Color(hue, 0.5, 1.0 - hue), 0.2,
+                                         0.7, 0.3, 16.0);
+                d_scene.addObject(ObjectPtr(obj));
+            }
+    };
+
+    typedef function<unique_ptr<Subject>(Scene::Acceleration)> Setup;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned count = DEFAULT_SPHERES;
+    int firstFile = 1;
+    if (argc >= 2 and isdigit(argv[1][0]))
+    {
+        count = stoul(argv[1]);
+        firstFile = 2;
+    }
+
+    vector<pair<string, Setup>> scenes;
+    for (string kind : {"equal", "mixed", "clustered"})
+    {
+        scenes.emplace_back(kind + "_spheres",
+                            [kind, count](Scene::Acceleration acceleration)
+        {
+            return unique_ptr<Subject>(
+                new GeneratedSubject(kind, count, acceleration));
+        });
+    }
+    for (int idx = firstFile; idx < argc; ++idx)
+    {
+        string filename = argv[idx];
+        scenes.emplace_back(filename,
+                            [filename](Scene::Acceleration acceleration)
+        {
+            return unique_ptr<Subject>(
+                new FileSubject(filename, acceleration));
+        });
+    }
+
+    ThreadPool pool;
+    json results = json::array();
+    json choices = json::array();
+    json skipped = json::array();
+    bool valid = true;
+
+    for (auto const &scene : scenes)
+    {
+        // a scene that cannot be set up, e.g. for a missing texture, is
+        // reported and skipped
+        json sceneResults = json::array();
+        try
+        {
+            Image reference;
+            // first and second renders
+            double fastest[2] = {INFINITY, INFINITY};
+            double automatic[2] = {0.0, 0.0};
+            string picked;
+
+            for (Scene::Acceleration backend : BACKENDS)
+            {
+                Quiet quiet;
+                Image img;
+                Scene::Acceleration used = backend;
+                double firstMs = INFINITY;
+                double renderMs = INFINITY;
+                auto begin = chrono::steady_clock::now();
+                do
+                {
+                    unique_ptr<Subject> subject = scene.second(backend);
+
+                    auto start = chrono::steady_clock::now();
+                    img = subject->render(pool);
+                    firstMs = min(firstMs, msSince(start));
+
+                    start = chrono::steady_clock::now();
+                    subject->render(pool);
+                    renderMs = min(renderMs, msSince(start));
+                    used = subject->used();
+                }
+                while (msSince(begin) < 1000.0 * MIN_SECONDS);
+
+                unsigned maxError = 0;
+                if (backend == Scene::Acceleration::Linear)
+                    reference = img;
+                else
+                    img.compare(reference, maxError);
+
+                sceneResults.push_back({
+                    {"scene", scene.first},
+                    {"acceleration", Scene::name(backend)},
+                    {"used", Scene::name(used)},
+                    {"first_render_ms", firstMs},
+                    {"render_ms", renderMs},
+                    {"max_error", maxError}
+                });
+
+                if (backend == Scene::Acceleration::Auto)
+                {
+                    automatic[0] = firstMs;
+                    automatic[1] = renderMs;
+                    picked = Scene::name(used);
+                }
+                else
+                {
+                    fastest[0] = min(fastest[0], firstMs);
+                    fastest[1] = min(fastest[1], renderMs);
+                }
+
+                if (maxError != 0)
+                {
+                    cerr << scene.first << ", " << Scene::name(backend)
+                         << ": the image differs from the linear one\n";
+                    valid = false;
+                }
+            }
+
+            choices.push_back({
+                {"scene", scene.first},
+                {"auto_picked", picked},
+                {"first_render_vs_fastest", automatic[0] / fastest[0]},
+                {"render_vs_fastest", automatic[1] / fastest[1]}
+            });
+        }
+        catch (exception const &ex)
+        {
+            cerr << scene.first << ": " << ex.what() << ", skipped\n";
+            skipped.push_back({
+                {"scene", scene.first},
+                {"error", ex.what()}
+            });
+            continue;
+        }
+        results.insert(results.end(), sceneResults.begin(),
+                       sceneResults.end());
+    }
+
+    json report = {
+        {"spheres", count},
+        {"image_size", SIZE},
+        {"results", results},
+        {"auto", choices},
+        {"skipped", skipped}
+    };
+    cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+// Benchmark of the bounding volume hierarchy layouts.
+//
+// Usage: ray_bvhbench [spheres] [out.json]
+//
+// Builds a binary SAH hierarchy over random spheres (uniformly spread, or
+// in a few dense clusters) and collapses it into the 4- and 8-wide
+// layouts, with float and with quantized child boxes. Every layout traces
+// the same closest-hit queries: coherent camera rays from outside the
+// spheres, and random rays starting among them. Reported per layout are
+// the ns and the nodes visited per ray, and the size of the nodes. The
+// layouts must find the same closest sphere for every ray; the program
+// exits with status 1 if they do not.
+// Results are written as JSON to the given file, or to stdout.
+
+#include "bvh.h"
+#include "threadpool.h"
+#include "widebvh.h"
+
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const DEFAULT_SPHERES = 100000;
+    unsigned const RAYS = 1 << 16;
+    double const MIN_SECONDS = 0.2;         // per measurement
+    double const EXTENT = 1000.0;           // the spheres fill a cube this wide
+
+    char const *simdName()
+    {
+#if defined(__AVX__)
+        return "avx";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+// --- Scenes and rays ---------------------------------------------------------
+
+    vector<unique_ptr<Sphere>> makeSpheres(string const &distribution,
+                                           unsigned count)
+    {
+        mt19937 rng(2022);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        normal_distribution<double> gauss;
+
+        // a radius giving roughly the same coverage for any count
+        double radius = 0.5 * EXTENT / cbrt(count);
+
+        vector<Point> centers;
+        for (unsigned idx = 0; idx != 16; ++idx)
+            centers.push_back(Point(unit(rng), unit(rng), unit(rng)) * EXTENT);
+
+        vector<unique_ptr<Sphere>> spheres;
+        for (unsigned idx = 0; idx != count; ++idx)
+        {
+            Point position;
+            if (distribution == "uniform")
+                position = Point(unit(rng), unit(rng), unit(rng)) * EXTENT;
+            else
+                position = centers[idx % centers.size()]
+                    + Vector(gauss(rng), gauss(rng), gauss(rng)) * (0.05 * EXTENT);
+            spheres.emplace_back(
+                new Sphere(position, radius * (0.5 + unit(rng))));
+        }
+        return spheres;
+    }
+
+    // Coherent: a 256 x 256 camera looking at the cube from outside.
+    // Random: origins inside the cube, directions uniform on the sphere.
+    vector<Ray> makeRays(string const &distribution)
+    {
+        vector<Ray> rays;
+        rays.reserve(RAYS);
+        if (distribution == "coherent")
+        {
+            Point eye(0.5 * EXTENT, 0.5 * EXTENT, 3.0 * EXTENT);
+            for (unsigned y = 0; y != 256; ++y)
+                for (unsigned x = 0; x != 256; ++x)
+                {
+                    Point pixel(x * EXTENT / 256, y * EXTENT / 256, EXTENT);
+                    rays.push_back(Ray(eye, (pixel - eye).normalized()));
+                }
+            return rays;
+        }
+
+        mt19937 rng(7);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        normal_distribution<double> gauss;
+        for (unsigned idx = 0; idx != RAYS; ++idx)
+        {
+            Point origin = Point(unit(rng), unit(rng), unit(rng)) * EXTENT;
+            Vector dir(gauss(rng), gauss(rng), gauss(rng));
+            rays.push_back(Ray(origin, dir.normalized()));
+        }
+        return rays;
+    }
+
+// --- Measurement -------------------------------------------------------------
+
+    // closest sphere along ray number idx, counting the visited nodes
+    typedef function<unsigned(size_t idx, unsigned &visited)> Trace;
+
+    double nsPerRay(size_t count, Trace const &trace)
+    {
+        unsigned volatile sink = 0;
+        size_t traced = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed(0);
+
+        while (elapsed.count() < MIN_SECONDS)
+        {
+            unsigned sum = 0;
+            for (size_t idx = 0; idx != count; ++idx)
+            {
+                unsigned visited = 0;
+                sum += trace(idx, visited);
+            }
+            sink = sink + sum;
+            traced += count;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+
+        return elapsed.count() * 1e9 / traced;
+    }
+
+    struct Layout
+    {
+        string name;
+        unsigned nodes;
+        unsigned nodeBytes;
+        Trace trace;
+    };
+
+    // closest-hit test as Scene::closestObject does it
+    template <typename Hierarchy>
+    Trace closestHit(Hierarchy const &hierarchy,
+                     vector<unique_ptr<Sphere>> const &spheres,
+                     vector<Ray> const &rays)
+    {
+        return [&hierarchy, &spheres, &rays](size_t idx, unsigned &visited)
+        {
+            Ray const &ray = rays[idx];
+            double t = numeric_limits<double>::infinity();
+            unsigned closest = spheres.size();
+            hierarchy.traverse(ray, t, [&](unsigned sphere, double &tmax)
+            {
+                unsigned primitive = 0;
+                double dist = spheres[sphere]->distance(ray, primitive);
+                if (dist < tmax or (dist == tmax and sphere < closest))
+                {
+                    tmax = dist;
+                    closest = sphere;
+                }
+            }, &visited);
+            return closest;
+        };
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " [spheres] [out.json]\n";
+        return 1;
+    }
+    unsigned count = argc >= 2 ? stoul(argv[1]) : DEFAULT_SPHERES;
+
+    ThreadPool pool;
+    json results = json::array();
+    json validation = json::array();
+    bool valid = true;
+
+    for (string sceneName : {"uniform", "clustered"})
+    {
+        vector<unique_ptr<Sphere>> spheres = makeSpheres(sceneName, count);
+        vector<Box> bounds;
+        for (auto const &sphere : spheres)
+            bounds.push_back(sphere->bounds());
+
+        Bvh binary;
+        binary.build(bounds, Bvh::Method::Sah, pool);
+        WideBvh<4, false> wide4;
+        WideBvh<4, true> wide4q;
+        WideBvh<8, false> wide8;
+        WideBvh<8, true> wide8q;
+        wide4.build(binary);
+        wide4q.build(binary);
+        wide8.build(binary);
+        wide8q.build(binary);
+
+        for (string rayName : {"coherent", "random"})
+        {
+            vector<Ray> rays = makeRays(rayName);
+            vector<Layout> layouts = {
+                {"binary", binary.stats().nodes, sizeof(Bvh::Node),
+                 closestHit(binary, spheres, rays)},
+                {"wide4", wide4.nodeCount(), wide4.nodeBytes(),
+                 closestHit(wide4, spheres, rays)},
+                {"wide4_quantized", wide4q.nodeCount(), wide4q.nodeBytes(),
+                 closestHit(wide4q, spheres, rays)},
+                {"wide8", wide8.nodeCount(), wide8.nodeBytes(),
+                 closestHit(wide8, spheres, rays)},
+                {"wide8_quantized", wide8q.nodeCount(), wide8q.nodeBytes(),
+                 closestHit(wide8q, spheres, rays)}
+            };
+
+            // the binary hierarchy is the reference
+            vector<unsigned> reference(rays.size());
+            size_t hits = 0;
+            for (size_t idx = 0; idx != rays.size(); ++idx)
+            {
+                unsigned visited = 0;
+                reference[idx] = layouts.front().trace(idx, visited);
+                hits += reference[idx] != spheres.size();
+            }
+
+            for (Layout const &layout : layouts)
+            {
+                size_t visitedTotal = 0;
+                size_t mismatches = 0;
+                for (size_t idx = 0; idx != rays.size(); ++idx)
+                {
+                    unsigned visited = 0;
+                    if (layout.trace(idx, visited) != reference[idx])
+                        ++mismatches;
+                    visitedTotal += visited;
+                }
+
+                results.push_back({
+                    {"scene", sceneName},
+                    {"rays", rayName},
+                    {"layout", layout.name},
+                    {"nodes", layout.nodes},
+                    {"node_bytes", layout.nodeBytes},
+                    {"total_kib", layout.nodes * layout.nodeBytes / 1024.0},
+                    {"hit_ratio", static_cast<double>(hits) / rays.size()},
+                    {"nodes_per_ray",
+                     static_cast<double>(visitedTotal) / rays.size()},
+                    {"ns_per_ray", nsPerRay(rays.size(), layout.trace)}
+                });
+
+                validation.push_back({
+                    {"scene", sceneName},
+                    {"rays", rayName},
+                    {"layout", layout.name},
+                    {"mismatches", mismatches}
+                });
+
+                if (mismatches != 0)
+                {
+                    cerr << layout.name << " (" << sceneName << ", "
+                         << rayName << "): " << mismatches
+                         << " rays differ from the binary hierarchy\n";
+                    valid = false;
+                }
+            }
+        }
+    }
+
+    json report = {
+        {"simd", simdName()},
+        {"spheres", count},
+        {"rays", RAYS},
+        {"results", results},
+        {"validation", validation}
+    };
+
+    if (argc == 3)
+    {
+        ofstream out(argv[2]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Quality of denoised low sample renders versus plain supersampling.
+//
+// Usage: ray_denoisebench scene.json [reference-factor] [out.json]
+//
+// Renders the scene once with reference-factor^2 samples per pixel (default
+// 16) as ground truth, then with 1 ... 4^2 samples per pixel both as is and
+// denoised. For every render the PSNR against the reference and the time
+// spent tracing and denoising are reported as JSON, written to the given
+// file or to stdout.
+
+#include "denoiser.h"
+#include "image.h"
+#include "raytracer.h"
+#include "threadpool.h"
+
+#include "json/json.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const MAX_FACTOR = 4;
+
+    double secondsSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // Silences the progress output of Raytracer while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 or argc > 4)
+    {
+        cerr << "Usage: " << argv[0]
+             << " scene.json [reference-factor] [out.json]\n";
+        return 1;
+    }
+
+    Raytracer raytracer;
+    bool read;
+    {
+        Quiet quiet;
+        read = raytracer.readScene(argv[1]);
+    }
+    if (!read)
+    {
+        cerr << "Error: reading scene from " << argv[1] << " failed.\n";
+        return 1;
+    }
+    raytracer.setDenoise(false);
+    unsigned referenceFactor = argc >= 3 ? stoul(argv[2]) : 16;
+
+    ThreadPool pool;
+    Image reference;
+    {
+        Quiet quiet;
+        raytracer.setSuperSample(referenceFactor);
+        reference = raytracer.render(pool);
+    }
+
+    json results = json::array();
+    for (unsigned factor = 1; factor <= MAX_FACTOR; ++factor)
+    {
+        Quiet quiet;
+        raytracer.setSuperSample(factor);
+
+        auto start = chrono::steady_clock::now();
+        AuxBuffers aux;
+        Image noisy = raytracer.render(pool, &aux);
+        double traceTime = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        Image denoised = Denoiser().denoise(noisy, aux, pool);
+        double denoiseTime = secondsSince(start);
+
+        unsigned maxError;
+        double noisyPsnr = noisy.compare(reference, maxError);
+        double denoisedPsnr = denoised.compare(reference, maxError);
+
+        results.push_back({
+            {"samples_per_pixel", factor * factor},
+            {"trace_s", traceTime},
+            {"denoise_s", denoiseTime},
+            {"psnr", noisyPsnr},
+            {"psnr_denoised", denoisedPsnr}
+        });
+    }
+
+    json report = {
+        {"scene", argv[1]},
+        {"reference_samples_per_pixel", referenceFactor * referenceFactor},
+        {"threads", pool.size()},
+        {"results", results}
+    };
+
+    if (argc == 4)
+    {
+        ofstream out(argv[3]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return 0;
+}
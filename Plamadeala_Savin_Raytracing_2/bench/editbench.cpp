@@ -0,0 +1,309 @@
+// Incremental scene edits versus building the acceleration structure again.
+//
+// Usage: ray_editbench [spheres] [out.json]
+//
+// Sets up a scene of random spheres (default 100000) and edits it through
+// the Scene editing API: small moves, moves across the scene, added,
+// removed and replaced (scaled) spheres and material changes. Every edit is
+// followed by Scene::prepare, as an interactive tool would before tracing
+// again, and the pair is timed. The time of building the BVH from scratch
+// is reported for comparison. After each kind of edit the first hits of
+// random rays are compared with those of a scene built from scratch over
+// the same objects; the program exits with status 1 if any differ.
+// This is done for every BVH layout. Results are written as JSON to the
+// given file, or to stdout.
+
+#include "scene.h"
+#include "threadpool.h"
+
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const DEFAULT_SPHERES = 100000;
+    unsigned const EDITS = 200;             // per kind of edit
+    unsigned const RAYS = 4096;             // for validation
+    double const EXTENT = 1000.0;           // the spheres fill a cube this wide
+
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // Silences the progress output of Scene while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+
+    struct Layout
+    {
+        char const *name;
+        unsigned width;
+        bool quantized;
+    };
+
+    Layout const LAYOUTS[] = {
+        {"binary", 2, false},
+        {"wide4", 4, false},
+        {"wide4_quantized", 4, true},
+        {"wide8", 8, false},
+        {"wide8_quantized", 8, true}
+    };
+
+// --- Scene and edits ---------------------------------------------------------
+
+    class Editor
+    {
+        mt19937 d_rng;
+        uniform_real_distribution<double> d_unit;
+        normal_distribution<double> d_gauss;
+        double d_radius;
+
+        public:
+            explicit Editor(unsigned spheres)
+            :
+                d_rng(2022),
+                d_unit(0.0, 1.0),
+                d_radius(0.5 * EXTENT / cbrt(spheres))
+            {}
+
+            Point position()
+            {
+                return Point(d_unit(d_rng), d_unit(d_rng), d_unit(d_rng))
+                       * EXTENT;
+            }
+
+            ObjectPtr sphere()
+            {
+                ObjectPtr obj(new Sphere(position(),
+                                         d_radius * (0.5 + d_unit(d_rng))));
+                obj->material = Material(Color(0.5, 0.5, 0.5), 0.2, 0.8,
+                                         0.0, 1.0);
+                return obj;
+            }
+
+            unsigned pick(Scene &scene)
+            {
+                return d_rng() % scene.getNumObject();
+            }
+
+            Vector jitter()
+            {
+                return Vector(d_gauss(d_rng), d_gauss(d_rng), d_gauss(d_rng))
+                       * (0.2 * d_radius);
+            }
+
+            double unit()
+            {
+                return d_unit(d_rng);
+            }
+
+            Ray ray()
+            {
+                Vector dir(d_gauss(d_rng), d_gauss(d_rng), d_gauss(d_rng));
+                return Ray(position(), dir.normalized());
+            }
+    };
+
+    // the kinds of edits, each applying one edit to the scene
+    typedef function<void(Scene &, Editor &)> Edit;
+
+    vector<pair<string, Edit>> edits(vector<ObjectPtr> &objects)
+    {
+        return {
+            {"move_small", [&](Scene &scene, Editor &editor)
+            {
+                scene.moveObject(editor.pick(scene), editor.jitter());
+            }},
+            {"move_across", [&](Scene &scene, Editor &editor)
+            {
+                unsigned idx = editor.pick(scene);
+                Point center = objects[idx]->bounds().centroid();
+                scene.moveObject(idx, editor.position() - center);
+            }},
+            {"add", [&](Scene &scene, Editor &editor)
+            {
+                objects.push_back(editor.sphere());
+                scene.addObject(objects.back());
+            }},
+            {"remove", [&](Scene &scene, Editor &editor)
+            {
+                unsigned idx = editor.pick(scene);
+                objects.erase(objects.begin() + idx);
+                scene.removeObject(idx);
+            }},
+            {"replace_scaled", [&](Scene &scene, Editor &editor)
+            {
+                unsigned idx = editor.pick(scene);
+                Box box = objects[idx]->bounds();
+                double radius = 0.5 * (box.hi.x - box.lo.x);
+                ObjectPtr scaled(new Sphere(box.centroid(),
+                                            radius * (0.5 + editor.unit())));
+                scaled->material = objects[idx]->material;
+                objects[idx] = scaled;
+                scene.replaceObject(idx, scaled);
+            }},
+            {"material", [&](Scene &scene, Editor &editor)
+            {
+                unsigned idx = editor.pick(scene);
+                Material material = objects[idx]->material;
+                material.ks = material.ks > 0.0 ? 0.0 : 0.5;
+                scene.setMaterial(idx, material);
+            }}
+        };
+    }
+
+    // Number of rays whose first hit in scene differs from the one in a
+    // scene built from scratch over objects.
+    unsigned mismatches(Scene const &scene, vector<ObjectPtr> const &objects,
+                        Layout const &layout, ThreadPool &pool,
+                        vector<Ray> const &rays, double &buildMs)
+    {
+        Scene fresh;
+        fresh.setAcceleration(Scene::Acceleration::Bvh);
+        fresh.setBvhWidth(layout.width, layout.quantized);
+        for (ObjectPtr const &obj : objects)
+            fresh.addObject(obj);
+
+        auto start = chrono::steady_clock::now();
+        fresh.prepare(pool);
+        buildMs = msSince(start);
+
+        unsigned differ = 0;
+        for (Ray const &ray : rays)
+        {
+            double t;
+            double freshT;
+            unsigned idx = scene.visibleObject(ray, t);
+            unsigned freshIdx = fresh.visibleObject(ray, freshT);
+            if (idx != freshIdx or (idx != objects.size() and t != freshT))
+                ++differ;
+        }
+        return differ;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " [spheres] [out.json]\n";
+        return 1;
+    }
+    unsigned count = argc >= 2 ? stoul(argv[1]) : DEFAULT_SPHERES;
+
+    ThreadPool pool;
+    json results = json::array();
+    json validation = json::array();
+    bool valid = true;
+
+    for (Layout const &layout : LAYOUTS)
+    {
+        Editor editor(count);
+        vector<ObjectPtr> objects;
+        Scene scene;
+        scene.setAcceleration(Scene::Acceleration::Bvh);
+        scene.setBvhWidth(layout.width, layout.quantized);
+        for (unsigned idx = 0; idx != count; ++idx)
+        {
+            objects.push_back(editor.sphere());
+            scene.addObject(objects.back());
+        }
+
+        vector<Ray> rays;
+        for (unsigned idx = 0; idx != RAYS; ++idx)
+            rays.push_back(editor.ray());
+
+        Quiet quiet;
+        scene.prepare(pool);
+
+        for (auto const &edit : edits(objects))
+        {
+            vector<double> times;
+            for (unsigned idx = 0; idx != EDITS; ++idx)
+            {
+                auto start = chrono::steady_clock::now();
+                edit.second(scene, editor);
+                scene.prepare(pool);
+                times.push_back(msSince(start));
+            }
+            sort(times.begin(), times.end());
+
+            double buildMs;
+            unsigned differ = mismatches(scene, objects, layout, pool, rays,
+                                         buildMs);
+
+            double total = 0.0;
+            for (double time : times)
+                total += time;
+
+            results.push_back({
+                {"layout", layout.name},
+                {"edit", edit.first},
+                {"objects", objects.size()},
+                {"mean_ms", total / times.size()},
+                {"median_ms", times[times.size() / 2]},
+                {"max_ms", times.back()},
+                {"full_build_ms", buildMs}
+            });
+            validation.push_back({
+                {"layout", layout.name},
+                {"edit", edit.first},
+                {"mismatches", differ}
+            });
+
+            if (differ != 0)
+            {
+                cerr << layout.name << ", " << edit.first << ": " << differ
+                     << " of " << RAYS
+                     << " rays hit differently than after a full build\n";
+                valid = false;
+            }
+        }
+    }
+
+    json report = {
+        {"spheres", count},
+        {"edits", EDITS},
+        {"results", results},
+        {"validation", validation}
+    };
+
+    if (argc == 3)
+    {
+        ofstream out(argv[2]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// Scene load and teardown times.
+//
+// Usage: ray_loadbench [objects] [out.json]
+//
+// Writes a scene file of the given number of objects (default 500000,
+// spheres and some quads) and 1000 lights to the temporary directory, then
+// reads it with Raytracer::readScene and destroys the Raytracer again,
+// several times. Reported are the fastest load and teardown, and the
+// resident set size before, with the scene loaded and after teardown.
+// Results are written as JSON to the given file, or to stdout.
+
+#include "raytracer.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const DEFAULT_OBJECTS = 500000;
+    unsigned const LIGHTS = 1000;
+    unsigned const QUAD_EVERY = 8;          // one in this many is a quad
+    unsigned const RUNS = 3;
+    double const EXTENT = 1000.0;
+
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // resident set size of the process
+    size_t residentKB()
+    {
+        ifstream statm("/proc/self/statm");
+        size_t pages = 0;
+        size_t resident = 0;
+        statm >> pages >> resident;
+        return resident * sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    // Silences the progress output while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+
+    void writeScene(string const &filename, unsigned objects)
+    {
+        mt19937 rng(2022);
+        uniform_real_distribution<double> coordinate(0.0, EXTENT);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+
+        ofstream out(filename);
+        out << "{\n\"Eye\": [500, 500, 2000],\n\"Lights\": [\n";
+        for (unsigned light = 0; light != LIGHTS; ++light)
+            out << (light == 0 ? "" : ",\n") << "{\"position\": ["
+                << coordinate(rng) << ", " << coordinate(rng)
+                << ", 1500], \"color\": [0.001, 0.001, 0.001]}";
+
+        out << "\n],\n\"Objects\": [\n";
+        for (unsigned obj = 0; obj != objects; ++obj)
+        {
+            double x = coordinate(rng);
+            double y = coordinate(rng);
+            double z = coordinate(rng);
+            out << (obj == 0 ? "" : ",\n");
+            if (obj % QUAD_EVERY == 0)
+                out << "{\"type\": \"quad\", \"v0\": [" << x << ", " << y
+                    << ", " << z << "], \"v1\": [" << x + 2 << ", " << y
+                    << ", " << z << "], \"v2\": [" << x + 2 << ", " << y + 2
+                    << ", " << z << "], \"v3\": [" << x << ", " << y + 2
+                    << ", " << z << "], ";
+            else
+                out << "{\"type\": \"sphere\", \"position\": [" << x << ", "
+                    << y << ", " << z << "], \"radius\": " << 1 + unit(rng)
+                    << ", ";
+            out << "\"material\": {\"color\": [" << unit(rng) << ", "
+                << unit(rng) << ", " << unit(rng) << "], \"ka\": 0.2, "
+                << "\"kd\": 0.7, \"ks\": 0.5, \"n\": 32}}";
+        }
+        out << "\n]\n}\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " [objects] [out.json]\n";
+        return 1;
+    }
+    unsigned objects = argc >= 2 ? stoul(argv[1]) : DEFAULT_OBJECTS;
+
+    string filename = string(P_tmpdir) + "/ray_loadbench_"
+                      + to_string(getpid()) + ".json";
+    writeScene(filename, objects);
+
+    double loadMs = 0.0;
+    double teardownMs = 0.0;
+    size_t beforeKB = residentKB();
+    size_t loadedKB = 0;
+    bool valid = true;
+    for (unsigned run = 0; run != RUNS; ++run)
+    {
+        Quiet quiet;
+        unique_ptr<Raytracer> raytracer(new Raytracer);
+
+        auto start = chrono::steady_clock::now();
+        valid = raytracer->readScene(filename) and valid;
+        double ms = msSince(start);
+        loadMs = run == 0 ? ms : min(loadMs, ms);
+        loadedKB = residentKB();
+
+        start = chrono::steady_clock::now();
+        raytracer.reset();
+        ms = msSince(start);
+        teardownMs = run == 0 ? ms : min(teardownMs, ms);
+    }
+    remove(filename.c_str());
+
+    json report = {
+        {"objects", objects},
+        {"lights", LIGHTS},
+        {"load_ms", loadMs},
+        {"teardown_ms", teardownMs},
+        {"rss_before_kb", beforeKB},
+        {"rss_loaded_kb", loadedKB},
+        {"rss_after_kb", residentKB()}
+    };
+
+    if (argc == 3)
+    {
+        ofstream out(argv[2]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    if (!valid)
+        cerr << "Reading the scene failed\n";
+    return valid ? 0 : 1;
+}
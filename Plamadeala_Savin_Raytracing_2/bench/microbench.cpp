@@ -0,0 +1,561 @@
+// Micro-benchmarks for the intersection kernels and the Triple operations.
+//
+// Usage: ray_microbench [out.json]
+//
+// Times Sphere::distance, Quad::distance and Solvers::quadratic in ns per
+// test, for random and coherent ray distributions with a controlled
+// fraction of hits. Every kernel runs in two variants: "simd", the
+// production code on top of the four-lane Triple, and "scalar", a plain
+// double reference implementation.
+//
+// The Triple operations (add, scale, dot, cross, normalized, reflect and
+// a*s + b) are timed in ns per operation over arrays of TRIPLES elements,
+// again in two variants: "simd", Triple, and "scalar", ScalarTriple, the
+// three double layout with out of line arithmetic Triple had before.
+//
+// The variants must agree within tolerance; the program exits with status
+// 1 if they do not. Results are written as JSON to the given file, or to
+// stdout.
+
+#include "scalartriple.h"
+
+#include "shapes/quad.h"
+#include "shapes/solvers.h"
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    size_t const RAYS_PER_WORKLOAD = 1 << 16;
+    size_t const TRIPLES = 4096;            // per array of operands
+    double const MIN_SECONDS = 0.05;        // per measurement
+    double const TOLERANCE = 1e-9;          // relative, between variants
+
+    double const NaN = numeric_limits<double>::quiet_NaN();
+
+    char const *simdName()
+    {
+#if defined(__AVX__)
+        return "avx";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+// --- Workloads ---------------------------------------------------------------
+
+    struct Workload
+    {
+        string distribution;    // "random" or "coherent"
+        double hitRatio;
+        vector<Ray> rays;
+    };
+
+    // Returns a point that the ray from origin must pass through to hit
+    // (hit == true) or miss the shape.
+    typedef function<Point(Point const &origin, bool hit, mt19937 &rng)>
+        TargetFn;
+
+    // Random: origins scattered around the shape.
+    // Coherent: one shared origin and rays in scanline order, like the
+    // primary rays of a camera.
+    vector<Workload> makeWorkloads(function<Point(mt19937 &)> randomOrigin,
+                                   Point const &eye, TargetFn target)
+    {
+        vector<Workload> workloads;
+        mt19937 rng(2022);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+
+        for (string distribution : {"random", "coherent"})
+            for (double hitRatio : {0.0, 0.5, 1.0})
+            {
+                Workload work{distribution, hitRatio, {}};
+                work.rays.reserve(RAYS_PER_WORKLOAD);
+                for (size_t idx = 0; idx != RAYS_PER_WORKLOAD; ++idx)
+                {
+                    Point origin = distribution == "random" ?
+                                   randomOrigin(rng) : eye;
+                    bool hit = unit(rng) < hitRatio;
+                    Point through = target(origin, hit, rng);
+                    work.rays.push_back(
+                        Ray(origin, (through - origin).normalized()));
+                }
+
+                if (distribution == "coherent")
+                    sort(work.rays.begin(), work.rays.end(),
+                        [](Ray const &lhs, Ray const &rhs)
+                        {
+                            int lrow = static_cast<int>(lhs.D.y * 256);
+                            int rrow = static_cast<int>(rhs.D.y * 256);
+                            return lrow != rrow ? lrow < rrow
+                                                : lhs.D.x < rhs.D.x;
+                        });
+
+                workloads.push_back(move(work));
+            }
+
+        return workloads;
+    }
+
+    // orthonormal vectors perpendicular to dir
+    void basis(Vector const &dir, Vector &u, Vector &v)
+    {
+        Vector helper = abs(dir.x) < 0.9 ? Vector(1, 0, 0) : Vector(0, 1, 0);
+        u = dir.cross(helper).normalized();
+        v = dir.cross(u);
+    }
+
+// --- Scalar reference kernels ------------------------------------------------
+
+    // Plain doubles only, written straight from the textbook formulas.
+
+    double scalarSphere(Ray const &ray, Sphere const &sphere)
+    {
+        double ox = ray.O.x - sphere.position.x;
+        double oy = ray.O.y - sphere.position.y;
+        double oz = ray.O.z - sphere.position.z;
+        double dx = ray.D.x;
+        double dy = ray.D.y;
+        double dz = ray.D.z;
+
+        double a = dx * dx + dy * dy + dz * dz;
+        double b = 2.0 * (dx * ox + dy * oy + dz * oz);
+        double c = ox * ox + oy * oy + oz * oz - sphere.r * sphere.r;
+
+        double discr = b * b - 4.0 * a * c;
+        if (discr < 0.0)
+            return NaN;
+
+        double root = sqrt(discr);
+        double t0 = (-b - root) / (2.0 * a);
+        double t1 = (-b + root) / (2.0 * a);
+        if (t0 >= 0.0)
+            return t0;
+        return t1 >= 0.0 ? t1 : NaN;
+    }
+
+    double scalarQuad(Ray const &ray, Quad const &quad)
+    {
+        double nx = quad.N.x;
+        double ny = quad.N.y;
+        double nz = quad.N.z;
+
+        double denom = nx * ray.D.x + ny * ray.D.y + nz * ray.D.z;
+        if (abs(denom) < numeric_limits<double>::epsilon())
+            return NaN;
+
+        double t = -(nx * (ray.O.x - quad.v0.x) + ny * (ray.O.y - quad.v0.y)
+                     + nz * (ray.O.z - quad.v0.z)) / denom;
+        if (t < 0.0)
+            return NaN;
+
+        double px = ray.O.x + t * ray.D.x - quad.v0.x;
+        double py = ray.O.y + t * ray.D.y - quad.v0.y;
+        double pz = ray.O.z + t * ray.D.z - quad.v0.z;
+
+        double ex = quad.v1.x - quad.v0.x;
+        double ey = quad.v1.y - quad.v0.y;
+        double ez = quad.v1.z - quad.v0.z;
+        double fx = quad.v3.x - quad.v0.x;
+        double fy = quad.v3.y - quad.v0.y;
+        double fz = quad.v3.z - quad.v0.z;
+
+        double u = px * ex + py * ey + pz * ez;
+        double v = px * fx + py * fy + pz * fz;
+        if (0.0 <= u and u <= ex * ex + ey * ey + ez * ez and
+            0.0 <= v and v <= fx * fx + fy * fy + fz * fz)
+            return t;
+        return NaN;
+    }
+
+    // smallest root, NaN if there is none
+    double scalarQuadratic(double a, double b, double c)
+    {
+        double discr = b * b - 4.0 * a * c;
+        if (discr < 0.0)
+            return NaN;
+        return (-b - sqrt(discr)) / (2.0 * a);
+    }
+
+// --- Measurement -------------------------------------------------------------
+
+    typedef function<double(size_t)> Kernel;  // test number idx, returns t
+
+    double nsPerTest(size_t count, Kernel const &kernel)
+    {
+        double volatile sink = 0.0;
+        size_t tests = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed(0);
+
+        while (elapsed.count() < MIN_SECONDS)
+        {
+            double sum = 0.0;
+            for (size_t idx = 0; idx != count; ++idx)
+            {
+                double t = kernel(idx);
+                if (t == t)     // skip misses (NaN)
+                    sum += t;
+            }
+            sink = sink + sum;
+            tests += count;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+
+        return elapsed.count() * 1e9 / tests;
+    }
+
+    bool agree(double lhs, double rhs)
+    {
+        bool lhsMiss = lhs != lhs or lhs == numeric_limits<double>::infinity();
+        bool rhsMiss = rhs != rhs or rhs == numeric_limits<double>::infinity();
+        if (lhsMiss or rhsMiss)
+            return lhsMiss == rhsMiss;
+        return abs(lhs - rhs) <= TOLERANCE * max(1.0, abs(rhs));
+    }
+
+// --- Triple operations -------------------------------------------------------
+
+    typedef function<void()> Pass;      // one operation on all TRIPLES
+
+    double nsPerOperation(Pass const &pass)
+    {
+        size_t operations = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed(0);
+
+        while (elapsed.count() < MIN_SECONDS)
+        {
+            pass();
+            operations += TRIPLES;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+
+        return elapsed.count() * 1e9 / operations;
+    }
+
+    // Operands and results of the operations on one triple type T. Each
+    // operation writes its results to out, dot to dots.
+    template <typename T>
+    struct TripleArrays
+    {
+        vector<T> a;
+        vector<T> b;            // unit vectors, the normals for reflect
+        double s = 1.5;
+        vector<T> out = vector<T>(TRIPLES);
+        vector<double> dots = vector<double>(TRIPLES);
+
+        vector<pair<string, Pass>> passes()
+        {
+            return {
+                {"add", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = a[idx] + b[idx];
+                    }},
+                {"scale", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = a[idx] * s;
+                    }},
+                {"dot", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            dots[idx] = a[idx].dot(b[idx]);
+                    }},
+                {"cross", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = a[idx].cross(b[idx]);
+                    }},
+                {"normalized", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = a[idx].normalized();
+                    }},
+                {"reflect", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = reflect(a[idx], b[idx]);
+                    }},
+                {"a*s + b", [this]
+                    {
+                        for (size_t idx = 0; idx != TRIPLES; ++idx)
+                            out[idx] = a[idx] * s + b[idx];
+                    }}
+            };
+        }
+    };
+
+    struct Bench
+    {
+        json results = json::array();
+        json tripleResults = json::array();
+        json validation = json::array();
+        bool valid = true;
+
+        // time all variants of one kernel on a workload and cross-check them
+        void run(string const &name, Workload const &work, size_t count,
+                 vector<pair<string, Kernel>> const &variants)
+        {
+            size_t hits = 0;
+            for (size_t idx = 0; idx != count; ++idx)
+                if (not agree(variants.front().second(idx), NaN))
+                    ++hits;
+
+            for (auto const &variant : variants)
+                results.push_back({
+                    {"kernel", name},
+                    {"variant", variant.first},
+                    {"distribution", work.distribution},
+                    {"hit_ratio", work.hitRatio},
+                    {"measured_hit_ratio", static_cast<double>(hits) / count},
+                    {"ns_per_test", nsPerTest(count, variant.second)}
+                });
+
+            size_t mismatches = 0;
+            for (size_t idx = 0; idx != count; ++idx)
+                for (size_t var = 1; var != variants.size(); ++var)
+                    if (not agree(variants[var].second(idx),
+                                  variants.front().second(idx)))
+                        ++mismatches;
+
+            validation.push_back({
+                {"kernel", name},
+                {"distribution", work.distribution},
+                {"hit_ratio", work.hitRatio},
+                {"tests", count},
+                {"mismatches", mismatches}
+            });
+
+            if (mismatches != 0)
+            {
+                cerr << name << " (" << work.distribution << ", hit ratio "
+                     << work.hitRatio << "): " << mismatches
+                     << " results differ between variants\n";
+                valid = false;
+            }
+        }
+
+        // time every operation on both triple types and cross-check them
+        void runTriples(TripleArrays<Triple> &simd,
+                        TripleArrays<ScalarTriple> &scalar)
+        {
+            vector<pair<string, Pass>> simdPasses = simd.passes();
+            vector<pair<string, Pass>> scalarPasses = scalar.passes();
+            for (size_t op = 0; op != simdPasses.size(); ++op)
+            {
+                string const &name = simdPasses[op].first;
+                tripleResults.push_back({
+                    {"operation", name},
+                    {"simd_ns_per_op", nsPerOperation(simdPasses[op].second)},
+                    {"scalar_ns_per_op",
+                     nsPerOperation(scalarPasses[op].second)}
+                });
+
+                size_t mismatches = 0;
+                for (size_t idx = 0; idx != TRIPLES; ++idx)
+                {
+                    Triple const &lhs = simd.out[idx];
+                    ScalarTriple const &rhs = scalar.out[idx];
+                    bool same = name == "dot" ?
+                        agree(simd.dots[idx], scalar.dots[idx]) :
+                        agree(lhs.x, rhs.x) and agree(lhs.y, rhs.y)
+                            and agree(lhs.z, rhs.z);
+                    if (not same)
+                        ++mismatches;
+                }
+
+                validation.push_back({
+                    {"kernel", "triple " + name},
+                    {"tests", TRIPLES},
+                    {"mismatches", mismatches}
+                });
+
+                if (mismatches != 0)
+                {
+                    cerr << "triple " << name << ": " << mismatches
+                         << " results differ between variants\n";
+                    valid = false;
+                }
+            }
+        }
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        cerr << "Usage: " << argv[0] << " [out.json]\n";
+        return 1;
+    }
+
+    Bench bench;
+
+    // -- Sphere and the quadratic solver, radius 100 around the origin ----
+
+    Sphere sphere(Point(0, 0, 0), 100);
+    auto sphereOrigin = [](mt19937 &rng)
+    {
+        normal_distribution<double> gauss;
+        Vector dir(gauss(rng), gauss(rng), gauss(rng));
+        return Point(dir.normalized() * 1000.0);
+    };
+    // A ray through a point at distance rho from the centre, in the plane
+    // perpendicular to the view direction, passes the centre at most rho away.
+    auto sphereTarget = [&](Point const &origin, bool hit, mt19937 &rng)
+    {
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        Vector u;
+        Vector v;
+        basis((sphere.position - origin).normalized(), u, v);
+        double angle = 2.0 * M_PI * unit(rng);
+        double rho = hit ? 0.9 * sphere.r * sqrt(unit(rng))
+                         : sphere.r * (1.1 + 2.0 * unit(rng));
+        return sphere.position + rho * (cos(angle) * u + sin(angle) * v);
+    };
+
+    for (Workload const &work : makeWorkloads(sphereOrigin, Point(0, 0, 1000),
+                                              sphereTarget))
+    {
+        vector<Ray> const &rays = work.rays;
+        Object &object = sphere;
+        bench.run("sphere", work, rays.size(), {
+            {"simd", [&](size_t idx)
+                {
+                    unsigned primitive;
+                    return object.distance(rays[idx], primitive);
+                }},
+            {"scalar", [&](size_t idx)
+                {
+                    return scalarSphere(rays[idx], sphere);
+                }}
+        });
+
+        // the coefficients Sphere::distance hands to the solver
+        struct Coefficients { double a; double b; double c; };
+        vector<Coefficients> coefficients;
+        for (Ray const &ray : rays)
+        {
+            Vector L = ray.O - sphere.position;
+            coefficients.push_back({ray.D.dot(ray.D), 2.0 * ray.D.dot(L),
+                                    L.dot(L) - sphere.r * sphere.r});
+        }
+
+        bench.run("quadratic", work, coefficients.size(), {
+            {"simd", [&](size_t idx)
+                {
+                    Coefficients const &co = coefficients[idx];
+                    double x0;
+                    double x1;
+                    if (not Solvers::quadratic(co.a, co.b, co.c, x0, x1))
+                        return NaN;
+                    return x0;
+                }},
+            {"scalar", [&](size_t idx)
+                {
+                    Coefficients const &co = coefficients[idx];
+                    return scalarQuadratic(co.a, co.b, co.c);
+                }}
+        });
+    }
+
+    // -- Quad, 200 x 200 in the z = 0 plane -------------------------------
+
+    Quad quad(Point(-100, -100, 0), Point(100, -100, 0),
+              Point(100, 100, 0), Point(-100, 100, 0));
+    auto quadOrigin = [](mt19937 &rng)
+    {
+        uniform_real_distribution<double> side(-1000.0, 1000.0);
+        uniform_real_distribution<double> height(200.0, 1000.0);
+        return Point(side(rng), side(rng), height(rng));
+    };
+    auto quadTarget = [](Point const &, bool hit, mt19937 &rng)
+    {
+        uniform_real_distribution<double> inside(-95.0, 95.0);
+        uniform_real_distribution<double> outside(105.0, 300.0);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        if (hit)
+            return Point(inside(rng), inside(rng), 0);
+
+        // outside on one side, anywhere along the other axis
+        double across = unit(rng) < 0.5 ? outside(rng) : -outside(rng);
+        double along = 3.0 * inside(rng);
+        return unit(rng) < 0.5 ? Point(across, along, 0)
+                               : Point(along, across, 0);
+    };
+
+    for (Workload const &work : makeWorkloads(quadOrigin, Point(0, 0, 1000),
+                                              quadTarget))
+    {
+        vector<Ray> const &rays = work.rays;
+        Object &object = quad;
+        bench.run("quad", work, rays.size(), {
+            {"simd", [&](size_t idx)
+                {
+                    unsigned primitive;
+                    return object.distance(rays[idx], primitive);
+                }},
+            {"scalar", [&](size_t idx)
+                {
+                    return scalarQuad(rays[idx], quad);
+                }}
+        });
+    }
+
+    // -- Triple operations on random operands ----------------------------
+
+    TripleArrays<Triple> simdTriples;
+    TripleArrays<ScalarTriple> scalarTriples;
+    mt19937 rng(2022);
+    uniform_real_distribution<double> coordinate(-10.0, 10.0);
+    for (size_t idx = 0; idx != TRIPLES; ++idx)
+    {
+        Vector a(coordinate(rng), coordinate(rng), coordinate(rng));
+        Vector b = Vector(coordinate(rng), coordinate(rng),
+                          coordinate(rng)).normalized();
+        simdTriples.a.push_back(a);
+        simdTriples.b.push_back(b);
+        scalarTriples.a.push_back(ScalarTriple(a.x, a.y, a.z));
+        scalarTriples.b.push_back(ScalarTriple(b.x, b.y, b.z));
+    }
+    bench.runTriples(simdTriples, scalarTriples);
+
+    json report = {
+        {"simd", simdName()},
+        {"rays_per_workload", RAYS_PER_WORKLOAD},
+        {"triples", TRIPLES},
+        {"tolerance", TOLERANCE},
+        {"results", bench.results},
+        {"triple_results", bench.tripleResults},
+        {"validation", bench.validation}
+    };
+
+    if (argc == 2)
+    {
+        ofstream out(argv[1]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return bench.valid ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include "scalartriple.h"
+
+#include <cmath>
+
+using namespace std;
+
+ScalarTriple::ScalarTriple(double X, double Y, double Z)
+:
+    x(X),
+    y(Y),
+    z(Z)
+{}
+
+ScalarTriple ScalarTriple::operator+(ScalarTriple const &t) const
+{
+    return ScalarTriple(x + t.x, y + t.y, z + t.z);
+}
+
+ScalarTriple ScalarTriple::operator-(ScalarTriple const &t) const
+{
+    return ScalarTriple(x - t.x, y - t.y, z - t.z);
+}
+
+ScalarTriple ScalarTriple::operator*(double f) const
+{
+    return ScalarTriple(x * f, y * f, z * f);
+}
+
+ScalarTriple ScalarTriple::operator/(double f) const
+{
+    double invf = 1.0 / f;
+    return ScalarTriple(x * invf, y * invf, z * invf);
+}
+
+double ScalarTriple::dot(ScalarTriple const &t) const
+{
+    return x * t.x + y * t.y + z * t.z;
+}
+
+ScalarTriple ScalarTriple::cross(ScalarTriple const &t) const
+{
+    return ScalarTriple(y*t.z - z*t.y,
+                        z*t.x - x*t.z,
+                        x*t.y - y*t.x);
+}
+
+double ScalarTriple::length() const
+{
+    return sqrt(length_2());
+}
+
+double ScalarTriple::length_2() const
+{
+    return x * x + y * y + z * z;
+}
+
+ScalarTriple ScalarTriple::normalized() const
+{
+    return (*this) / length();
+}
+
+ScalarTriple operator*(double f, ScalarTriple const &t)
+{
+    return ScalarTriple(f * t.x, f * t.y, f * t.z);
+}
+
+ScalarTriple reflect(ScalarTriple const &incident, ScalarTriple const &normal)
+{
+    return incident - 2.0 * normal.dot(incident) * normal;
+}
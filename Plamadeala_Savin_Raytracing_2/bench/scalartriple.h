@@ -0,0 +1,33 @@
+#ifndef SCALARTRIPLE_H_
+#define SCALARTRIPLE_H_
+
+// Triple as it was before the four-lane one, for ray_microbench: three
+// doubles, with the arithmetic out of line in scalartriple.cpp so that,
+// as then, every operation is a call.
+class ScalarTriple
+{
+    public:
+        double x;
+        double y;
+        double z;
+
+        explicit ScalarTriple(double X = 0, double Y = 0, double Z = 0);
+
+        ScalarTriple operator+(ScalarTriple const &t) const;
+        ScalarTriple operator-(ScalarTriple const &t) const;
+        ScalarTriple operator*(double f) const;
+        ScalarTriple operator/(double f) const;
+
+        double dot(ScalarTriple const &t) const;
+        ScalarTriple cross(ScalarTriple const &t) const;
+        double length() const;
+        double length_2() const;
+        ScalarTriple normalized() const;
+};
+
+ScalarTriple operator*(double f, ScalarTriple const &t);
+
+// reflect incident in normal
+ScalarTriple reflect(ScalarTriple const &incident, ScalarTriple const &normal);
+
+#endif
@@ -0,0 +1,251 @@
+// Closest-hit loops carrying shared_ptr copies versus plain pointers, on
+// 1 ... N threads.
+//
+// Usage: ray_scalebench [max-threads] [out.json]
+//
+// Casts camera rays at spheres made by Scene::make, so that, as in a
+// rendered scene, all objects share the reference count of the scene's
+// arena. Two closest-hit loops are timed: "copying", as Scene::castRay
+// and Scene::trace were before, copies the ObjectPtr of every closer hit
+// and hands it out and on by value; "plain", as they are now, only keeps
+// a plain Object pointer. Each runs on 1, 2, 4, ... up to max-threads
+// (default: the hardware threads) threads of a ThreadPool, reporting ns
+// per ray and the speedup over one thread. On a single core machine the
+// copies cost little, as nothing contends for the count; the difference
+// shows with several cores.
+//
+// Both loops must find the same objects; the program exits with status 1
+// if they do not. Results are written as JSON to the given file, or to
+// stdout.
+
+#include "scene.h"
+#include "threadpool.h"
+
+#include "shapes/sphere.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    unsigned const SPHERES = 256;
+    unsigned const SIZE = 128;              // rays per side of the image
+    double const EXTENT = 1000.0;           // the spheres fill a cube this wide
+    double const MIN_SECONDS = 0.2;         // per measurement
+
+    double const INF = numeric_limits<double>::infinity();
+
+    // as Scene::castRay was: the closest object is copied whenever a
+    // closer one is found, and returned as an owning pointer
+    pair<ObjectPtr, double> closestCopying(vector<ObjectPtr> const &objects,
+                                           Ray const &ray)
+    {
+        double best = INF;
+        ObjectPtr closest = nullptr;
+        for (unsigned idx = 0; idx != objects.size(); ++idx)
+        {
+            unsigned part = 0;
+            double t = objects[idx]->distance(ray, part);
+            if (t < best)
+            {
+                best = t;
+                closest = objects[idx];
+            }
+        }
+        return pair<ObjectPtr, double>(closest, best);
+    }
+
+    // as Scene::castRay is: only a plain pointer to the closest object
+    pair<Object *, double> closestPlain(vector<ObjectPtr> const &objects,
+                                        Ray const &ray)
+    {
+        double best = INF;
+        Object *closest = nullptr;
+        for (ObjectPtr const &object : objects)
+        {
+            unsigned part = 0;
+            double t = object->distance(ray, part);
+            if (t < best)
+            {
+                best = t;
+                closest = object.get();
+            }
+        }
+        return pair<Object *, double>(closest, best);
+    }
+
+    // One row of rays through the loop, recording the object hit per ray.
+    // As in Scene::trace, the hit object is then used for its normal.
+    typedef function<void(vector<Ray> const &, Object const **)> Row;
+
+    Row copyingRow(vector<ObjectPtr> const &objects)
+    {
+        return [&objects](vector<Ray> const &rays, Object const **hits)
+        {
+            for (unsigned idx = 0; idx != rays.size(); ++idx)
+            {
+                pair<ObjectPtr, double> hit = closestCopying(objects,
+                                                             rays[idx]);
+                ObjectPtr obj = hit.first;      // as trace copied it again
+                if (obj)
+                    obj->normal(rays[idx], hit.second, 0);
+                hits[idx] = obj.get();
+            }
+        };
+    }
+
+    Row plainRow(vector<ObjectPtr> const &objects)
+    {
+        return [&objects](vector<Ray> const &rays, Object const **hits)
+        {
+            for (unsigned idx = 0; idx != rays.size(); ++idx)
+            {
+                pair<Object *, double> hit = closestPlain(objects, rays[idx]);
+                if (hit.first)
+                    hit.first->normal(rays[idx], hit.second, 0);
+                hits[idx] = hit.first;
+            }
+        };
+    }
+
+    // ns per ray of all rows on the given number of threads, the caller
+    // being one of them
+    double time(vector<vector<Ray>> const &rows, Row const &row,
+                unsigned threads, vector<Object const *> &hits)
+    {
+        unique_ptr<ThreadPool> pool;
+        if (threads > 1)
+            pool.reset(new ThreadPool(threads - 1));
+
+        hits.assign(rows.size() * SIZE, nullptr);
+        auto pass = [&]
+        {
+            auto body = [&](unsigned y)
+            {
+                row(rows[y], &hits[y * SIZE]);
+            };
+            if (pool)
+                pool->parallelFor(rows.size(), body);
+            else
+                for (unsigned y = 0; y != rows.size(); ++y)
+                    body(y);
+        };
+
+        pass();                                 // warm up
+        unsigned passes = 0;
+        auto start = chrono::steady_clock::now();
+        chrono::duration<double> elapsed;
+        do
+        {
+            pass();
+            ++passes;
+            elapsed = chrono::steady_clock::now() - start;
+        }
+        while (elapsed.count() < MIN_SECONDS);
+
+        return elapsed.count() * 1e9 / (double(passes) * rows.size() * SIZE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        cerr << "Usage: " << argv[0] << " [max-threads] [out.json]\n";
+        return 1;
+    }
+    unsigned maxThreads = argc >= 2 ? stoul(argv[1])
+                                    : max(thread::hardware_concurrency(), 1u);
+    maxThreads = max(maxThreads, 1u);
+
+    // the spheres, from the scene's arena
+    Scene scene;
+    mt19937 rng(2022);
+    uniform_real_distribution<double> coordinate(0.0, EXTENT);
+    uniform_real_distribution<double> radius(20.0, 60.0);
+    vector<ObjectPtr> objects;
+    for (unsigned idx = 0; idx != SPHERES; ++idx)
+        objects.push_back(scene.make<Sphere>(
+            Point(coordinate(rng), coordinate(rng), coordinate(rng)),
+            radius(rng)));
+
+    // camera rays through the front face of the cube
+    Point eye(EXTENT / 2, EXTENT / 2, 3 * EXTENT);
+    vector<vector<Ray>> rows(SIZE);
+    for (unsigned y = 0; y != SIZE; ++y)
+        for (unsigned x = 0; x != SIZE; ++x)
+        {
+            Point pixel((x + 0.5) * EXTENT / SIZE, (y + 0.5) * EXTENT / SIZE,
+                        EXTENT);
+            rows[y].push_back(Ray(eye, (pixel - eye).normalized()));
+        }
+
+    vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    json results = json::array();
+    bool valid = true;
+    double copyingSingle = 0.0;
+    double plainSingle = 0.0;
+    for (unsigned threads : threadCounts)
+    {
+        vector<Object const *> copyingHits;
+        vector<Object const *> plainHits;
+        double copying = time(rows, copyingRow(objects), threads, copyingHits);
+        double plain = time(rows, plainRow(objects), threads, plainHits);
+        if (threads == 1)
+        {
+            copyingSingle = copying;
+            plainSingle = plain;
+        }
+
+        if (copyingHits != plainHits)
+        {
+            cerr << threads << " threads: the loops hit different objects\n";
+            valid = false;
+        }
+
+        results.push_back({
+            {"threads", threads},
+            {"copying_ns_per_ray", copying},
+            {"plain_ns_per_ray", plain},
+            {"copying_speedup", copyingSingle / copying},
+            {"plain_speedup", plainSingle / plain},
+            {"plain_vs_copying", copying / plain}
+        });
+    }
+
+    json report = {
+        {"spheres", SPHERES},
+        {"rays", SIZE * SIZE},
+        {"hardware_threads", thread::hardware_concurrency()},
+        {"results", results}
+    };
+
+    if (argc == 3)
+    {
+        ofstream out(argv[2]);
+        out << report.dump(2) << '\n';
+    }
+    else
+        cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
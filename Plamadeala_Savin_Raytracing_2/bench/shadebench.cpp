@@ -0,0 +1,135 @@
+// Specialised shading kernels against the generic one, per scene.
+//
+// Usage: ray_shadebench scene.json ...
+//
+// Renders each scene with the shading kernels specialised on the features
+// of every object, as usual, and with the generic kernel that tests those
+// features at run time, repeatedly for a while, and reports the fastest
+// render of each in ms. Only the shading differs, as the hits are found
+// the same way. The images must be identical; the program exits with
+// status 1 if they are not. Results are written as JSON to stdout.
+
+#include "image.h"
+#include "raytracer.h"
+#include "threadpool.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    double const MIN_SECONDS = 0.5;         // per scene and kernel choice
+
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    // Silences the progress output while in scope.
+    class Quiet
+    {
+        streambuf *d_saved;
+
+        public:
+            Quiet()
+            :
+                d_saved(cout.rdbuf(nullptr))
+            {}
+
+            ~Quiet()
+            {
+                cout.rdbuf(d_saved);
+            }
+    };
+
+    // fastest render of the scene in ms, the image in img
+    double fastest(string const &filename, bool specialised, ThreadPool &pool,
+                   Image &img)
+    {
+        Quiet quiet;
+        Raytracer raytracer;
+        if (not raytracer.readScene(filename))
+            throw runtime_error("cannot read " + filename);
+        raytracer.setSpecialisedShading(specialised);
+        raytracer.prepare(pool);
+
+        img = raytracer.render(pool);           // warm up
+        double best = INFINITY;
+        auto begin = chrono::steady_clock::now();
+        do
+        {
+            auto start = chrono::steady_clock::now();
+            raytracer.render(pool);
+            best = min(best, msSince(start));
+        }
+        while (msSince(begin) < 1000.0 * MIN_SECONDS);
+        return best;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " scene.json ...\n";
+        return 1;
+    }
+
+    ThreadPool pool;
+    json results = json::array();
+    bool valid = true;
+
+    for (int idx = 1; idx != argc; ++idx)
+    {
+        string filename = argv[idx];
+        Image specialisedImg;
+        Image genericImg;
+        double specialisedMs;
+        double genericMs;
+        try
+        {
+            specialisedMs = fastest(filename, true, pool, specialisedImg);
+            genericMs = fastest(filename, false, pool, genericImg);
+        }
+        catch (exception const &error)
+        {
+            cerr << error.what() << '\n';
+            return 1;
+        }
+
+        unsigned maxError = 0;
+        specialisedImg.compare(genericImg, maxError);
+        if (maxError != 0)
+        {
+            cerr << filename << ": the generic kernel renders differently\n";
+            valid = false;
+        }
+
+        results.push_back({
+            {"scene", filename},
+            {"specialised_ms", specialisedMs},
+            {"generic_ms", genericMs},
+            {"specialised_vs_generic", genericMs / specialisedMs},
+            {"max_error", maxError}
+        });
+    }
+
+    json report = {
+        {"threads", pool.size()},
+        {"results", results}
+    };
+    cout << report.dump(2) << '\n';
+
+    return valid ? 0 : 1;
+}
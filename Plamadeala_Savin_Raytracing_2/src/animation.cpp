@@ -0,0 +1,48 @@
+#include "animation.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+Track::Track(json const &node)
+{
+    if (!node.is_array() or node.empty())
+        throw runtime_error("Track(): keyframes must be a non-empty array");
+
+    for (json const &key : node)
+        d_keys.emplace_back(key["frame"].get<double>(), Triple(key["value"]));
+
+    sort(d_keys.begin(), d_keys.end(),
+        [](pair<double, Triple> const &lhs, pair<double, Triple> const &rhs)
+        {
+            return lhs.first < rhs.first;
+        });
+}
+
+bool Track::empty() const
+{
+    return d_keys.empty();
+}
+
+Triple Track::at(double frame) const
+{
+    if (frame <= d_keys.front().first)
+        return d_keys.front().second;
+    if (frame >= d_keys.back().first)
+        return d_keys.back().second;
+
+    // first key after frame, there is one before it
+    auto next = upper_bound(d_keys.begin(), d_keys.end(), frame,
+        [](double value, pair<double, Triple> const &key)
+        {
+            return value < key.first;
+        });
+    auto prev = next - 1;
+
+    double weight = (frame - prev->first) / (next->first - prev->first);
+    return prev->second + (next->second - prev->second) * weight;
+}
@@ -0,0 +1,28 @@
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include "triple.h"
+
+#include "json/json_fwd.h"
+
+#include <utility>
+#include <vector>
+
+// Keyframes of a Triple (a position or an offset) over time. Between two
+// keys the value is interpolated linearly, before the first and after the
+// last key it holds still.
+//
+// JSON: [{"frame": 0, "value": [x, y, z]}, {"frame": 24, "value": ...}, ...]
+class Track
+{
+    std::vector<std::pair<double, Triple>> d_keys;     // sorted by frame
+
+    public:
+        Track() = default;
+        explicit Track(nlohmann::json const &node);
+
+        bool empty() const;
+        Triple at(double frame) const;
+};
+
+#endif
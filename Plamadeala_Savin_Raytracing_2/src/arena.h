@@ -0,0 +1,83 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Memory for the objects and lights of a scene, released all at once.
+//
+// Values are placed one after the other in large blocks instead of being
+// allocated one by one. The pointers make() hands out share ownership of
+// the arena instead of each having a count of their own: the values are
+// destroyed and the blocks freed when the last pointer into the arena is
+// gone. Values in the arena must therefore not hold pointers from make()
+// themselves, as the arena would then never be released.
+//
+// make() may be called from several threads.
+class Arena: public std::enable_shared_from_this<Arena>
+{
+    struct Destructor
+    {
+        void (*destroy)(void *value);
+        void *value;
+    };
+
+    std::mutex d_mutex;
+    std::vector<std::unique_ptr<unsigned char[]>> d_blocks;
+    uintptr_t d_free;                       // in the last block
+    uintptr_t d_end;                        // of the last block
+    size_t d_capacity;                      // of all blocks
+    size_t d_bytes;                         // handed out
+    size_t d_values;
+    std::vector<Destructor> d_destructors;  // of the values that need one
+
+    Arena();
+
+    public:
+        static std::shared_ptr<Arena> create();
+        ~Arena();
+
+        Arena(Arena const &) = delete;
+        Arena &operator=(Arena const &) = delete;
+
+        // a new T in the arena, constructed from args
+        template <typename T, typename ...Args>
+        std::shared_ptr<T> make(Args &&...args);
+
+        size_t values();
+        size_t bytes();                 // taken by the values
+        size_t capacity();              // of the blocks
+
+    private:
+        // call with d_mutex locked
+        void *allocate(size_t size, size_t alignment);
+
+        template <typename T>
+        static void destroy(void *value)
+        {
+            static_cast<T *>(value)->~T();
+        }
+};
+
+template <typename T, typename ...Args>
+std::shared_ptr<T> Arena::make(Args &&...args)
+{
+    T *value;
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        value = new (allocate(sizeof(T), alignof(T)))
+                    T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            d_destructors.push_back({&destroy<T>, value});
+        ++d_values;
+    }
+    return std::shared_ptr<T>(shared_from_this(), value);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include "assetloader.h"
+
+#include "texture.h"
+#include "texturecache.h"
+#include "threadpool.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    double msSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+}
+
+AssetLoader::AssetLoader() = default;
+
+AssetLoader::~AssetLoader() = default;
+
+shared_ptr<Texture const> AssetLoader::texture(string const &path)
+{
+    lock_guard<mutex> lock(d_mutex);
+
+    auto found = d_textures.find(path);
+    if (found != d_textures.end())
+    {
+        if (found->second.tiled)
+            return found->second.tiled;
+        return found->second.image;
+    }
+
+    // a missing file fails the scene right away, only decoding is deferred
+    if (!ifstream(path))
+        throw runtime_error("Could not open texture " + path + ".");
+
+    Entry &texture = d_textures[path];
+    if (d_cache)
+        texture.tiled = make_shared<TiledTexture>(d_cache);
+    else
+        texture.image = make_shared<ImageTexture>();
+    if (d_pending++ == 0)
+        d_start = chrono::steady_clock::now();
+    if (!d_pool)
+        d_pool.reset(new ThreadPool);
+
+    // map entries stay put, so the worker can fill in this one
+    Entry *entry = &texture;
+    d_pool->submit([this, entry, path]
+    {
+        auto start = chrono::steady_clock::now();
+        Image image;
+        bool converted = false;
+        bool failed = false;
+        if (entry->tiled)
+        {
+            string tileFile = path + ".tiles";
+            failed = !TiledTexture::convert(path, tileFile, converted)
+                     or !entry->tiled->open(tileFile);
+        }
+        else
+            image.read_png(path);
+        double loadMs = msSince(start);
+
+        lock_guard<mutex> lock(d_mutex);
+        if (entry->image)
+        {
+            entry->image->image = move(image);
+            failed = entry->image->image.size() == 0;
+        }
+        entry->loadMs = loadMs;
+        entry->converted = converted;
+        entry->failed = failed;
+        if (--d_pending == 0)
+            d_done.notify_all();
+    });
+    if (texture.tiled)
+        return texture.tiled;
+    return texture.image;
+}
+
+void AssetLoader::setTextureBudget(size_t budget)
+{
+    lock_guard<mutex> lock(d_mutex);
+    if (d_cache)
+        d_cache->setBudget(budget);
+    else
+        d_cache = make_shared<TextureCache>(budget);
+}
+
+shared_ptr<TextureCache> AssetLoader::cache() const
+{
+    return d_cache;
+}
+
+void AssetLoader::wait()
+{
+    auto start = chrono::steady_clock::now();
+    unique_lock<mutex> lock(d_mutex);
+    d_done.wait(lock, [this]{ return d_pending == 0; });
+
+    unsigned count = 0;
+    for (auto &entry : d_textures)
+    {
+        Entry &texture = entry.second;
+        if (texture.logged)
+            continue;
+        texture.logged = true;
+        ++count;
+
+        if (texture.failed)
+        {
+            // an unopened tiled texture is magenta already
+            cerr << "Could not decode texture " << entry.first
+                 << ", it is shown in magenta.\n";
+            if (texture.image)
+            {
+                texture.image->image = Image(1, 1);
+                texture.image->image(0, 0) = Color(1, 0, 1);
+            }
+        }
+        else if (texture.tiled)
+            cout << (texture.converted ? "Converted" : "Opened")
+                 << " tiled texture " << entry.first << " ("
+                 << texture.tiled->width() << 'x' << texture.tiled->height()
+                 << ") in "
+                 << texture.loadMs << " ms\n";
+        else
+            cout << "Loaded texture " << entry.first << " ("
+                 << texture.image->image.width() << 'x'
+                 << texture.image->image.height() << ") in "
+                 << texture.loadMs << " ms\n";
+    }
+
+    if (count != 0)
+        cout << "Loaded " << count << " textures in " << msSince(d_start)
+             << " ms, waited " << msSince(start) << " ms for them\n";
+
+    // the workers are idle until the next scene is read
+    d_pool.reset();
+}
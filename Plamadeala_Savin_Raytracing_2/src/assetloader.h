@@ -0,0 +1,71 @@
+#ifndef ASSETLOADER_H_
+#define ASSETLOADER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ImageTexture;
+class Texture;
+class TextureCache;
+class ThreadPool;
+class TiledTexture;
+
+// Decodes the textures of a scene in the background while it is parsed.
+//
+// Every path is decoded once, on a pool of worker threads that exists
+// while textures are pending; requests for the same path share the
+// texture. The textures are filled in asynchronously, so they may only be
+// read after wait() returned.
+//
+// With a texture budget, textures requested from then on are not decoded
+// into memory but converted to tiled files (path.tiles), of which only the
+// tiles used are read in, into a cache shared by all of them.
+class AssetLoader
+{
+    struct Entry
+    {
+        std::shared_ptr<ImageTexture> image;    // one of these two
+        std::shared_ptr<TiledTexture> tiled;
+        double loadMs = 0.0;
+        bool converted = false;
+        bool failed = false;
+        bool logged = false;
+    };
+
+    std::mutex d_mutex;
+    std::condition_variable d_done;
+    std::map<std::string, Entry> d_textures;
+    std::shared_ptr<TextureCache> d_cache;
+    unsigned d_pending = 0;
+    std::chrono::steady_clock::time_point d_start;
+    std::unique_ptr<ThreadPool> d_pool;     // last: joined first
+
+    public:
+        AssetLoader();
+        ~AssetLoader();
+
+        AssetLoader(AssetLoader const &) = delete;
+        AssetLoader &operator=(AssetLoader const &) = delete;
+
+        // The texture in the PNG file path, decoding it if it is new.
+        // Throws if the file cannot be opened.
+        std::shared_ptr<Texture const> texture(std::string const &path);
+
+        // Tile the textures requested from now on, keeping their tiles in
+        // memory under budget bytes (0: no limit).
+        void setTextureBudget(size_t budget);
+
+        // the cache of the tiled textures, nullptr without a budget
+        std::shared_ptr<TextureCache> cache() const;
+
+        // Block until all requested textures are decoded. The first call
+        // after new requests logs how long each texture took and how long
+        // the caller had to wait.
+        void wait();
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef BOX_H_
+#define BOX_H_
+
+#include "ray.h"
+#include "triple.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Axis aligned bounding box. A default constructed box is empty: it
+// contains nothing and extending it by a point gives that point.
+class Box
+{
+    public:
+        Point lo;
+        Point hi;
+
+        Box()
+        :
+            lo(std::numeric_limits<double>::infinity(),
+               std::numeric_limits<double>::infinity(),
+               std::numeric_limits<double>::infinity()),
+            hi(-std::numeric_limits<double>::infinity(),
+               -std::numeric_limits<double>::infinity(),
+               -std::numeric_limits<double>::infinity())
+        {}
+
+        Box(Point const &low, Point const &high)
+        :
+            lo(low),
+            hi(high)
+        {}
+
+        // contains all of space, for objects without finite bounds
+        static Box everything()
+        {
+            return Box(Box().hi, Box().lo);
+        }
+
+        bool empty() const
+        {
+            return lo.x > hi.x or lo.y > hi.y or lo.z > hi.z;
+        }
+
+        bool bounded() const
+        {
+            return std::isfinite(lo.x) and std::isfinite(lo.y)
+                   and std::isfinite(lo.z) and std::isfinite(hi.x)
+                   and std::isfinite(hi.y) and std::isfinite(hi.z);
+        }
+
+        void extend(Point const &point)
+        {
+            for (int axis = 0; axis != 3; ++axis)
+            {
+                lo.data[axis] = std::min(lo.data[axis], point.data[axis]);
+                hi.data[axis] = std::max(hi.data[axis], point.data[axis]);
+            }
+        }
+
+        void extend(Box const &box)
+        {
+            for (int axis = 0; axis != 3; ++axis)
+            {
+                lo.data[axis] = std::min(lo.data[axis], box.lo.data[axis]);
+                hi.data[axis] = std::max(hi.data[axis], box.hi.data[axis]);
+            }
+        }
+
+        Point centroid() const
+        {
+            return (lo + hi) * 0.5;
+        }
+
+        // the axis (0 = x, 1 = y, 2 = z) along which the box is longest
+        int longestAxis() const
+        {
+            Vector size = hi - lo;
+            if (size.x >= size.y and size.x >= size.z)
+                return 0;
+            return size.y >= size.z ? 1 : 2;
+        }
+
+        // surface area, 0 for an empty box
+        double area() const
+        {
+            if (empty())
+                return 0.0;
+            Vector size = hi - lo;
+            return 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        // Slab test. invD holds 1 / ray.D per component. Returns whether
+        // the ray enters the box before tmax, with the entry distance in
+        // tnear (0 if the origin is inside).
+        bool hit(Ray const &ray, Vector const &invD, double tmax,
+                 double &tnear) const
+        {
+            double t0 = 0.0;
+            double t1 = tmax;
+            for (int axis = 0; axis != 3; ++axis)
+            {
+                double ta = (lo.data[axis] - ray.O.data[axis]) * invD.data[axis];
+                double tb = (hi.data[axis] - ray.O.data[axis]) * invD.data[axis];
+                if (ta > tb)
+                    std::swap(ta, tb);
+                // NaN (origin on a slab of a flat box) keeps the old bound
+                t0 = ta > t0 ? ta : t0;
+                t1 = tb < t1 ? tb : t1;
+            }
+            tnear = t0;
+            return t0 <= t1;
+        }
+};
+
+#endif
@@ -0,0 +1,1021 @@
+#include "bvh.h"
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    unsigned const BINS = 16;
+    unsigned const MAX_LEAF_SIZE = 4;
+
+    // ranges of at least this many boxes are split over the pool
+    unsigned const PARALLEL_SIZE = 4096;
+
+    // from this depth on ranges are split at their median instead, which
+    // bounds the depth by 64 + log2(boxes)
+    unsigned const MAX_SAH_DEPTH = 64;
+
+    // SAH costs, relative to each other
+    double const TRAVERSAL_COST = 1.0;
+    double const INTERSECTION_COST = 1.0;
+
+    // An updated subtree is built again once its area grew by this factor
+    // since it was built, and a moved box is reinserted rather than grow
+    // its leaf this much.
+    double const REBUILD_GROWTH = 2.0;
+
+    // Updates deepening the tree beyond this depth make it rebuild,
+    // traversal has room for up to 128 levels.
+    unsigned const MAX_UPDATE_DEPTH = 100;
+
+    // parent of the root and of unused nodes, and leaf of absent ids
+    unsigned const NONE = ~0u;
+    unsigned const DEAD = ~0u - 1;
+
+    struct Bin
+    {
+        Box box;
+        unsigned count = 0;
+    };
+
+    // Run body(chunk, first, last) over chunks of [begin, end), on the
+    // pool if the range is large. Returns the number of chunks.
+    unsigned forChunks(ThreadPool &pool, unsigned begin, unsigned end,
+                       function<void(unsigned, unsigned, unsigned)> const &body)
+    {
+        unsigned size = end - begin;
+        unsigned chunks = max(1u, size / PARALLEL_SIZE);
+        if (chunks == 1)
+        {
+            body(0, begin, end);
+            return 1;
+        }
+
+        pool.parallelFor(chunks, [&](unsigned chunk)
+        {
+            unsigned first = begin + uint64_t(size) * chunk / chunks;
+            unsigned last = begin + uint64_t(size) * (chunk + 1) / chunks;
+            body(chunk, first, last);
+        });
+        return chunks;
+    }
+
+    // spread the lowest 10 bits of value over every third bit
+    uint32_t spreadBits(uint32_t value)
+    {
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    }
+
+    // Both builders store the nodes of a range of n boxes in the 2n - 1
+    // slots from the range's root on: the left child of n_left boxes
+    // directly after it, the right one 2 n_left slots after it. The tree
+    // is laid out without coordination between threads, and compacted
+    // afterwards.
+    class Builder
+    {
+        vector<Box> const &d_bounds;
+        vector<Point> d_centroids;
+        vector<uint32_t> d_codes;       // Lbvh only, per index position
+        vector<unsigned> &d_indices;
+        vector<Bvh::Node> &d_nodes;
+        ThreadPool &d_pool;
+
+        public:
+            Builder(vector<Box> const &bounds, vector<unsigned> &indices,
+                    vector<Bvh::Node> &nodes, ThreadPool &pool);
+
+            void sah(unsigned slot, unsigned begin, unsigned end,
+                     unsigned depth);
+            Box lbvh(unsigned slot, unsigned begin, unsigned end);
+
+            // sort the indices along the Morton curve, for lbvh
+            void sortByCode();
+
+        private:
+            void rangeBounds(unsigned begin, unsigned end, Box &box,
+                             Box &centroids);
+            void leaf(Bvh::Node &node, unsigned begin, unsigned end);
+            void children(unsigned size, function<void()> const &left,
+                          function<void()> const &right);
+    };
+
+    Builder::Builder(vector<Box> const &bounds, vector<unsigned> &indices,
+                     vector<Bvh::Node> &nodes, ThreadPool &pool)
+    :
+        d_bounds(bounds),
+        d_centroids(bounds.size()),
+        d_indices(indices),
+        d_nodes(nodes),
+        d_pool(pool)
+    {
+        forChunks(d_pool, 0, bounds.size(),
+            [&](unsigned, unsigned first, unsigned last)
+            {
+                for (unsigned idx = first; idx != last; ++idx)
+                {
+                    d_centroids[idx] = d_bounds[idx].centroid();
+                    d_indices[idx] = idx;
+                }
+            });
+    }
+
+    void Builder::sah(unsigned slot, unsigned begin, unsigned end,
+                      unsigned depth)
+    {
+        Bvh::Node &node = d_nodes[slot];
+        Box centroids;
+        rangeBounds(begin, end, node.box, centroids);
+
+        unsigned size = end - begin;
+        int axis = centroids.longestAxis();
+        double low = centroids.lo.data[axis];
+        double extent = centroids.hi.data[axis] - low;
+        if (size == 1 or (size <= MAX_LEAF_SIZE and extent <= 0.0))
+        {
+            leaf(node, begin, end);
+            return;
+        }
+
+        unsigned *indices = d_indices.data();
+        unsigned mid;
+        if (extent <= 0.0)                  // all centroids coincide
+            mid = begin + size / 2;
+        else if (depth >= MAX_SAH_DEPTH)
+        {
+            mid = begin + size / 2;
+            nth_element(indices + begin, indices + mid, indices + end,
+                [&](unsigned lhs, unsigned rhs)
+                {
+                    return d_centroids[lhs].data[axis]
+                           < d_centroids[rhs].data[axis];
+                });
+        }
+        else
+        {
+            double scale = BINS / extent;
+            auto binOf = [&](unsigned idx)
+            {
+                double offset = d_centroids[idx].data[axis] - low;
+                return min(BINS - 1, static_cast<unsigned>(offset * scale));
+            };
+
+            // Fill the bins per chunk, then merge.
+            vector<Bin> chunkBins(BINS * max(1u, size / PARALLEL_SIZE));
+            unsigned chunks = forChunks(d_pool, begin, end,
+                [&](unsigned chunk, unsigned first, unsigned last)
+                {
+                    Bin *bins = &chunkBins[chunk * BINS];
+                    for (unsigned pos = first; pos != last; ++pos)
+                    {
+                        Bin &bin = bins[binOf(indices[pos])];
+                        bin.box.extend(d_bounds[indices[pos]]);
+                        ++bin.count;
+                    }
+                });
+
+            Bin bins[BINS];
+            for (unsigned chunk = 0; chunk != chunks; ++chunk)
+            {
+                for (unsigned idx = 0; idx != BINS; ++idx)
+                {
+                    bins[idx].box.extend(chunkBins[chunk * BINS + idx].box);
+                    bins[idx].count += chunkBins[chunk * BINS + idx].count;
+                }
+            }
+
+            // Sweep from the right for the right hand areas, then from
+            // the left evaluating the split after every bin.
+            double rightArea[BINS];
+            unsigned rightCount[BINS];
+            Box box;
+            unsigned count = 0;
+            for (unsigned idx = BINS - 1; idx != 0; --idx)
+            {
+                box.extend(bins[idx].box);
+                count += bins[idx].count;
+                rightArea[idx] = box.area();
+                rightCount[idx] = count;
+            }
+
+            double bestCost = numeric_limits<double>::infinity();
+            unsigned bestSplit = 0;
+            box = Box();
+            count = 0;
+            for (unsigned idx = 0; idx != BINS - 1; ++idx)
+            {
+                box.extend(bins[idx].box);
+                count += bins[idx].count;
+                if (count == 0 or rightCount[idx + 1] == 0)
+                    continue;
+
+                double cost = box.area() * count
+                              + rightArea[idx + 1] * rightCount[idx + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = idx;
+                }
+            }
+
+            double area = node.box.area();
+            bestCost = TRAVERSAL_COST
+                       + (area > 0.0 ? INTERSECTION_COST * bestCost / area : 0.0);
+            if (size <= MAX_LEAF_SIZE and size * INTERSECTION_COST <= bestCost)
+            {
+                leaf(node, begin, end);
+                return;
+            }
+
+            mid = partition(indices + begin, indices + end,
+                [&](unsigned idx)
+                {
+                    return binOf(idx) <= bestSplit;
+                }) - indices;
+        }
+
+        node.count = 0;
+        node.axis = axis;
+        node.offset = slot + 2 * (mid - begin);
+        unsigned right = node.offset;
+        children(size,
+            [=] { sah(slot + 1, begin, mid, depth + 1); },
+            [=] { sah(right, mid, end, depth + 1); });
+    }
+
+    Box Builder::lbvh(unsigned slot, unsigned begin, unsigned end)
+    {
+        Bvh::Node &node = d_nodes[slot];
+        unsigned size = end - begin;
+        uint32_t first = d_codes[begin];
+        uint32_t last = d_codes[end - 1];
+        if (size == 1 or (size <= MAX_LEAF_SIZE and first == last))
+        {
+            Box centroids;
+            rangeBounds(begin, end, node.box, centroids);
+            leaf(node, begin, end);
+            return node.box;
+        }
+
+        // Split where the highest bit in which the codes differ flips.
+        unsigned mid;
+        unsigned axis = 0;
+        if (first == last)
+            mid = begin + size / 2;
+        else
+        {
+            unsigned bit = 31 - __builtin_clz(first ^ last);
+            axis = 2 - bit % 3;             // x is in the highest bit
+            mid = partition_point(d_codes.begin() + begin,
+                                  d_codes.begin() + end,
+                [=](uint32_t code)
+                {
+                    return (code >> bit & 1) == 0;
+                }) - d_codes.begin();
+        }
+
+        node.count = 0;
+        node.axis = axis;
+        node.offset = slot + 2 * (mid - begin);
+        unsigned right = node.offset;
+
+        Box leftBox;
+        Box rightBox;
+        children(size,
+            [&] { leftBox = lbvh(slot + 1, begin, mid); },
+            [&] { rightBox = lbvh(right, mid, end); });
+
+        node.box = leftBox;
+        node.box.extend(rightBox);
+        return node.box;
+    }
+
+    void Builder::sortByCode()
+    {
+        unsigned size = d_indices.size();
+        Box box;
+        Box centroids;
+        rangeBounds(0, size, box, centroids);
+
+        // quantize the centroids to 10 bits per axis
+        Vector extent = centroids.hi - centroids.lo;
+        Vector scale;
+        for (int axis = 0; axis != 3; ++axis)
+            scale.data[axis] = extent.data[axis] > 0.0
+                               ? 1023.0 / extent.data[axis] : 0.0;
+
+        vector<uint64_t> keys(size);
+        forChunks(d_pool, 0, size,
+            [&](unsigned, unsigned first, unsigned last)
+            {
+                for (unsigned idx = first; idx != last; ++idx)
+                {
+                    Vector cell = (d_centroids[idx] - centroids.lo) * scale;
+                    uint32_t code =
+                        spreadBits(static_cast<uint32_t>(cell.x)) << 2
+                        | spreadBits(static_cast<uint32_t>(cell.y)) << 1
+                        | spreadBits(static_cast<uint32_t>(cell.z));
+                    keys[idx] = uint64_t(code) << 32 | idx;
+                }
+            });
+        sort(keys.begin(), keys.end());
+
+        d_codes.resize(size);
+        for (unsigned pos = 0; pos != size; ++pos)
+        {
+            d_codes[pos] = keys[pos] >> 32;
+            d_indices[pos] = static_cast<uint32_t>(keys[pos]);
+        }
+    }
+
+    void Builder::rangeBounds(unsigned begin, unsigned end, Box &box,
+                              Box &centroids)
+    {
+        vector<Box> chunkBoxes(2 * max(1u, (end - begin) / PARALLEL_SIZE));
+        unsigned chunks = forChunks(d_pool, begin, end,
+            [&](unsigned chunk, unsigned first, unsigned last)
+            {
+                for (unsigned pos = first; pos != last; ++pos)
+                {
+                    chunkBoxes[2 * chunk].extend(d_bounds[d_indices[pos]]);
+                    chunkBoxes[2 * chunk + 1].extend(
+                        d_centroids[d_indices[pos]]);
+                }
+            });
+
+        box = Box();
+        centroids = Box();
+        for (unsigned chunk = 0; chunk != chunks; ++chunk)
+        {
+            box.extend(chunkBoxes[2 * chunk]);
+            centroids.extend(chunkBoxes[2 * chunk + 1]);
+        }
+    }
+
+    void Builder::leaf(Bvh::Node &node, unsigned begin, unsigned end)
+    {
+        node.offset = begin;
+        node.count = end - begin;
+        node.axis = 0;
+    }
+
+    void Builder::children(unsigned size, function<void()> const &left,
+                           function<void()> const &right)
+    {
+        if (size < PARALLEL_SIZE)
+        {
+            left();
+            right();
+            return;
+        }
+
+        d_pool.parallelFor(2, [&](unsigned child)
+        {
+            if (child == 0)
+                left();
+            else
+                right();
+        });
+    }
+
+    // Copy the children of slot, which is at index in compact, and their
+    // subtrees into compact, depth first, and add them to the statistics.
+    void compactFrom(vector<Bvh::Node> const &nodes, unsigned slot,
+                     unsigned index, unsigned depth, double rootArea,
+                     vector<Bvh::Node> &compact, Bvh::Stats &stats)
+    {
+        Bvh::Node const &node = nodes[slot];
+        double share = rootArea > 0.0 ? node.box.area() / rootArea : 1.0;
+        stats.depth = max(stats.depth, depth);
+        if (node.count != 0)
+        {
+            ++stats.leaves;
+            stats.sahCost += share * node.count * INTERSECTION_COST;
+            return;
+        }
+
+        stats.sahCost += share * TRAVERSAL_COST;
+        unsigned left = compact.size();
+        compact[index].offset = left;
+        compact.push_back(nodes[slot + 1]);
+        compact.push_back(nodes[node.offset]);
+        compactFrom(nodes, slot + 1, left, depth + 1, rootArea, compact,
+                    stats);
+        compactFrom(nodes, node.offset, left + 1, depth + 1, rootArea,
+                    compact, stats);
+    }
+
+    // Build over bounds into nodes, the root first, and indices, which
+    // are positions in bounds. The SAH builder starts counting the depth
+    // at depth.
+    void buildTree(vector<Box> const &bounds, Bvh::Method method,
+                   unsigned depth, ThreadPool &pool,
+                   vector<Bvh::Node> &nodes, vector<unsigned> &indices,
+                   Bvh::Stats &stats)
+    {
+        nodes.clear();
+        indices.resize(bounds.size());
+        stats = Bvh::Stats();
+        if (bounds.empty())
+            return;
+
+        vector<Bvh::Node> slots(2 * bounds.size() - 1);
+        Builder builder(bounds, indices, slots, pool);
+        if (method == Bvh::Method::Sah)
+            builder.sah(0, 0, bounds.size(), depth);
+        else
+        {
+            builder.sortByCode();
+            builder.lbvh(0, 0, bounds.size());
+        }
+
+        nodes.reserve(slots.size());
+        nodes.push_back(slots[0]);
+        compactFrom(slots, 0, 0, 0, slots[0].box.area(), nodes, stats);
+        stats.nodes = nodes.size();
+    }
+
+    bool sameBox(Box const &lhs, Box const &rhs)
+    {
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            if (lhs.lo.data[axis] != rhs.lo.data[axis]
+                or lhs.hi.data[axis] != rhs.hi.data[axis])
+                return false;
+        }
+        return true;
+    }
+
+    // the axis along which the centers of two boxes lie furthest apart
+    unsigned splitAxis(Box const &lhs, Box const &rhs)
+    {
+        Vector apart = lhs.centroid() - rhs.centroid();
+        unsigned axis = 0;
+        for (unsigned idx = 1; idx != 3; ++idx)
+        {
+            if (abs(apart.data[idx]) > abs(apart.data[axis]))
+                axis = idx;
+        }
+        return axis;
+    }
+
+    // a subtree that may hold the best sibling for an inserted box
+    struct Candidate
+    {
+        double bound;       // lower bound of the cost within the subtree
+        unsigned node;
+        double inherited;   // area the ancestors of node grow by
+
+        bool operator>(Candidate const &other) const
+        {
+            return bound > other.bound;
+        }
+    };
+}
+
+Bvh::Stats const &Bvh::build(vector<Box> const &bounds, Method method,
+                             ThreadPool &pool)
+{
+    auto start = chrono::steady_clock::now();
+
+    d_method = method;
+    buildTree(bounds, method, 0, pool, d_nodes, d_indices, d_stats);
+
+    d_boxes = bounds;
+    d_builtAreas.resize(d_nodes.size());
+    for (unsigned idx = 0; idx != d_nodes.size(); ++idx)
+        d_builtAreas[idx] = d_nodes[idx].box.area();
+    d_parents.assign(d_nodes.size(), NONE);
+    d_leaves.assign(bounds.size(), NONE);
+    if (not d_nodes.empty())
+        adopt(0);
+
+    d_degraded.clear();
+    d_deadNodes = 0;
+    d_deadIndices = 0;
+    d_changes = Changes();
+    d_changes.relaid = true;
+
+    chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+    d_stats.buildMs = elapsed.count();
+    return d_stats;
+}
+
+void Bvh::remap(vector<unsigned> const &ids)
+{
+    for (unsigned &index : d_indices)
+        index = ids[index];
+
+    unsigned size = ids.empty() ? 0 : *max_element(ids.begin(), ids.end()) + 1;
+    vector<Box> boxes(size);
+    vector<unsigned> leaves(size, NONE);
+    for (unsigned idx = 0; idx != ids.size(); ++idx)
+    {
+        boxes[ids[idx]] = d_boxes[idx];
+        leaves[ids[idx]] = d_leaves[idx];
+    }
+    d_boxes.swap(boxes);
+    d_leaves.swap(leaves);
+}
+
+// --- Updates -----------------------------------------------------------------
+
+void Bvh::insert(unsigned id, Box const &box)
+{
+    if (id >= d_boxes.size())
+    {
+        d_boxes.resize(id + 1);
+        d_leaves.resize(id + 1, NONE);
+    }
+    d_boxes[id] = box;
+    attach(id);
+}
+
+void Bvh::move(unsigned id, Box const &box)
+{
+    d_boxes[id] = box;
+    unsigned leaf = d_leaves[id];
+    if (leafBox(d_nodes[leaf]).area() > REBUILD_GROWTH * d_builtAreas[leaf])
+    {
+        detach(id);
+        attach(id);
+    }
+    else
+        refitFrom(leaf);
+}
+
+void Bvh::remove(unsigned id)
+{
+    detach(id);
+    d_boxes[id] = Box();
+}
+
+void Bvh::erase(unsigned id)
+{
+    if (id >= d_leaves.size())
+        return;
+
+    if (d_leaves[id] != NONE)
+        detach(id);
+    for (unsigned &index : d_indices)
+    {
+        if (index > id)
+            --index;
+    }
+    d_boxes.erase(d_boxes.begin() + id);
+    d_leaves.erase(d_leaves.begin() + id);
+}
+
+// Subtrees are built again from the top down, a rebuild makes the
+// degraded subtrees below it unused.
+unsigned Bvh::rebuildDegraded(ThreadPool &pool)
+{
+    unsigned rebuilt = 0;
+    if (not d_nodes.empty() and d_heights[0] > MAX_UPDATE_DEPTH)
+    {
+        rebuild(0, pool);
+        ++rebuilt;
+    }
+    else
+    {
+        vector<pair<unsigned, unsigned>> roots;     // depth, node
+        for (unsigned node : d_degraded)
+        {
+            if (alive(node))
+                roots.push_back({depth(node), node});
+        }
+        sort(roots.begin(), roots.end());
+        roots.erase(unique(roots.begin(), roots.end()), roots.end());
+
+        for (auto const &root : roots)
+        {
+            unsigned node = root.second;
+            if (alive(node) and d_nodes[node].box.area()
+                                > REBUILD_GROWTH * d_builtAreas[node])
+            {
+                rebuild(node, pool);
+                ++rebuilt;
+            }
+        }
+    }
+    d_degraded.clear();
+
+    if (not d_nodes.empty() and (d_deadNodes > d_nodes.size() / 2
+                                 or d_deadIndices > d_indices.size() / 2))
+        compact();
+    return rebuilt;
+}
+
+bool Bvh::changed() const
+{
+    return d_changes.relaid or not d_changes.refitted.empty()
+           or not d_changes.restructured.empty();
+}
+
+Bvh::Changes const &Bvh::changes() const
+{
+    return d_changes;
+}
+
+void Bvh::clearChanges()
+{
+    d_changes = Changes();
+}
+
+bool Bvh::alive(unsigned node) const
+{
+    return node < d_nodes.size() and d_parents[node] != DEAD;
+}
+
+Bvh::Stats const &Bvh::stats() const
+{
+    return d_stats;
+}
+
+bool Bvh::empty() const
+{
+    return d_nodes.empty();
+}
+
+vector<Bvh::Node> const &Bvh::nodes() const
+{
+    return d_nodes;
+}
+
+vector<unsigned> const &Bvh::indices() const
+{
+    return d_indices;
+}
+
+// --- Private -----------------------------------------------------------------
+
+void Bvh::adopt(unsigned root)
+{
+    d_heights.resize(d_nodes.size());
+
+    // children come after their parent in order
+    vector<unsigned> order;
+    vector<unsigned> stack(1, root);
+    while (not stack.empty())
+    {
+        unsigned node = stack.back();
+        stack.pop_back();
+        order.push_back(node);
+        reparent(node);
+        if (d_nodes[node].count == 0)
+        {
+            stack.push_back(d_nodes[node].offset);
+            stack.push_back(d_nodes[node].offset + 1);
+        }
+    }
+
+    for (auto node = order.rbegin(); node != order.rend(); ++node)
+    {
+        Node const &current = d_nodes[*node];
+        d_heights[*node] = current.count != 0 ? 0 :
+            1 + max(d_heights[current.offset], d_heights[current.offset + 1]);
+    }
+}
+
+void Bvh::reparent(unsigned node)
+{
+    Node const &parent = d_nodes[node];
+    if (parent.count == 0)
+    {
+        d_parents[parent.offset] = node;
+        d_parents[parent.offset + 1] = node;
+        return;
+    }
+    for (unsigned idx = 0; idx != parent.count; ++idx)
+        d_leaves[d_indices[parent.offset + idx]] = node;
+}
+
+Box Bvh::leafBox(Node const &leaf) const
+{
+    Box box;
+    for (unsigned idx = 0; idx != leaf.count; ++idx)
+        box.extend(d_boxes[d_indices[leaf.offset + idx]]);
+    return box;
+}
+
+void Bvh::raise(unsigned node)
+{
+    for (; node != NONE; node = d_parents[node])
+    {
+        unsigned left = d_nodes[node].offset;
+        unsigned height = 1 + max(d_heights[left], d_heights[left + 1]);
+        if (height == d_heights[node])
+            break;
+        d_heights[node] = height;
+    }
+}
+
+unsigned Bvh::depth(unsigned node) const
+{
+    unsigned levels = 0;
+    while ((node = d_parents[node]) != NONE)
+        ++levels;
+    return levels;
+}
+
+// Stops where a box stays the same. Of the subtrees on the way that grew
+// too much, only the largest one needs building again.
+void Bvh::refitFrom(unsigned node)
+{
+    unsigned degraded = NONE;
+    for (; node != NONE; node = d_parents[node])
+    {
+        Node &current = d_nodes[node];
+        Box box;
+        if (current.count != 0)
+            box = leafBox(current);
+        else
+        {
+            box = d_nodes[current.offset].box;
+            box.extend(d_nodes[current.offset + 1].box);
+        }
+        if (sameBox(box, current.box))
+            break;
+
+        current.box = box;
+        d_changes.refitted.push_back(node);
+        if (box.area() > REBUILD_GROWTH * d_builtAreas[node])
+            degraded = node;
+    }
+
+    if (degraded != NONE)
+        d_degraded.push_back(degraded);
+}
+
+// The new leaf and the sibling become the children of a new node in the
+// place of the sibling, which moves to the end with the leaf.
+void Bvh::attach(unsigned id)
+{
+    Box const &box = d_boxes[id];
+    Node leaf{box, static_cast<unsigned>(d_indices.size()), 1, 0};
+    d_indices.push_back(id);
+
+    if (d_nodes.empty())
+    {
+        d_nodes.push_back(leaf);
+        d_parents.assign(1, NONE);
+        d_heights.assign(1, 0);
+        d_builtAreas.assign(1, box.area());
+        d_leaves[id] = 0;
+        d_changes.relaid = true;
+        return;
+    }
+
+    unsigned sibling = bestSibling(box);
+    Node moved = d_nodes[sibling];
+    unsigned axis = splitAxis(box, moved.box);
+    bool leafFirst = box.centroid().data[axis] < moved.box.centroid().data[axis];
+
+    unsigned pair = d_nodes.size();
+    d_nodes.push_back(leafFirst ? leaf : moved);
+    d_nodes.push_back(leafFirst ? moved : leaf);
+    d_parents.resize(pair + 2, sibling);
+    d_heights.push_back(leafFirst ? 0 : d_heights[sibling]);
+    d_heights.push_back(leafFirst ? d_heights[sibling] : 0);
+    d_builtAreas.push_back(leafFirst ? box.area() : d_builtAreas[sibling]);
+    d_builtAreas.push_back(leafFirst ? d_builtAreas[sibling] : box.area());
+    reparent(pair);
+    reparent(pair + 1);
+
+    Node &parent = d_nodes[sibling];
+    parent.box.extend(box);
+    parent.offset = pair;
+    parent.count = 0;
+    parent.axis = axis;
+    d_builtAreas[sibling] = parent.box.area();
+    d_changes.restructured.push_back(sibling);
+    raise(sibling);
+    refitFrom(d_parents[sibling]);
+}
+
+// An emptied leaf is replaced, together with its parent, by its sibling.
+void Bvh::detach(unsigned id)
+{
+    unsigned leafIdx = d_leaves[id];
+    d_leaves[id] = NONE;
+
+    Node &leaf = d_nodes[leafIdx];
+    unsigned *first = d_indices.data() + leaf.offset;
+    swap(*find(first, first + leaf.count, id), first[leaf.count - 1]);
+    --leaf.count;
+    ++d_deadIndices;
+    if (leaf.count != 0)
+    {
+        d_changes.restructured.push_back(leafIdx);
+        refitFrom(leafIdx);
+        return;
+    }
+
+    unsigned parent = d_parents[leafIdx];
+    if (parent == NONE)
+    {
+        d_nodes.clear();
+        d_indices.clear();
+        d_parents.clear();
+        d_heights.clear();
+        d_builtAreas.clear();
+        d_degraded.clear();
+        d_deadNodes = 0;
+        d_deadIndices = 0;
+        d_changes.relaid = true;
+        return;
+    }
+
+    unsigned left = d_nodes[parent].offset;
+    unsigned sibling = leafIdx == left ? left + 1 : left;
+    d_nodes[parent] = d_nodes[sibling];
+    d_builtAreas[parent] = d_builtAreas[sibling];
+    d_heights[parent] = d_heights[sibling];
+    reparent(parent);
+    d_parents[left] = DEAD;
+    d_parents[left + 1] = DEAD;
+    d_deadNodes += 2;
+
+    d_changes.restructured.push_back(parent);
+    raise(d_parents[parent]);
+    refitFrom(d_parents[parent]);
+}
+
+// Branch and bound over the tree: the cost of a sibling is the area of
+// the new parent plus the area its ancestors grow by, which bounds the
+// cost of every node below it from below.
+unsigned Bvh::bestSibling(Box const &box) const
+{
+    double area = box.area();
+    unsigned best = 0;
+    double bestCost = numeric_limits<double>::infinity();
+
+    vector<Candidate> heap(1, Candidate{0.0, 0, 0.0});
+    while (not heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), greater<Candidate>());
+        Candidate candidate = heap.back();
+        heap.pop_back();
+        if (candidate.bound >= bestCost)
+            break;
+
+        Node const &node = d_nodes[candidate.node];
+        Box joint = node.box;
+        joint.extend(box);
+        double jointArea = joint.area();
+        double cost = jointArea + candidate.inherited;
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            best = candidate.node;
+        }
+
+        if (node.count != 0)
+            continue;
+        double inherited = candidate.inherited + jointArea - node.box.area();
+        if (area + inherited >= bestCost)
+            continue;
+        for (unsigned child : {node.offset, node.offset + 1})
+        {
+            heap.push_back(Candidate{area + inherited, child, inherited});
+            push_heap(heap.begin(), heap.end(), greater<Candidate>());
+        }
+    }
+    return best;
+}
+
+// The new root takes the place of the old one, the other nodes and the
+// indices go at the end.
+void Bvh::rebuild(unsigned root, ThreadPool &pool)
+{
+    vector<unsigned> ids;
+    vector<unsigned> stack(1, root);
+    while (not stack.empty())
+    {
+        unsigned node = stack.back();
+        stack.pop_back();
+        if (node != root)
+        {
+            d_parents[node] = DEAD;
+            ++d_deadNodes;
+        }
+
+        Node const &current = d_nodes[node];
+        if (current.count != 0)
+        {
+            ids.insert(ids.end(), d_indices.begin() + current.offset,
+                       d_indices.begin() + current.offset + current.count);
+            d_deadIndices += current.count;
+            continue;
+        }
+        stack.push_back(current.offset);
+        stack.push_back(current.offset + 1);
+    }
+
+    vector<Box> bounds(ids.size());
+    for (unsigned idx = 0; idx != ids.size(); ++idx)
+        bounds[idx] = d_boxes[ids[idx]];
+
+    vector<Node> nodes;
+    vector<unsigned> positions;
+    Stats stats;
+    buildTree(bounds, d_method, depth(root), pool, nodes, positions, stats);
+
+    unsigned nodeBase = d_nodes.size() - 1;     // for nodes 1 and up
+    unsigned indexBase = d_indices.size();
+    for (unsigned position : positions)
+        d_indices.push_back(ids[position]);
+
+    d_builtAreas.resize(nodeBase + nodes.size());
+    for (unsigned idx = 0; idx != nodes.size(); ++idx)
+    {
+        Node node = nodes[idx];
+        node.offset += node.count != 0 ? indexBase : nodeBase;
+        if (idx == 0)
+            d_nodes[root] = node;
+        else
+            d_nodes.push_back(node);
+        d_builtAreas[idx == 0 ? root : nodeBase + idx] = node.box.area();
+    }
+    d_parents.resize(d_nodes.size(), NONE);
+    adopt(root);
+    raise(d_parents[root]);
+    d_changes.restructured.push_back(root);
+}
+
+// Lays the tree out again as build does, keeping the areas the nodes
+// were built with.
+void Bvh::compact()
+{
+    vector<Node> nodes(1, d_nodes[0]);
+    vector<double> builtAreas(1, d_builtAreas[0]);
+    vector<unsigned> indices;
+    nodes.reserve(d_nodes.size() - d_deadNodes);
+    indices.reserve(d_indices.size() - d_deadIndices);
+
+    vector<pair<unsigned, unsigned>> stack(1, {0, 0});  // old, new index
+    while (not stack.empty())
+    {
+        unsigned from = stack.back().first;
+        unsigned to = stack.back().second;
+        stack.pop_back();
+
+        Node const &node = d_nodes[from];
+        if (node.count != 0)
+        {
+            nodes[to].offset = indices.size();
+            indices.insert(indices.end(), d_indices.begin() + node.offset,
+                           d_indices.begin() + node.offset + node.count);
+            continue;
+        }
+
+        unsigned left = nodes.size();
+        nodes[to].offset = left;
+        for (unsigned child : {node.offset, node.offset + 1})
+        {
+            nodes.push_back(d_nodes[child]);
+            builtAreas.push_back(d_builtAreas[child]);
+        }
+        stack.push_back({node.offset + 1, left + 1});
+        stack.push_back({node.offset, left});
+    }
+
+    d_nodes.swap(nodes);
+    d_builtAreas.swap(builtAreas);
+    d_indices.swap(indices);
+    d_parents.assign(d_nodes.size(), NONE);
+    adopt(0);
+
+    d_degraded.clear();
+    d_deadNodes = 0;
+    d_deadIndices = 0;
+    d_changes.relaid = true;
+}
+
+bool Bvh::parse(string const &name, Method &method)
+{
+    if (name == "sah")
+        method = Method::Sah;
+    else if (name == "lbvh")
+        method = Method::Lbvh;
+    else
+        return false;
+    return true;
+}
+
+char const *Bvh::name(Method method)
+{
+    return method == Method::Sah ? "sah" : "lbvh";
+}
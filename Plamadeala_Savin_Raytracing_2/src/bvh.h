@@ -0,0 +1,195 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "box.h"
+#include "ray.h"
+
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Binary bounding volume hierarchy over a set of boxes (the objects of a
+// scene), for closest-hit queries.
+//
+// Two builders are available:
+// - Sah: top-down, every split chosen by the surface area heuristic over
+//   16 bins of the centroids. Slower to build, faster to trace.
+// - Lbvh: the centroids are sorted along a Morton (Z-order) curve and the
+//   tree follows the bits of the codes. Builds several times faster, for
+//   previews and scenes that change every frame.
+// Both split large ranges over the thread pool, and both produce the same
+// node layout: depth first, the two children of a node next to each other.
+//
+// After a build the tree can be updated in place as boxes are added,
+// moved and removed: bounds are refitted bottom-up, objects that leave
+// their neighbourhood are reinserted where they add the least area, and
+// subtrees whose area has grown too much since they were built are built
+// again. Nodes freed by the updates are reused by compacting the tree once
+// half of them are unused.
+class Bvh
+{
+    public:
+        enum class Method
+        {
+            Sah,
+            Lbvh
+        };
+
+        struct Node
+        {
+            Box box;
+            unsigned offset;    // leaf: first index, inner node: left child,
+                                // the right child follows it
+            unsigned count;     // leaf: number of indices, 0 for inner nodes
+            unsigned axis;      // inner node: the axis it was split along
+        };
+
+        struct Stats
+        {
+            double buildMs = 0.0;
+            unsigned nodes = 0;
+            unsigned leaves = 0;
+            unsigned depth = 0;
+            double sahCost = 0.0;   // expected cost of a random ray
+        };
+
+        // Nodes changed by the updates since clearChanges(), for the
+        // structures derived from the tree
+        struct Changes
+        {
+            std::vector<unsigned> refitted;     // the box changed
+            std::vector<unsigned> restructured; // the node and its subtree
+                                                // were replaced
+            bool relaid = false;                // all nodes were replaced
+        };
+
+    private:
+    std::vector<Node> d_nodes;
+    std::vector<unsigned> d_indices;    // of the boxes, in leaf order
+    Stats d_stats;
+    Method d_method = Method::Sah;
+
+    // For the updates. Per node, its parent, the height of its subtree
+    // and its area when it was built; per id (the values in the leaves),
+    // its box and its leaf. The root and unused nodes have no parent.
+    std::vector<unsigned> d_parents;
+    std::vector<unsigned> d_heights;
+    std::vector<double> d_builtAreas;
+    std::vector<Box> d_boxes;
+    std::vector<unsigned> d_leaves;
+    std::vector<unsigned> d_degraded;   // subtrees to check when rebuilding
+    unsigned d_deadNodes = 0;
+    unsigned d_deadIndices = 0;
+    Changes d_changes;
+
+    public:
+        // Build over bounds; all boxes must be bounded and non-empty.
+        Stats const &build(std::vector<Box> const &bounds, Method method,
+                           ThreadPool &pool);
+
+        // replace box index i by ids[i] in the leaves
+        void remap(std::vector<unsigned> const &ids);
+
+        // Incremental updates, ids being the values in the leaves. Boxes
+        // must be bounded and non-empty. move refits the tree to the new
+        // box of id, or reinserts id if its leaf would grow too much.
+        // erase removes id if it is in the tree, and moves the ids above
+        // it down by one, as erasing from a vector does.
+        void insert(unsigned id, Box const &box);
+        void move(unsigned id, Box const &box);
+        void remove(unsigned id);
+        void erase(unsigned id);
+
+        // Build the subtrees degraded by the updates again, or the whole
+        // tree if they made it too deep, and compact the nodes if half of
+        // them are unused. Returns the number of subtrees built.
+        unsigned rebuildDegraded(ThreadPool &pool);
+
+        // whether there are updates since clearChanges()
+        bool changed() const;
+        Changes const &changes() const;
+        void clearChanges();
+
+        // whether node is part of the tree
+        bool alive(unsigned node) const;
+
+        Stats const &stats() const;
+        bool empty() const;
+        std::vector<Node> const &nodes() const;
+        std::vector<unsigned> const &indices() const;
+
+        // Visit the boxes the ray may hit before distance t, near ones
+        // first. test(index, t) intersects box index and lowers t on a
+        // closer hit. If visited is given, it is incremented for every
+        // node whose box is tested.
+        template <typename Test>
+        void traverse(Ray const &ray, double &t, Test const &test,
+                      unsigned *visited = nullptr) const;
+
+        // "sah" or "lbvh"
+        static bool parse(std::string const &name, Method &method);
+        static char const *name(Method method);
+
+    private:
+        // set the parents and heights of the nodes below root, and the
+        // leaves of their ids
+        void adopt(unsigned root);
+        // recompute the heights from node up
+        void raise(unsigned node);
+        // point the children or ids of node back at it
+        void reparent(unsigned node);
+
+        Box leafBox(Node const &leaf) const;
+        unsigned depth(unsigned node) const;
+
+        // recompute the boxes from node up, noting degraded subtrees
+        void refitFrom(unsigned node);
+
+        // add or take out the leaf entry of id
+        void attach(unsigned id);
+        void detach(unsigned id);
+        // the node whose sibling a new box adds the least area as
+        unsigned bestSibling(Box const &box) const;
+
+        void rebuild(unsigned root, ThreadPool &pool);
+        void compact();
+};
+
+template <typename Test>
+void Bvh::traverse(Ray const &ray, double &t, Test const &test,
+                   unsigned *visited) const
+{
+    if (d_nodes.empty())
+        return;
+
+    Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+    bool negative[3] = {ray.D.x < 0.0, ray.D.y < 0.0, ray.D.z < 0.0};
+
+    unsigned stack[128];    // the depth is kept below 100
+    unsigned top = 0;
+    stack[top++] = 0;
+    while (top != 0)
+    {
+        Node const &node = d_nodes[stack[--top]];
+        if (visited)
+            ++*visited;
+        double tnear;
+        if (not node.box.hit(ray, invD, t, tnear))
+            continue;
+
+        if (node.count != 0)
+        {
+            for (unsigned idx = 0; idx != node.count; ++idx)
+                test(d_indices[node.offset + idx], t);
+            continue;
+        }
+
+        // Push the far child first, so the near one is visited first.
+        bool leftFirst = not negative[node.axis];
+        stack[top++] = node.offset + leftFirst;
+        stack[top++] = node.offset + not leftFirst;
+    }
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "checkpoint.h"
+
+#include "image.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    char const MAGIC[8] = {'R', 'A', 'Y', 'C', 'K', 'P', 'T', '1'};
+    uint32_t const BAND_MAGIC = 0x444e4142;     // "BAND"
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint64_t fingerprint;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bandHeight;
+        uint32_t padding;
+    };
+
+    struct RecordHeader
+    {
+        uint32_t magic;
+        uint32_t band;
+        uint64_t checksum;      // of the pixel data that follows
+    };
+
+    uint64_t const FNV_BASIS = 0xcbf29ce484222325ull;
+
+    uint64_t fnv1a(void const *data, size_t size, uint64_t hash = FNV_BASIS)
+    {
+        unsigned char const *bytes = static_cast<unsigned char const *>(data);
+        for (size_t idx = 0; idx != size; ++idx)
+        {
+            hash ^= bytes[idx];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+Checkpoint::Checkpoint(string const &path, uint64_t fingerprint,
+                       unsigned width, unsigned height, unsigned bandHeight)
+:
+    d_path(path),
+    d_fingerprint(fingerprint),
+    d_width(width),
+    d_height(height),
+    d_bandHeight(bandHeight),
+    d_file(nullptr)
+{}
+
+Checkpoint::~Checkpoint()
+{
+    if (d_file)
+        fclose(d_file);
+}
+
+unsigned Checkpoint::bands() const
+{
+    return (d_height + d_bandHeight - 1) / d_bandHeight;
+}
+
+Region Checkpoint::band(unsigned idx) const
+{
+    return Region(0, idx * d_bandHeight,
+                  d_width, min(d_height, (idx + 1) * d_bandHeight));
+}
+
+vector<bool> Checkpoint::start(bool resume, Image &img)
+{
+    vector<bool> done(bands(), false);
+
+    long valid = resume ? load(img, done) : -1;
+    if (valid < 0)
+    {
+        fill(done.begin(), done.end(), false);
+        if (not create())
+            return vector<bool>();
+    }
+    else if (truncate(d_path.c_str(), valid) != 0)  // drop a torn record
+        return vector<bool>();
+
+    d_file = fopen(d_path.c_str(), "ab");
+    if (!d_file)
+        return vector<bool>();
+    return done;
+}
+
+bool Checkpoint::append(unsigned idx, Image const &img)
+{
+    Region region = band(idx);
+    vector<double> pixels;
+    pixels.reserve(3 * region.width() * region.height());
+    for (unsigned y = region.y0; y != region.y1; ++y)
+        for (unsigned x = region.x0; x != region.x1; ++x)
+            pixels.insert(pixels.end(), img(x, y).data, img(x, y).data + 3);
+
+    size_t bytes = pixels.size() * sizeof(double);
+    RecordHeader record{BAND_MAGIC, idx, fnv1a(pixels.data(), bytes)};
+
+    return fwrite(&record, sizeof record, 1, d_file) == 1
+           and fwrite(pixels.data(), bytes, 1, d_file) == 1
+           and fflush(d_file) == 0
+           and fsync(fileno(d_file)) == 0;
+}
+
+void Checkpoint::finish()
+{
+    if (d_file)
+    {
+        fclose(d_file);
+        d_file = nullptr;
+    }
+    remove(d_path.c_str());
+}
+
+uint64_t Checkpoint::hash(string const &text)
+{
+    return fnv1a(text.data(), text.size());
+}
+
+uint64_t Checkpoint::hash(string const &text, uint64_t previous)
+{
+    return fnv1a(text.data(), text.size(), previous);
+}
+
+// --- Private -----------------------------------------------------------------
+
+long Checkpoint::load(Image &img, vector<bool> &done)
+{
+    FILE *file = fopen(d_path.c_str(), "rb");
+    if (!file)
+        return -1;
+
+    FileHeader header;
+    if (fread(&header, sizeof header, 1, file) != 1
+        or memcmp(header.magic, MAGIC, sizeof MAGIC) != 0
+        or header.fingerprint != d_fingerprint
+        or header.width != d_width
+        or header.height != d_height
+        or header.bandHeight != d_bandHeight)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    long valid = ftell(file);
+    RecordHeader record;
+    vector<double> pixels;
+    while (fread(&record, sizeof record, 1, file) == 1)
+    {
+        if (record.magic != BAND_MAGIC or record.band >= bands())
+            break;
+
+        Region region = band(record.band);
+        pixels.resize(3 * region.width() * region.height());
+        size_t bytes = pixels.size() * sizeof(double);
+        if (fread(pixels.data(), bytes, 1, file) != 1
+            or fnv1a(pixels.data(), bytes) != record.checksum)
+            break;
+
+        double const *pixel = pixels.data();
+        for (unsigned y = region.y0; y != region.y1; ++y)
+            for (unsigned x = region.x0; x != region.x1; ++x, pixel += 3)
+                img(x, y) = Color(pixel[0], pixel[1], pixel[2]);
+
+        done[record.band] = true;
+        valid = ftell(file);
+    }
+
+    fclose(file);
+    return valid;
+}
+
+bool Checkpoint::create()
+{
+    string tmpname = d_path + ".tmp";
+    FILE *file = fopen(tmpname.c_str(), "wb");
+    if (!file)
+        return false;
+
+    FileHeader header;
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.fingerprint = d_fingerprint;
+    header.width = d_width;
+    header.height = d_height;
+    header.bandHeight = d_bandHeight;
+    header.padding = 0;
+
+    bool written = fwrite(&header, sizeof header, 1, file) == 1
+                   and fflush(file) == 0
+                   and fsync(fileno(file)) == 0;
+    fclose(file);
+
+    // rename is atomic: the file either holds a complete header or is absent
+    return written and rename(tmpname.c_str(), d_path.c_str()) == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "region.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Image;
+
+// Append-only log of the finished bands (full width strips of rows) of a
+// render, so an interrupted render can be resumed.
+//
+// The file starts with a header identifying the render (scene fingerprint
+// and image size), written to a temporary file and renamed into place.
+// Every finished band is then appended as one record holding its pixels,
+// protected by a checksum and flushed to disk. A record torn by a crash
+// fails its checksum and is dropped when resuming, so the file is always
+// usable.
+class Checkpoint
+{
+    std::string d_path;
+    uint64_t d_fingerprint;
+    unsigned d_width;
+    unsigned d_height;
+    unsigned d_bandHeight;
+    FILE *d_file;
+
+    public:
+        Checkpoint(std::string const &path, uint64_t fingerprint,
+                   unsigned width, unsigned height, unsigned bandHeight);
+        ~Checkpoint();
+
+        Checkpoint(Checkpoint const &) = delete;
+        Checkpoint &operator=(Checkpoint const &) = delete;
+
+        unsigned bands() const;
+        Region band(unsigned idx) const;
+
+        // Open the checkpoint for appending. With resume, the bands stored
+        // in an existing file for the same render are copied into img and
+        // flagged as done in the returned vector. Otherwise, or if the file
+        // belongs to another render, a new file is started.
+        // Returns an empty vector if the file cannot be written.
+        std::vector<bool> start(bool resume, Image &img);
+
+        // append a finished band of img and flush it to disk
+        bool append(unsigned band, Image const &img);
+
+        // the render is complete, remove the file
+        void finish();
+
+        // FNV-1a, to fingerprint scene descriptions. Continuing from the
+        // hash of a previous text hashes both texts as one.
+        static uint64_t hash(std::string const &text);
+        static uint64_t hash(std::string const &text, uint64_t previous);
+
+    private:
+        // the number of valid bytes in the file, after reading its bands
+        long load(Image &img, std::vector<bool> &done);
+        bool create();
+};
+
+#endif
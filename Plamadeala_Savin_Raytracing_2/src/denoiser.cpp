@@ -0,0 +1,139 @@
+#include "denoiser.h"
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+    // 1D B3-spline taps for offsets -2 ... 2
+    double const KERNEL[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+    // taps whose edge-stopping weight is below exp(-MAX_EXPONENT) are skipped
+    double const MAX_EXPONENT = 10.0;
+
+    double luminance(Color const &color)
+    {
+        return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
+    }
+}
+
+// --- AuxBuffers --------------------------------------------------------------
+
+AuxBuffers::AuxBuffers(unsigned width, unsigned height)
+:
+    albedo(width, height),
+    normal(width, height),
+    depth(width, height)
+{}
+
+void AuxBuffers::write_png(string const &prefix) const
+{
+    albedo.write_png(prefix + "_albedo.png");
+
+    // map the normal components from [-1, 1] to [0, 1]
+    Image shownNormal(normal.width(), normal.height());
+    for (unsigned y = 0; y != normal.height(); ++y)
+    {
+        for (unsigned x = 0; x != normal.width(); ++x)
+            shownNormal(x, y) = normal(x, y) * 0.5 + 0.5;
+    }
+    shownNormal.write_png(prefix + "_normal.png");
+
+    // scale the depth so the farthest hit is white
+    double maxDepth = 0.0;
+    for (unsigned y = 0; y != depth.height(); ++y)
+    {
+        for (unsigned x = 0; x != depth.width(); ++x)
+            maxDepth = max(maxDepth, depth(x, y).r);
+    }
+    Image shownDepth(depth.width(), depth.height());
+    for (unsigned y = 0; y != depth.height(); ++y)
+    {
+        for (unsigned x = 0; x != depth.width(); ++x)
+            shownDepth(x, y) = maxDepth > 0.0 ? depth(x, y) / maxDepth : depth(x, y);
+    }
+    shownDepth.write_png(prefix + "_depth.png");
+}
+
+// --- Denoiser ----------------------------------------------------------------
+
+Image Denoiser::denoise(Image const &noisy, AuxBuffers const &aux,
+                        ThreadPool &pool) const
+{
+    Image current(noisy);
+    Image next(noisy.width(), noisy.height());
+
+    double sigmaColor = d_sigmaColor;
+    for (unsigned iteration = 0; iteration != d_iterations; ++iteration)
+    {
+        pass(current, next, aux, 1u << iteration, sigmaColor, pool);
+        swap(current, next);
+        sigmaColor *= 0.5;
+    }
+
+    return current;
+}
+
+void Denoiser::pass(Image const &in, Image &out, AuxBuffers const &aux,
+                    unsigned step, double sigmaColor, ThreadPool &pool) const
+{
+    int const w = in.width();
+    int const h = in.height();
+
+    double const colorScale = 1.0 / (sigmaColor * sigmaColor);
+    double const albedoScale = 1.0 / (d_sigmaAlbedo * d_sigmaAlbedo);
+    double const normalScale = 1.0 / (d_sigmaNormal * d_sigmaNormal);
+
+    pool.parallelFor(h, [&](unsigned row)
+    {
+        int y = row;
+        for (int x = 0; x != w; ++x)
+        {
+            Color const &color = in(x, y);
+            double lum = luminance(color);
+            Color const &albedo = aux.albedo(x, y);
+            Vector const &normal = aux.normal(x, y);
+            double depth = aux.depth(x, y).r;
+            double depthScale = 1.0 / (d_sigmaDepth * max(depth, 1e-6));
+
+            Color sum(0.0, 0.0, 0.0);
+            double weights = 0.0;
+            for (int j = -2; j <= 2; ++j)
+            {
+                int qy = y + j * static_cast<int>(step);
+                if (qy < 0 or qy >= h)
+                    continue;
+
+                for (int i = -2; i <= 2; ++i)
+                {
+                    int qx = x + i * static_cast<int>(step);
+                    if (qx < 0 or qx >= w)
+                        continue;
+
+                    Color const &tap = in(qx, qy);
+                    double dLum = luminance(tap) - lum;
+                    double dDepth = aux.depth(qx, qy).r - depth;
+
+                    double exponent = dLum * dLum * colorScale
+                        + (aux.albedo(qx, qy) - albedo).length_2() * albedoScale
+                        + (aux.normal(qx, qy) - normal).length_2() * normalScale
+                        + abs(dDepth) * depthScale;
+
+                    if (exponent > MAX_EXPONENT)   // negligible weight
+                        continue;
+
+                    double weight = KERNEL[i + 2] * KERNEL[j + 2] * exp(-exponent);
+                    sum += tap * weight;
+                    weights += weight;
+                }
+            }
+
+            // the center tap has weight > 0, so weights never is 0
+            out(x, y) = sum / weights;
+        }
+    });
+}
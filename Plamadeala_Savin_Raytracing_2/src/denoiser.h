@@ -0,0 +1,46 @@
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+#include "image.h"
+
+#include <string>
+
+class ThreadPool;
+
+// Features of the first hit per pixel, averaged over its samples. They are
+// (nearly) noise free and guide the denoiser around edges and texture
+// detail. Pixels that see no object have a zero albedo, normal and depth.
+struct AuxBuffers
+{
+    Image albedo;       // material (texture) color
+    Image normal;       // shading normal, facing the eye
+    Image depth;        // distance from the eye, in all three channels
+
+    AuxBuffers(unsigned width = 0, unsigned height = 0);
+
+    // writes prefix_albedo.png, prefix_normal.png and prefix_depth.png
+    void write_png(std::string const &prefix) const;
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010): a 5x5
+// B-spline kernel is applied with a doubling step size, every tap weighted
+// by how similar its color, albedo, normal and depth are to the center.
+class Denoiser
+{
+    unsigned d_iterations = 5;
+    double d_sigmaColor = 0.5;      // luminance, halved every iteration
+    double d_sigmaAlbedo = 0.1;
+    double d_sigmaNormal = 0.3;
+    double d_sigmaDepth = 0.05;     // relative to the center depth
+
+    public:
+        Image denoise(Image const &noisy, AuxBuffers const &aux,
+                      ThreadPool &pool) const;
+
+    private:
+        // one filter pass with the given step size
+        void pass(Image const &in, Image &out, AuxBuffers const &aux,
+                  unsigned step, double sigmaColor, ThreadPool &pool) const;
+};
+
+#endif
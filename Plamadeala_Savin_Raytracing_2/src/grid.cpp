@@ -0,0 +1,200 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+using namespace std;
+
+namespace
+{
+    // cells per box; more cells mean fewer boxes per cell, but more
+    // cells to step through and more boxes in several cells
+    double const DENSITY = 2.0;
+    unsigned const MAX_CELLS_PER_AXIS = 1024;
+
+    // Boxes are also put in a neighbouring cell when they come this close
+    // to it (in cells), so a ray entering a cell slightly off by rounding
+    // does not miss them.
+    double const SLACK = 1e-6;
+
+    // axes thinner than this fraction of the longest one are widened
+    double const MIN_THICKNESS = 1e-3;
+
+    // Limits for suits(): the mean number of cells a box is in, the ratio
+    // of large (90th percentile) to small (10th) box sizes, and the mean
+    // number of box centers in the cells holding any.
+    double const MAX_CELLS_PER_BOX = 8.0;
+    double const MAX_SIZE_SPREAD = 4.0;
+    double const MAX_CROWDING = 4.0;
+
+    // Grid bounds holding all boxes, widened where they are flat so the
+    // cells have a volume, and the number of cubic cells along each axis,
+    // DENSITY per box.
+    Box layout(vector<Box> const &bounds, unsigned (&cells)[3])
+    {
+        Box grid;
+        for (Box const &box : bounds)
+            grid.extend(box);
+
+        Vector size = grid.hi - grid.lo;
+        double longest = max(size.x, max(size.y, size.z));
+        if (longest == 0.0)
+            longest = 1.0;
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            double widen = 0.5 * (MIN_THICKNESS * longest - size.data[axis]);
+            if (widen > 0.0)
+            {
+                grid.lo.data[axis] -= widen;
+                grid.hi.data[axis] += widen;
+            }
+        }
+        size = grid.hi - grid.lo;
+
+        double volume = size.x * size.y * size.z;
+        double perUnit = cbrt(DENSITY * bounds.size() / volume);
+        for (int axis = 0; axis != 3; ++axis)
+            cells[axis] = min(max(size.data[axis] * perUnit, 1.0),
+                              static_cast<double>(MAX_CELLS_PER_AXIS));
+        return grid;
+    }
+}
+
+Grid::Stats const &Grid::build(vector<Box> const &bounds,
+                               vector<unsigned> const &ids)
+{
+    auto start = chrono::steady_clock::now();
+
+    d_firsts.clear();
+    d_entries.clear();
+    d_stats = Stats();
+    if (bounds.empty())
+        return d_stats;
+
+    d_bounds = layout(bounds, d_cells);
+    Vector size = d_bounds.hi - d_bounds.lo;
+    unsigned cellCount = d_cells[0] * d_cells[1] * d_cells[2];
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        d_cellSize.data[axis] = size.data[axis] / d_cells[axis];
+        d_invCellSize.data[axis] = 1.0 / d_cellSize.data[axis];
+    }
+
+    // Count the boxes per cell, then place them in a second pass.
+    vector<array<int, 6>> ranges(bounds.size());
+    d_firsts.assign(cellCount + 1, 0);
+    for (unsigned idx = 0; idx != bounds.size(); ++idx)
+    {
+        array<int, 6> &range = ranges[idx];
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            double slack = SLACK * d_cellSize.data[axis];
+            range[axis] = cellOf(bounds[idx].lo.data[axis] - slack, axis);
+            range[axis + 3] = cellOf(bounds[idx].hi.data[axis] + slack, axis);
+        }
+
+        for (int z = range[2]; z <= range[5]; ++z)
+            for (int y = range[1]; y <= range[4]; ++y)
+                for (int x = range[0]; x <= range[3]; ++x)
+                    ++d_firsts[(z * d_cells[1] + y) * d_cells[0] + x + 1];
+    }
+
+    for (unsigned cell = 0; cell != cellCount; ++cell)
+        d_firsts[cell + 1] += d_firsts[cell];
+
+    d_entries.resize(d_firsts.back());
+    vector<unsigned> next(d_firsts.begin(), d_firsts.end() - 1);
+    for (unsigned idx = 0; idx != bounds.size(); ++idx)
+    {
+        array<int, 6> const &range = ranges[idx];
+        for (int z = range[2]; z <= range[5]; ++z)
+            for (int y = range[1]; y <= range[4]; ++y)
+                for (int x = range[0]; x <= range[3]; ++x)
+                    d_entries[next[(z * d_cells[1] + y) * d_cells[0] + x]++]
+                        = ids[idx];
+    }
+
+    for (int axis = 0; axis != 3; ++axis)
+        d_stats.cells[axis] = d_cells[axis];
+    d_stats.references = d_entries.size();
+
+    chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+    d_stats.buildMs = elapsed.count();
+    return d_stats;
+}
+
+bool Grid::suits(vector<Box> const &bounds)
+{
+    if (bounds.empty())
+        return false;
+
+    unsigned cells[3];
+    Box grid = layout(bounds, cells);
+    Vector cellSize = grid.hi - grid.lo;
+    for (int axis = 0; axis != 3; ++axis)
+        cellSize.data[axis] /= cells[axis];
+
+    // per box the longest side in cells, and the cells it is expected to
+    // be in; per cell the box centers in it
+    vector<double> sizes;
+    sizes.reserve(bounds.size());
+    double references = 0.0;
+    vector<unsigned> centers(cells[0] * cells[1] * cells[2], 0);
+    for (Box const &box : bounds)
+    {
+        double longest = 0.0;
+        double covered = 1.0;
+        unsigned cell[3];
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            double extent = (box.hi.data[axis] - box.lo.data[axis])
+                            / cellSize.data[axis];
+            longest = max(longest, extent);
+            covered *= extent + 1.0;
+
+            double center = (box.centroid().data[axis] - grid.lo.data[axis])
+                            / cellSize.data[axis];
+            cell[axis] = min(max(center, 0.0), cells[axis] - 1.0);
+        }
+        sizes.push_back(longest);
+        references += covered;
+        ++centers[(cell[2] * cells[1] + cell[1]) * cells[0] + cell[0]];
+    }
+
+    auto percentile = [&](unsigned percent)
+    {
+        auto nth = sizes.begin() + (sizes.size() - 1) * percent / 100;
+        nth_element(sizes.begin(), nth, sizes.end());
+        return *nth;
+    };
+    double small = percentile(10);
+    double large = percentile(90);
+
+    unsigned occupied = count_if(centers.begin(), centers.end(),
+                                 [](unsigned count) { return count != 0; });
+
+    return references / bounds.size() <= MAX_CELLS_PER_BOX
+           and large <= MAX_SIZE_SPREAD * small
+           and bounds.size() <= MAX_CROWDING * occupied;
+}
+
+Grid::Stats const &Grid::stats() const
+{
+    return d_stats;
+}
+
+bool Grid::empty() const
+{
+    return d_entries.empty();
+}
+
+// --- Private -----------------------------------------------------------------
+
+int Grid::cellOf(double value, int axis) const
+{
+    double cell = floor((value - d_bounds.lo.data[axis])
+                        * d_invCellSize.data[axis]);
+    return min(max(cell, 0.0), d_cells[axis] - 1.0);
+}
@@ -0,0 +1,123 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include "box.h"
+#include "ray.h"
+
+#include <cmath>
+#include <vector>
+
+// Uniform grid over a set of boxes (the objects of a scene), for
+// closest-hit queries.
+//
+// The bounds of the boxes are split into cells of equal size, about
+// DENSITY of them per box, and every cell lists the boxes overlapping it.
+// A ray walks the cells it passes front to back (3D DDA) and stops in the
+// first cell that holds a hit. Building is a counting sort, much faster
+// than building a Bvh, and tracing is fast as long as the boxes have
+// similar sizes; a few large boxes end up in many cells, and dense
+// clusters in few.
+class Grid
+{
+    public:
+        struct Stats
+        {
+            double buildMs = 0.0;
+            unsigned cells[3] = {0, 0, 0};
+            unsigned references = 0;    // entries in all cells together
+        };
+
+    private:
+    Box d_bounds;
+    unsigned d_cells[3] = {0, 0, 0};
+    Vector d_cellSize;
+    Vector d_invCellSize;
+    std::vector<unsigned> d_firsts;     // per cell, its first entry, and
+                                        // the number of entries at the end
+    std::vector<unsigned> d_entries;    // ids, cell after cell
+    Stats d_stats;
+
+    public:
+        // Build over bounds, which must be bounded and non-empty. The
+        // cells hold ids[i] for bounds[i].
+        Stats const &build(std::vector<Box> const &bounds,
+                           std::vector<unsigned> const &ids);
+
+        Stats const &stats() const;
+        bool empty() const;
+
+        // Whether a grid over bounds is expected to trace about as fast
+        // as a Bvh: the boxes are not much larger than the cells, do not
+        // differ much in size, and are not crowded into a few cells.
+        static bool suits(std::vector<Box> const &bounds);
+
+        // As Bvh::traverse: test(id, t) intersects box id and lowers t on
+        // a closer hit. A box may be tested more than once per ray.
+        template <typename Test>
+        void traverse(Ray const &ray, double &t, Test const &test) const;
+
+    private:
+        // the cell along axis holding coordinate value, clamped to the grid
+        int cellOf(double value, int axis) const;
+};
+
+template <typename Test>
+void Grid::traverse(Ray const &ray, double &t, Test const &test) const
+{
+    if (d_entries.empty())
+        return;
+
+    Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+    double tnear;
+    if (not d_bounds.hit(ray, invD, t, tnear))
+        return;
+
+    // The cell the ray enters, and per axis the distance to the next cell
+    // boundary and between boundaries.
+    Point entry = ray.at(tnear);
+    int cell[3];
+    int step[3];
+    double tNext[3];
+    double tDelta[3];
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        cell[axis] = cellOf(entry.data[axis], axis);
+        double dir = ray.D.data[axis];
+        if (dir == 0.0)
+        {
+            step[axis] = 0;
+            tNext[axis] = INFINITY;
+            tDelta[axis] = INFINITY;
+            continue;
+        }
+
+        step[axis] = dir > 0.0 ? 1 : -1;
+        double boundary = d_bounds.lo.data[axis]
+            + (cell[axis] + (dir > 0.0)) * d_cellSize.data[axis];
+        tNext[axis] = (boundary - ray.O.data[axis]) * invD.data[axis];
+        tDelta[axis] = d_cellSize.data[axis] * std::abs(invD.data[axis]);
+    }
+
+    while (true)
+    {
+        unsigned index = (cell[2] * d_cells[1] + cell[1]) * d_cells[0]
+                         + cell[0];
+        for (unsigned idx = d_firsts[index]; idx != d_firsts[index + 1]; ++idx)
+            test(d_entries[idx], t);
+
+        int axis = tNext[0] < tNext[1] ? 0 : 1;
+        axis = tNext[2] < tNext[axis] ? 2 : axis;
+
+        // A hit before the ray leaves the cell cannot be beaten by the
+        // boxes further on.
+        if (t <= tNext[axis])
+            return;
+
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 or cell[axis] == static_cast<int>(d_cells[axis]))
+            return;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+#endif
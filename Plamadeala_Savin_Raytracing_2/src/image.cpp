@@ -1,8 +1,13 @@
 #include "image.h"
 
 #include "lode/lodepng.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <stdexcept>
 
 using namespace std;
 
@@ -68,9 +73,9 @@ void Image::write_png(std::string const &filename) const
     image.reserve(size() * 4);  // reserves size (less allocations)
     for (Color pixel : d_pixels)
     {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
+        image.push_back(toByte(pixel.r));
+        image.push_back(toByte(pixel.g));
+        image.push_back(toByte(pixel.b));
         image.push_back(255);   // alpha is always 1
     }
 
@@ -80,7 +85,13 @@ void Image::write_png(std::string const &filename) const
 void Image::read_png(std::string const &filename)
 {
     vector<unsigned char> image;
-    lodepng::decode(image, d_width, d_height, filename);
+    if (lodepng::decode(image, d_width, d_height, filename) != 0)
+    {
+        // unreadable: an empty image
+        d_width = d_height = 0;
+        d_pixels.clear();
+        return;
+    }
     d_pixels.reserve(size());
 
     auto imgIter = image.begin();
@@ -97,3 +108,60 @@ void Image::read_png(std::string const &filename)
         d_pixels.push_back(Color(r, g, b));
     }
 }
+
+double Image::compare(Image const &reference, unsigned &maxError) const
+{
+    if (d_width != reference.d_width or d_height != reference.d_height)
+        throw runtime_error("Image::compare(): image sizes differ");
+
+    double squaredError = 0.0;
+    maxError = 0;
+    for (unsigned idx = 0; idx != size(); ++idx)
+        for (unsigned channel = 0; channel != 3; ++channel)
+        {
+            int error = toByte(d_pixels[idx].data[channel])
+                        - toByte(reference.d_pixels[idx].data[channel]);
+            squaredError += error * error;
+            maxError = max(maxError, static_cast<unsigned>(abs(error)));
+        }
+
+    if (squaredError == 0.0)
+        return numeric_limits<double>::infinity();
+
+    double mse = squaredError / (3.0 * size());
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+Image Image::difference(Image const &reference, double gain) const
+{
+    if (d_width != reference.d_width or d_height != reference.d_height)
+        throw runtime_error("Image::difference(): image sizes differ");
+
+    Image diff(d_width, d_height);
+    for (unsigned idx = 0; idx != size(); ++idx)
+        for (unsigned channel = 0; channel != 3; ++channel)
+        {
+            int error = toByte(d_pixels[idx].data[channel])
+                        - toByte(reference.d_pixels[idx].data[channel]);
+            diff.d_pixels[idx].data[channel] = fmin(1.0, gain * abs(error) / 255.0);
+        }
+    return diff;
+}
+
+Image Image::crop(Region const &region) const
+{
+    Region inside = region.clipped(d_width, d_height);
+
+    Image cropped(inside.width(), inside.height());
+    for (unsigned y = 0; y != cropped.d_height; ++y)
+        for (unsigned x = 0; x != cropped.d_width; ++x)
+            cropped(x, y) = (*this)(inside.x0 + x, inside.y0 + y);
+    return cropped;
+}
+
+// --- Private -----------------------------------------------------------------
+
+unsigned char Image::toByte(double value)
+{
+    return static_cast<unsigned char>(value * 255.0);
+}
@@ -1,6 +1,7 @@
 #ifndef IMAGE_H_
 #define IMAGE_H_
 
+#include "region.h"
 #include "triple.h"
 
 #include <string>
@@ -37,7 +38,21 @@ class Image
         void write_png(std::string const &filename) const;
         void read_png(std::string const &filename);
 
+        // Compare with a reference image of the same size, on the 8-bit
+        // values write_png stores. Returns the PSNR in dB (infinity if the
+        // images are identical); maxError is set to the largest difference
+        // of a single channel (0 - 255).
+        double compare(Image const &reference, unsigned &maxError) const;
+
+        // per channel absolute difference to reference, multiplied by gain
+        Image difference(Image const &reference, double gain = 10.0) const;
+
+        // copy of the pixels inside region (clipped to the image)
+        Image crop(Region const &region) const;
+
     private:
+        static unsigned char toByte(double value);
+
         inline unsigned index(unsigned x, unsigned y) const
         {
             return y * d_width + x;
@@ -11,7 +11,7 @@ typedef std::shared_ptr<Light> LightPtr;
 class Light
 {
     public:
-        Point const position;
+        Point position;                 // moved by animations
         Color const color;
 
         Light(Point const &pos, Color const &c)
@@ -1,21 +1,215 @@
+#include "image.h"
 #include "raytracer.h"
+#include "renderserver.h"
+#include "threadpool.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+namespace
+{
+    // Thresholds for --check, on 8-bit channel values
+    double const MIN_PSNR = 40.0;       // dB
+    unsigned const MAX_ERROR = 16;      // largest single channel difference
+
+    // text as a non-negative number, false if it is not entirely one
+    bool parseAmount(char const *text, double &value)
+    {
+        char *end;
+        value = strtod(text, &end);
+        return end != text and *end == '\0' and value >= 0.0;
+    }
+
+    // Render a scene and compare it with a known good image, to catch
+    // visual regressions. The render is written to outName (if given),
+    // and on failure a difference image next to it (out_diff.png).
+    // Returns 1 on failure.
+    int checkScene(string const &sceneName, string const &referenceName,
+                   string const &outName)
+    try
+    {
+        Image reference(referenceName);
+        if (reference.size() == 0)
+        {
+            cerr << "Error: could not read reference image "
+                 << referenceName << ".\n";
+            return 1;
+        }
+
+        Raytracer raytracer;
+        if (!raytracer.readScene(sceneName))
+        {
+            cerr << "Error: reading scene from " << sceneName << " failed.\n";
+            return 1;
+        }
+
+        ThreadPool pool;
+        Image img = raytracer.render(pool);
+        if (not outName.empty())
+            img.write_png(outName);
+
+        // rendered at the scene's own size, which must not change either
+        if (img.width() != reference.width()
+            or img.height() != reference.height())
+        {
+            cout << "FAIL " << sceneName << ": size " << img.width() << 'x'
+                 << img.height() << ", reference " << reference.width()
+                 << 'x' << reference.height() << '\n';
+            return 1;
+        }
+
+        unsigned maxError;
+        double psnr = img.compare(reference, maxError);
+        bool passed = psnr >= MIN_PSNR and maxError <= MAX_ERROR;
+
+        cout << (passed ? "PASS " : "FAIL ") << sceneName
+             << ": PSNR " << psnr << " dB, max error " << maxError << '\n';
+
+        if (not passed and not outName.empty())
+        {
+            string diffName = outName.substr(0, outName.find_last_of('.'))
+                              + "_diff.png";
+            img.difference(reference).write_png(diffName);
+            cout << "Difference written to " << diffName << '\n';
+        }
+
+        return passed ? 0 : 1;
+    }
+    catch (exception const &ex)
+    {
+        cerr << "Error: " << ex.what() << '\n';
+        return 1;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     cout << "Computer Graphics - Ray tracer\n\n";
 
-    if (argc < 2 || argc > 3)
+    if (argc == 3 and string(argv[1]) == "--daemon")
     {
-        cerr << "Usage: " << argv[0] << " in-file [out-file.png]\n";
+        // keep scenes resident and render requests arriving on the socket
+        ThreadPool pool;
+        RenderServer server(argv[2], pool);
+        return server.run() ? 0 : 1;
+    }
+
+    if ((argc == 4 or argc == 5) and string(argv[1]) == "--check")
+        return checkScene(argv[2], argv[3], argc == 5 ? argv[4] : "");
+
+    // Options before the scene file:
+    //     --time-budget seconds: render progressively until the time is up
+    //     --region x,y,w,h:      only trace this rectangle (repeatable)
+    //     --patch:               write the regions into the existing output
+    //     --checkpoint:          log finished bands to out-file.ckpt
+    //     --resume:              as --checkpoint, continuing an existing one
+    //     --frames first-last|all: render an animation sequence
+    //     --reproject:           with --frames, reuse pixels of the last frame
+    //     --acceleration name:   auto, linear, grid or bvh, overriding the
+    //                            scene file
+    //     --texture-budget MB:   tile the textures, keeping at most MB of
+    //                            them in memory
+    string program = argv[0];
+    double budget = 0.0;
+    vector<Region> regions;
+    bool patch = false;
+    bool checkpoint = false;
+    bool resume = false;
+    string frames;
+    bool reproject = false;
+    string acceleration;
+    double textureBudget = 0.0;
+    bool badOption = false;
+    while (argc >= 2 and string(argv[1]).compare(0, 2, "--") == 0)
+    {
+        string option = argv[1];
+        Region region;
+        unsigned used = 1;
+        if (option == "--patch")
+            patch = true;
+        else if (option == "--checkpoint")
+            checkpoint = true;
+        else if (option == "--resume")
+            checkpoint = resume = true;
+        else if (option == "--reproject")
+            reproject = true;
+        else if (argc >= 3 and option == "--frames")
+        {
+            frames = argv[2];
+            used = 2;
+        }
+        else if (argc >= 3 and option == "--acceleration")
+        {
+            acceleration = argv[2];
+            used = 2;
+        }
+        else if (argc >= 3 and option == "--texture-budget"
+                 and parseAmount(argv[2], textureBudget))
+            used = 2;
+        else if (argc >= 3 and option == "--time-budget"
+                 and parseAmount(argv[2], budget))
+            used = 2;
+        else if (argc >= 3 and option == "--region"
+                 and Region::parse(argv[2], region))
+        {
+            regions.push_back(region);
+            used = 2;
+        }
+        else
+        {
+            badOption = true;
+            break;
+        }
+
+        argc -= used;
+        argv += used;
+    }
+
+    if (argc < 2 || argc > 3 || badOption
+        || (patch and regions.empty())
+        || (reproject and frames.empty())
+        || (budget > 0.0 and not regions.empty())
+        || (checkpoint and (budget > 0.0 or not regions.empty()))
+        || (not frames.empty()
+            and (checkpoint or budget > 0.0 or not regions.empty())))
+    {
+        cerr << "Usage: " << program
+             << " [--time-budget seconds] in-file [out-file.png]\n"
+             << "       " << program
+             << " --checkpoint|--resume in-file [out-file.png]\n"
+             << "       " << program
+             << " --frames first-last|all [--reproject] in-file"
+                " [out-file.png]\n"
+             << "       " << program
+             << " --region x,y,w,h [--region ...] [--patch] in-file"
+                " [out-file.png]\n"
+             << "       " << program << " --daemon socket-path\n"
+             << "       " << program
+             << " --check in-file reference.png [out-file.png]\n"
+             << "Rendering options may be preceded by"
+                " --acceleration auto|linear|grid|bvh\n"
+                "and --texture-budget MB.\n";
+        return 1;
+    }
+
+    Scene::Acceleration accelerationOverride = Scene::Acceleration::Auto;
+    if (not acceleration.empty()
+        and not Scene::parse(acceleration, accelerationOverride))
+    {
+        cerr << "Error: unknown acceleration " << acceleration
+             << ", expected auto, linear, grid or bvh.\n";
         return 1;
     }
 
     Raytracer raytracer;
+    if (textureBudget > 0.0)
+        raytracer.setTextureBudget(textureBudget);
 
     // read the scene
     if (!raytracer.readScene(argv[1]))
@@ -24,6 +218,8 @@ int main(int argc, char *argv[])
             " failed - no output generated.\n";
         return 1;
     }
+    if (not acceleration.empty())
+        raytracer.setAcceleration(accelerationOverride);
 
     // determine output name
     string ofname;
@@ -38,7 +234,40 @@ int main(int argc, char *argv[])
         ofname += ".png";
     }
 
-    raytracer.renderToFile(ofname);
+    ThreadPool pool;
+    if (not frames.empty())
+    {
+        unsigned first = 0;
+        unsigned last = raytracer.frameCount() - 1;
+        char end;
+        if (frames != "all"
+            and sscanf(frames.c_str(), "%u-%u%c", &first, &last, &end) != 2)
+        {
+            cerr << "Error: --frames expects first-last or all.\n";
+            return 1;
+        }
+        if (first > last or last >= raytracer.frameCount())
+        {
+            cerr << "Error: the scene has frames 0-"
+                 << raytracer.frameCount() - 1 << ".\n";
+            return 1;
+        }
+        if (reproject)
+            raytracer.setReproject(true);
+        raytracer.renderSequence(ofname, pool, first, last);
+        return 0;
+    }
+
+    if (not regions.empty())
+        return raytracer.renderRegionsToFile(ofname, pool, regions, patch) ? 0 : 1;
+
+    if (checkpoint)
+        return raytracer.renderToFileCheckpointed(ofname, pool, resume) ? 0 : 1;
+
+    if (budget > 0.0)
+        raytracer.renderToFileWithin(ofname, pool, budget);
+    else
+        raytracer.renderToFile(ofname, pool);
 
     return 0;
 }
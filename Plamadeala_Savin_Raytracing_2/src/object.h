@@ -1,6 +1,7 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include "box.h"
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
@@ -19,8 +20,30 @@ class Object
 
         virtual ~Object() = default;
 
-        virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
-                                                    // in derived class
+        // Closest-hit test, must be implemented in derived class.
+        // Returns the distance along the ray to the first intersection in
+        // front of its origin, or NO_DISTANCE if there is none. Nothing else
+        // about the hit is computed here; composite objects store which of
+        // their parts was hit in primitive.
+        virtual double distance(Ray const &ray, unsigned &primitive) = 0;
+
+        // Attribute stage, only called for the winning hit of distance().
+        // Pre-condition: for closed objects, N points outwards.
+        virtual Vector normal(Ray const &ray, double t, unsigned primitive) = 0;
+
+        // Bounding box, used by the acceleration structure. Objects
+        // without finite bounds are tested against every ray.
+        virtual Box bounds() const
+        {
+            return Box::everything();
+        }
+
+        // Move the object by offset, for animation. Returns false if the
+        // object cannot be moved.
+        virtual bool translate(Vector const &offset)
+        {
+            return false;
+        }
 
         virtual Vector toUV(Point const &hit)
         {
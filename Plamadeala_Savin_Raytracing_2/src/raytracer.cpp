@@ -1,8 +1,14 @@
 #include "raytracer.h"
 
+#include "assetloader.h"
+#include "checkpoint.h"
+#include "denoiser.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
+#include "reprojector.h"
+#include "texturecache.h"
+#include "threadpool.h"
 #include "triple.h"
 
 // =============================================================================
@@ -18,11 +24,20 @@
 
 #include "json/json.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <exception>
 #include <fstream>
 #include <iostream>
 
 using namespace std;        // no std:: required
+
+namespace
+{
+    // rows per checkpointed band
+    unsigned const BAND_HEIGHT = 16;
+}
 using json = nlohmann::json;
 
 bool Raytracer::parseObjectNode(json const &node)
@@ -42,11 +57,11 @@ bool Raytracer::parseObjectNode(json const &node)
             // Create sphere with rotation
             Vector rotation(node["rotation"]);
             double angle = node["angle"];
-            obj = ObjectPtr(new Sphere(pos, radius, rotation, angle));
+            obj = scene.make<Sphere>(pos, radius, rotation, angle);
         }
         else
         {
-            obj = ObjectPtr(new Sphere(pos, radius));
+            obj = scene.make<Sphere>(pos, radius);
         }
     }
     else if (node["type"] == "quad")
@@ -55,7 +70,7 @@ bool Raytracer::parseObjectNode(json const &node)
         Point v1(node["v1"]);
         Point v2(node["v2"]);
         Point v3(node["v3"]);
-        obj = ObjectPtr(new Quad(v0, v1, v2, v3));
+        obj = scene.make<Quad>(v0, v1, v2, v3);
     }
     else
     {
@@ -69,8 +84,23 @@ bool Raytracer::parseObjectNode(json const &node)
     if (!obj)
         return false;
 
+    if (node.count("offsetKeys"))
+    {
+        // a zero move tells whether the object can be moved at all
+        if (not obj->translate(Vector(0, 0, 0)))
+        {
+            cerr << "Objects of type " << node["type"]
+                 << " cannot be animated.\n";
+            return false;
+        }
+        animatedObjects.push_back(AnimatedObject{scene.getNumObject(),
+                                  Track(node["offsetKeys"]), Vector()});
+    }
+
     // Parse material and add object to the scene
     obj->material = parseMaterialNode(node["material"]);
+    viewIndependent.push_back(obj->material.ks == 0.0
+                              and not obj->material.isTransparent);
     scene.addObject(obj);
     return true;
 }
@@ -105,8 +135,7 @@ Material Raytracer::parseMaterialNode(json const &node) const
     if (node.count("texture"))
     {
         string imagePath = node["texture"];
-        Image im(imagePath);
-        return Material(im, ka, kd, ks, n);
+        return Material(assets->texture(imagePath), ka, kd, ks, n);
     }
 
     // No color or texture specified
@@ -119,8 +148,46 @@ try
     // Read and parse input json file
     ifstream infile(ifname);
     if (!infile) throw runtime_error("Could not open input file for reading.");
-    json jsonscene;
-    infile >> jsonscene;
+
+    // The entries of Objects are turned into objects as soon as they are
+    // parsed and then dropped from the document, so large scenes never
+    // exist as a whole json tree. They are fingerprinted one by one,
+    // followed by the rest of the document. TextureBudgetMB is applied as
+    // soon as it is read, as it affects how the textures of the objects
+    // after it are loaded; after the Objects, their textures would already
+    // be decoding into memory.
+    string topKey;
+    bool objectsRead = false;
+    unsigned objCount = 0;
+    fingerprint = Checkpoint::hash("");
+    auto streamObjects = [&](int depth, json::parse_event_t event,
+                             json &parsed)
+    {
+        if (event == json::parse_event_t::key and depth == 1)
+        {
+            topKey = parsed.get<string>();
+            objectsRead = objectsRead or topKey == "Objects";
+        }
+        else if (event == json::parse_event_t::value and depth == 1
+                 and topKey == "TextureBudgetMB")
+        {
+            if (objectsRead)
+                throw runtime_error("TextureBudgetMB must come before "
+                                    "Objects in the scene file.");
+            setTextureBudget(parsed.get<double>());
+        }
+        else if (event == json::parse_event_t::object_end and depth == 2
+                 and topKey == "Objects")
+        {
+            fingerprint = Checkpoint::hash(parsed.dump(), fingerprint);
+            if (parseObjectNode(parsed))
+                ++objCount;
+            return false;
+        }
+        return true;
+    };
+    json jsonscene = json::parse(infile, streamObjects);
+    fingerprint = Checkpoint::hash(jsonscene.dump(), fingerprint);
 
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
@@ -153,16 +220,107 @@ try
         scene.setRenderShadows(shadows);
     }
 
+    if (jsonscene.count("Frames"))
+    {
+        json const &count = jsonscene["Frames"];
+        if (not count.is_number_integer() or count.get<long long>() < 1)
+            throw runtime_error("Frames must be a whole number of at least 1.");
+        frames = count.get<unsigned>();
+    }
+
+    if (jsonscene.count("EyeKeys"))
+        eyeTrack = Track(jsonscene["EyeKeys"]);
+
+    if (jsonscene.count("Denoise"))
+        denoise = jsonscene["Denoise"];
+
+    if (jsonscene.count("Reproject"))
+        reproject = jsonscene["Reproject"];
+
+    if (jsonscene.count("SaveAuxBuffers"))
+        saveAuxBuffers = jsonscene["SaveAuxBuffers"];
+
+    if (jsonscene.count("Sampler"))
+    {
+        string name = jsonscene["Sampler"];
+        Sampler::Pattern pattern;
+        if (not Sampler::parse(name, pattern))
+        {
+            cerr << "Unknown sampler: " << name << '\n';
+            return false;
+        }
+        scene.setSamplePattern(pattern);
+    }
+
+    if (jsonscene.count("Integrator"))
+    {
+        string integrator = jsonscene["Integrator"];
+        if (integrator == "path")
+            scene.setIntegrator(Scene::Integrator::Path);
+        else if (integrator == "whitted")
+            scene.setIntegrator(Scene::Integrator::Whitted);
+        else
+        {
+            cerr << "Unknown integrator: " << integrator << '\n';
+            return false;
+        }
+    }
+
+    if (jsonscene.count("Acceleration"))
+    {
+        string name = jsonscene["Acceleration"];
+        Scene::Acceleration acceleration;
+        if (not Scene::parse(name, acceleration))
+        {
+            cerr << "Unknown acceleration: " << name << '\n';
+            return false;
+        }
+        scene.setAcceleration(acceleration);
+    }
+
+    if (jsonscene.count("BvhBuild"))
+    {
+        string name = jsonscene["BvhBuild"];
+        Bvh::Method method;
+        if (not Bvh::parse(name, method))
+        {
+            cerr << "Unknown BVH build: " << name << '\n';
+            return false;
+        }
+        scene.setBvhMethod(method);
+    }
+
+    if (jsonscene.count("BvhWidth") or jsonscene.count("BvhQuantized"))
+    {
+        unsigned width = jsonscene.value("BvhWidth", 4u);
+        bool quantized = jsonscene.value("BvhQuantized", false);
+        if (width != 2 and width != 4 and width != 8)
+        {
+            cerr << "BvhWidth must be 2, 4 or 8.\n";
+            return false;
+        }
+        scene.setBvhWidth(width, quantized);
+    }
+
+    if (jsonscene.count("MaxPathLength"))
+    {
+        int length = jsonscene["MaxPathLength"];
+        scene.setMaxPathLength(length);
+    }
+
     for (auto const &lightNode : jsonscene["Lights"])
+    {
+        if (lightNode.count("positionKeys"))
+            animatedLights.push_back(AnimatedLight{scene.getNumLights(),
+                                     Track(lightNode["positionKeys"])});
         scene.addLight(parseLightNode(lightNode));
-
-    unsigned objCount = 0;
-    for (auto const &objectNode : jsonscene["Objects"])
-        if (parseObjectNode(objectNode))
-            ++objCount;
+    }
 
     cout << "Parsed " << objCount << " objects.\n";
 
+    // animated scenes start out posed for the first frame
+    setFrame(0);
+
 // =============================================================================
 // -- End of scene data reading ------------------------------------------------
 // =============================================================================
@@ -175,13 +333,362 @@ catch (exception const &ex)
     return false;
 }
 
-void Raytracer::renderToFile(string const &ofname)
+void Raytracer::prepare(ThreadPool &pool)
+{
+    assets->wait();
+    scene.prepare(pool);
+}
+
+Raytracer::Settings Raytracer::settings() const
+{
+    return Settings{width, height, denoise, scene.getSettings()};
+}
+
+Image Raytracer::render(ThreadPool &pool, AuxBuffers *aux)
+{
+    prepare(pool);
+    return render(pool, settings(), aux);
+}
+
+Image Raytracer::render(ThreadPool &pool, Settings const &settings,
+                        AuxBuffers *aux) const
+{
+    Image img(settings.width, settings.height);
+
+    AuxBuffers denoiseAux;
+    if (settings.denoise and !aux)
+        aux = &denoiseAux;
+    if (aux)
+        *aux = AuxBuffers(settings.width, settings.height);
+
+    cout << "Tracing...\n";
+    scene.render(img, pool, settings.scene, aux);
+
+    if (shared_ptr<TextureCache> cache = assets->cache())
+    {
+        TextureCache::Stats stats = cache->stats();
+        cout << "Texture tiles: " << stats.lookups << " lookups, "
+             << stats.reads << " read, " << stats.evictions
+             << " evicted, peak " << stats.peakBytes / (1024.0 * 1024.0)
+             << " MB\n";
+    }
+
+    if (settings.denoise)
+    {
+        cout << "Denoising...\n";
+        img = Denoiser().denoise(img, *aux, pool);
+    }
+    return img;
+}
+
+void Raytracer::renderToFile(string const &ofname, ThreadPool &pool)
+{
+    prepare(pool);
+    renderToFile(ofname, pool, settings());
+}
+
+void Raytracer::renderToFile(string const &ofname, ThreadPool &pool,
+                             Settings const &settings) const
+{
+    AuxBuffers aux;
+    Image img = render(pool, settings, saveAuxBuffers ? &aux : nullptr);
+    cout << "Writing image to " << ofname << "...\n";
+    img.write_png(ofname);
+
+    if (saveAuxBuffers)
+    {
+        // out.png -> out_albedo.png, out_normal.png, out_depth.png
+        string prefix = ofname.substr(0, ofname.find_last_of('.'));
+        cout << "Writing auxiliary buffers to " << prefix << "_*.png...\n";
+        aux.write_png(prefix);
+    }
+    cout << "Done.\n";
+}
+
+bool Raytracer::renderRegionsToFile(string const &ofname, ThreadPool &pool,
+                                    vector<Region> const &regions, bool patch)
+{
+    prepare(pool);
+    return renderRegionsToFile(ofname, pool, settings(), regions, patch);
+}
+
+bool Raytracer::renderRegionsToFile(string const &ofname, ThreadPool &pool,
+                                    Settings const &settings,
+                                    vector<Region> const &regions,
+                                    bool patch) const
+{
+    unsigned width = settings.width;
+    unsigned height = settings.height;
+    Image img(width, height);
+    if (patch)
+    {
+        img = Image(ofname);
+        if (img.width() != width or img.height() != height)
+        {
+            cerr << "Cannot patch " << ofname << ": it is " << img.width()
+                 << 'x' << img.height() << ", the render is " << width
+                 << 'x' << height << ".\n";
+            return false;
+        }
+    }
+
+    Region bounds;
+    for (Region const &region : regions)
+        bounds = bounds.united(region.clipped(width, height));
+    if (bounds.empty())
+    {
+        cerr << "No pixels to render, the regions lie outside the "
+             << width << 'x' << height << " image.\n";
+        return false;
+    }
+
+    cout << "Tracing " << regions.size() << " region(s)...\n";
+    scene.render(img, pool, settings.scene, regions);
+
+    cout << "Writing image to " << ofname << "...\n";
+    if (patch)
+        img.write_png(ofname);
+    else
+        img.crop(bounds).write_png(ofname);
+    cout << "Done.\n";
+    return true;
+}
+
+bool Raytracer::renderToFileCheckpointed(string const &ofname,
+                                         ThreadPool &pool, bool resume)
 {
-    // TODO: the size may be a settings in your file
-    Image img(400, 400);
+    assets->wait();
+    Image img(width, height);
+    Checkpoint checkpoint(ofname + ".ckpt", fingerprint, width, height,
+                          BAND_HEIGHT);
+
+    vector<bool> done = checkpoint.start(resume, img);
+    if (done.empty())
+    {
+        cerr << "Could not write checkpoint " << ofname << ".ckpt\n";
+        return false;
+    }
+
+    vector<unsigned> todo;
+    for (unsigned band = 0; band != done.size(); ++band)
+        if (not done[band])
+            todo.push_back(band);
+    if (todo.size() != done.size())
+        cout << "Resuming, " << done.size() - todo.size() << " of "
+             << done.size() << " bands were already done.\n";
+
+    // One band per worker at a time, so all of them have rows to trace.
     cout << "Tracing...\n";
-    scene.render(img);
+    unsigned batchSize = max(pool.size(), 1u);
+    for (size_t first = 0; first < todo.size(); first += batchSize)
+    {
+        size_t last = min(todo.size(), first + batchSize);
+
+        vector<Region> regions;
+        for (size_t idx = first; idx != last; ++idx)
+            regions.push_back(checkpoint.band(todo[idx]));
+        scene.render(img, pool, regions);
+
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            if (not checkpoint.append(todo[idx], img))
+            {
+                cerr << "Could not append to checkpoint " << ofname
+                     << ".ckpt\n";
+                return false;
+            }
+        }
+    }
+
+    if (denoise)
+        cerr << "Denoise is not applied to checkpointed renders.\n";
+
     cout << "Writing image to " << ofname << "...\n";
     img.write_png(ofname);
+    checkpoint.finish();
+    cout << "Done.\n";
+    return true;
+}
+
+void Raytracer::renderToFileWithin(string const &ofname, ThreadPool &pool,
+                                   double seconds)
+{
+    prepare(pool);
+    renderToFileWithin(ofname, pool, settings(), seconds);
+}
+
+void Raytracer::renderToFileWithin(string const &ofname, ThreadPool &pool,
+                                   Settings const &settings,
+                                   double seconds) const
+{
+    Image img(settings.width, settings.height);
+    string tmpname = ofname + ".tmp";
+
+    cout << "Tracing for at most " << seconds << " s...\n";
+    double samples = scene.renderWithin(img, pool, settings.scene, seconds,
+        [&](Image const &current)
+        {
+            // rename is atomic, readers never see a half written file
+            current.write_png(tmpname);
+            if (rename(tmpname.c_str(), ofname.c_str()) != 0)
+                cerr << "Could not replace " << ofname << '\n';
+        });
+    cout << "Wrote " << ofname << " with " << samples
+         << " samples per pixel on average.\nDone.\n";
+}
+
+unsigned Raytracer::frameCount() const
+{
+    return frames;
+}
+
+void Raytracer::setFrame(unsigned frame)
+{
+    if (not eyeTrack.empty())
+        scene.setEye(eyeTrack.at(frame));
+
+    for (AnimatedLight const &light : animatedLights)
+        scene.setLightPosition(light.index, light.position.at(frame));
+
+    for (AnimatedObject &animated : animatedObjects)
+    {
+        Vector offset = animated.offset.at(frame);
+        Vector delta = offset - animated.applied;
+        if (delta.x == 0.0 and delta.y == 0.0 and delta.z == 0.0)
+            continue;
+
+        scene.moveObject(animated.index, delta);
+        animated.applied = offset;
+    }
+}
+
+vector<bool> Raytracer::reusableObjects(unsigned frame) const
+{
+    vector<bool> reusable = viewIndependent;
+
+    // Moving lights change all shading. Path traced pixels are noisy
+    // estimates that also depend on other objects.
+    bool relit = scene.getIntegrator() == Scene::Integrator::Path;
+    for (AnimatedLight const &light : animatedLights)
+    {
+        if (frame == 0)
+            break;
+        Vector delta = light.position.at(frame) - light.position.at(frame - 1);
+        relit = relit or delta.length_2() != 0.0;
+    }
+
+    bool moved = false;
+    for (AnimatedObject const &animated : animatedObjects)
+    {
+        Vector delta = animated.offset.at(frame) - animated.applied;
+        if (delta.length_2() != 0.0)
+        {
+            reusable[animated.index] = false;
+            moved = true;
+        }
+    }
+
+    // a moving object may cast its shadow onto any other
+    if (relit or (moved and scene.getRenderShadows()))
+        fill(reusable.begin(), reusable.end(), false);
+    return reusable;
+}
+
+void Raytracer::renderSequence(string const &ofname, ThreadPool &pool,
+                               unsigned first, unsigned last)
+{
+    assets->wait();
+    size_t dot = ofname.find_last_of('.');
+    string stem = ofname.substr(0, dot);
+    string extension = dot == string::npos ? ".png" : ofname.substr(dot);
+
+    Reprojector reprojector;
+    if (reproject and denoise)
+        cerr << "Denoise is not applied to reprojected frames.\n";
+
+    for (unsigned frame = first; frame <= last; ++frame)
+    {
+        auto start = chrono::steady_clock::now();
+        vector<bool> reusable = reusableObjects(frame);
+        setFrame(frame);
+        auto posed = chrono::steady_clock::now();
+
+        Image img(width, height);
+        Reprojector::Stats stats;
+        if (reproject)
+            stats = reprojector.render(scene, img, pool, reusable);
+        else
+            img = render(pool);
+        auto traced = chrono::steady_clock::now();
+
+        char number[16];
+        snprintf(number, sizeof number, "_%04u", frame);
+        string name = stem + number + extension;
+        img.write_png(name);
+        auto written = chrono::steady_clock::now();
+
+        chrono::duration<double, milli> setup = posed - start;
+        chrono::duration<double, milli> trace = traced - posed;
+        chrono::duration<double, milli> write = written - traced;
+        cout << "Frame " << frame << " -> " << name << ": setup "
+             << setup.count() << " ms, trace " << trace.count()
+             << " ms, write " << write.count() << " ms";
+        if (reproject)
+            cout << ", reused " << stats.reused << " of "
+                 << stats.reused + stats.traced << " pixels";
+        cout << '\n';
+    }
     cout << "Done.\n";
 }
+
+void Raytracer::setReproject(bool enable)
+{
+    reproject = enable;
+}
+
+void Raytracer::setResolution(unsigned w, unsigned h)
+{
+    width = w;
+    height = h;
+}
+
+void Raytracer::setSuperSample(unsigned factor)
+{
+    scene.setSuperSample(factor);
+}
+
+void Raytracer::setTextureBudget(double megabytes)
+{
+    if (megabytes > 0.0)
+        assets->setTextureBudget(megabytes * 1024 * 1024);
+}
+
+void Raytracer::setRecursionDepth(unsigned depth)
+{
+    scene.setRecursionDepth(depth);
+}
+
+void Raytracer::setRenderShadows(bool shadows)
+{
+    scene.setRenderShadows(shadows);
+}
+
+void Raytracer::setSpecialisedShading(bool specialised)
+{
+    scene.setSpecialisedShading(specialised);
+}
+
+void Raytracer::setDenoise(bool enable)
+{
+    denoise = enable;
+}
+
+void Raytracer::setAcceleration(Scene::Acceleration acceleration)
+{
+    scene.setAcceleration(acceleration);
+}
+
+Scene::Acceleration Raytracer::acceleration() const
+{
+    return scene.getAcceleration();
+}
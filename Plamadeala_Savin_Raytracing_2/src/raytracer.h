@@ -1,29 +1,159 @@
 #ifndef RAYTRACER_H_
 #define RAYTRACER_H_
 
+#include "animation.h"
+#include "assetloader.h"
+#include "region.h"
 #include "scene.h"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 // Forward declarations
+struct AuxBuffers;
+class Image;
 class Light;
 class Material;
+class ThreadPool;
 
 #include "json/json_fwd.h"
 
 class Raytracer
 {
+    struct AnimatedLight
+    {
+        unsigned index;
+        Track position;
+    };
+
+    struct AnimatedObject
+    {
+        unsigned index;         // in the scene
+        Track offset;
+        Vector applied;         // offset the object was moved by so far
+    };
+
     Scene scene;
+    unsigned width = 400;
+    unsigned height = 400;
+    bool denoise = false;
+    bool saveAuxBuffers = false;
+    uint64_t fingerprint = 0;       // of the scene description
+
+    unsigned frames = 1;
+    Track eyeTrack;
+    std::vector<AnimatedLight> animatedLights;
+    std::vector<AnimatedObject> animatedObjects;
+
+    bool reproject = false;
+    std::vector<bool> viewIndependent;  // per object: diffuse shading only
+
+    // decodes the textures while the scene is read; every render waits
+    // for it first
+    std::shared_ptr<AssetLoader> assets = std::make_shared<AssetLoader>();
 
     public:
 
+        // The settings a single render may override, see the const render
+        // functions below.
+        struct Settings
+        {
+            unsigned width;
+            unsigned height;
+            bool denoise;
+            Scene::Settings scene;
+        };
+
         bool readScene(std::string const &ifname);
-        void renderToFile(std::string const &ofname);
+
+        // Keep at most the given MB of texture tiles in memory, for the
+        // textures read from now on (see AssetLoader). Scene files set it
+        // with TextureBudgetMB, before their Objects.
+        void setTextureBudget(double megabytes);
+
+        // Wait for the textures and build the acceleration structure.
+        // Rendering does this itself when needed; the renders with
+        // settings of their own below need it done up front.
+        void prepare(ThreadPool &pool);
+
+        // aux, if given, receives the feature buffers of the render
+        Image render(ThreadPool &pool, AuxBuffers *aux = nullptr);
+        void renderToFile(std::string const &ofname, ThreadPool &pool);
+
+        // Only trace the pixels inside regions. With patch, they replace
+        // the pixels of the existing image ofname (which must have the
+        // render's size); otherwise the bounding box of the regions is
+        // written as a cropped image. Returns false on failure.
+        bool renderRegionsToFile(std::string const &ofname, ThreadPool &pool,
+                                 std::vector<Region> const &regions,
+                                 bool patch);
+
+        // Render band by band, logging every finished band to
+        // ofname.ckpt. With resume, the bands in an existing checkpoint of
+        // the same scene are reused. The checkpoint is removed once the
+        // image is written. Returns false on failure.
+        bool renderToFileCheckpointed(std::string const &ofname,
+                                      ThreadPool &pool, bool resume);
+
+        // Animation. setFrame poses the camera, lights and objects with
+        // keyframes for the given frame; objects are only touched when
+        // their offset changed.
+        unsigned frameCount() const;
+        void setFrame(unsigned frame);
+
+        // Render frames first ... last, writing frame f to ofname with
+        // _<f> (four digits) inserted before the extension. With
+        // reprojection, pixels that can be are copied from the previous
+        // frame instead of traced.
+        void renderSequence(std::string const &ofname, ThreadPool &pool,
+                            unsigned first, unsigned last);
+
+        // progressive render that stops after about the given time. The
+        // file is replaced after every pass, so it always holds a
+        // complete image.
+        void renderToFileWithin(std::string const &ofname, ThreadPool &pool,
+                                double seconds);
+
+        // the settings read from the scene file, with the overrides below
+        Settings settings() const;
+
+        // The renders above with the given settings instead. They leave
+        // the raytracer as it is, so one prepared raytracer can serve
+        // renders with different settings. Requires prepare().
+        Image render(ThreadPool &pool, Settings const &settings,
+                     AuxBuffers *aux = nullptr) const;
+        void renderToFile(std::string const &ofname, ThreadPool &pool,
+                          Settings const &settings) const;
+        bool renderRegionsToFile(std::string const &ofname, ThreadPool &pool,
+                                 Settings const &settings,
+                                 std::vector<Region> const &regions,
+                                 bool patch) const;
+        void renderToFileWithin(std::string const &ofname, ThreadPool &pool,
+                                Settings const &settings,
+                                double seconds) const;
+
+        // Overrides of the settings read from the scene file
+        void setResolution(unsigned w, unsigned h);
+        void setSuperSample(unsigned factor);
+        void setRecursionDepth(unsigned depth);
+        void setRenderShadows(bool shadows);
+        void setSpecialisedShading(bool specialised);
+        void setDenoise(bool enable);
+        void setReproject(bool enable);
+        void setAcceleration(Scene::Acceleration acceleration);
+
+        // the acceleration used by the last render, resolving Auto
+        Scene::Acceleration acceleration() const;
 
     private:
 
         bool parseObjectNode(nlohmann::json const &node);
 
+        // which objects may be reprojected from frame - 1 into frame
+        std::vector<bool> reusableObjects(unsigned frame) const;
+
         Light parseLightNode(nlohmann::json const &node) const;
         Material parseMaterialNode(nlohmann::json const &node) const;
 };
@@ -0,0 +1,75 @@
+#ifndef REGION_H_
+#define REGION_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// Rectangle of pixels: x0 <= x < x1, y0 <= y < y1, y = 0 is the top row
+class Region
+{
+    public:
+        unsigned x0;
+        unsigned y0;
+        unsigned x1;
+        unsigned y1;
+
+        Region(unsigned left = 0, unsigned top = 0,
+               unsigned right = 0, unsigned bottom = 0)
+        :
+            x0(left),
+            y0(top),
+            x1(right),
+            y1(bottom)
+        {}
+
+        unsigned width() const
+        {
+            return x1 > x0 ? x1 - x0 : 0;
+        }
+
+        unsigned height() const
+        {
+            return y1 > y0 ? y1 - y0 : 0;
+        }
+
+        bool empty() const
+        {
+            return width() == 0 or height() == 0;
+        }
+
+        // the part of this region inside a width x height image
+        Region clipped(unsigned width, unsigned height) const
+        {
+            return Region(std::min(x0, width), std::min(y0, height),
+                          std::min(x1, width), std::min(y1, height));
+        }
+
+        // the smallest region containing both
+        Region united(Region const &other) const
+        {
+            if (empty())
+                return other;
+            if (other.empty())
+                return *this;
+            return Region(std::min(x0, other.x0), std::min(y0, other.y0),
+                          std::max(x1, other.x1), std::max(y1, other.y1));
+        }
+
+        // parse "x,y,width,height"
+        static bool parse(std::string const &text, Region &region)
+        {
+            unsigned x;
+            unsigned y;
+            unsigned w;
+            unsigned h;
+            char end;
+            if (std::sscanf(text.c_str(), "%u,%u,%u,%u%c",
+                            &x, &y, &w, &h, &end) != 4)
+                return false;
+            region = Region(x, y, x + w, y + h);
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "renderserver.h"
+
+#include "threadpool.h"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // A client has this long to send its request and take the reply, so
+    // a stalled one cannot hold up the others.
+    timeval const CLIENT_TIMEOUT = {5, 0};
+
+    // text as an unsigned number, false if it is not entirely one
+    bool parseUnsigned(string const &text, unsigned &value)
+    {
+        if (text.empty() or not isdigit(static_cast<unsigned char>(text[0])))
+            return false;
+        char *end;
+        errno = 0;
+        unsigned long parsed = strtoul(text.c_str(), &end, 10);
+        if (*end != '\0' or errno == ERANGE or parsed > UINT_MAX)
+            return false;
+        value = parsed;
+        return true;
+    }
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        chrono::duration<double, milli> elapsed =
+            chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+}
+
+RenderServer::RenderServer(string const &socketPath, ThreadPool &pool)
+:
+    d_socketPath(socketPath),
+    d_pool(pool)
+{}
+
+bool RenderServer::run()
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (d_socketPath.size() >= sizeof addr.sun_path)
+    {
+        cerr << "Socket path too long: " << d_socketPath << '\n';
+        return false;
+    }
+    strcpy(addr.sun_path, d_socketPath.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+    {
+        cerr << "Could not create socket: " << strerror(errno) << '\n';
+        return false;
+    }
+
+    unlink(d_socketPath.c_str());   // remove a stale socket of a previous run
+    if (bind(server, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0
+        or listen(server, 16) < 0)
+    {
+        cerr << "Could not listen on " << d_socketPath << ": "
+             << strerror(errno) << '\n';
+        close(server);
+        return false;
+    }
+
+    cout << "Listening on " << d_socketPath << " with "
+         << d_pool.size() << " threads.\n";
+
+    bool quit = false;
+    while (not quit)
+    {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &CLIENT_TIMEOUT,
+                   sizeof CLIENT_TIMEOUT);
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &CLIENT_TIMEOUT,
+                   sizeof CLIENT_TIMEOUT);
+
+        // read a single request line, the end of the input ends it too
+        string request;
+        char ch;
+        ssize_t got;
+        while ((got = read(client, &ch, 1)) == 1 and ch != '\n')
+            request += ch;
+
+        string reply;
+        if (got >= 0)
+            reply = handleRequest(request, quit);
+        else if (errno == EAGAIN or errno == EWOULDBLOCK)
+            reply = "error timed out waiting for the request";
+        else
+            reply = string("error reading the request: ") + strerror(errno);
+        reply += '\n';
+        send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+        close(client);
+    }
+
+    close(server);
+    unlink(d_socketPath.c_str());
+    return true;
+}
+
+// --- Private -----------------------------------------------------------------
+
+string RenderServer::handleRequest(string const &request, bool &quit)
+try
+{
+    istringstream tokens(request);
+    string command;
+    tokens >> command;
+
+    if (command == "quit")
+    {
+        quit = true;
+        return "ok";
+    }
+
+    if (command != "render")
+        return "error unknown command '" + command + "'";
+
+    string sceneFile;
+    string outFile;
+    if (not (tokens >> sceneFile >> outFile))
+        return "error usage: render <scene.json> <out.png> [key=value ...]";
+
+    auto start = chrono::steady_clock::now();
+    bool cached;
+    Raytracer const *resident = loadScene(sceneFile, cached);
+    if (!resident)
+        return "error reading scene from " + sceneFile + " failed";
+    double loadTime = millisecondsSince(start);
+
+    // Overrides only apply to this job, the resident scene is left untouched.
+    Raytracer::Settings settings = resident->settings();
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned budget = 0;        // ms, 0 for a full render
+    vector<Region> regions;
+    bool patch = false;
+    string option;
+    while (tokens >> option)
+    {
+        size_t split = option.find('=');
+        if (split == string::npos)
+            return "error malformed option '" + option + "'";
+
+        string key = option.substr(0, split);
+        if (key == "region")
+        {
+            Region region;
+            if (not Region::parse(option.substr(split + 1), region))
+                return "error malformed region '" + option + "'";
+            regions.push_back(region);
+            continue;
+        }
+
+        unsigned value;
+        if (not parseUnsigned(option.substr(split + 1), value))
+            return "error malformed option '" + option + "'";
+
+        if (key == "width")
+            width = value;
+        else if (key == "height")
+            height = value;
+        else if (key == "samples")
+            settings.scene.supersamplingFactor = value;
+        else if (key == "depth")
+            settings.scene.recursionDepth = value;
+        else if (key == "shadows")
+            settings.scene.renderShadows = value != 0;
+        else if (key == "denoise")
+            settings.denoise = value != 0;
+        else if (key == "budget_ms")
+            budget = value;
+        else if (key == "patch")
+            patch = value != 0;
+        else
+            return "error unknown option '" + key + "'";
+    }
+
+    if (width != 0 or height != 0)
+    {
+        settings.width = width ? width : height;
+        settings.height = height ? height : width;
+    }
+
+    start = chrono::steady_clock::now();
+    if (not regions.empty())
+    {
+        if (not resident->renderRegionsToFile(outFile, d_pool, settings,
+                                              regions, patch))
+            return "error could not render the regions into " + outFile;
+    }
+    else if (budget != 0)
+        resident->renderToFileWithin(outFile, d_pool, settings, budget / 1000.0);
+    else
+        resident->renderToFile(outFile, d_pool, settings);
+    double traceTime = millisecondsSince(start);
+
+    ostringstream reply;
+    reply << "ok cached=" << cached << " load_ms=" << loadTime
+          << " trace_ms=" << traceTime;
+    return reply.str();
+}
+catch (exception const &ex)
+{
+    return string("error ") + ex.what();
+}
+
+Raytracer const *RenderServer::loadScene(string const &path, bool &cached)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return nullptr;
+
+    auto entry = d_scenes.find(path);
+    cached = entry != d_scenes.end()
+             and entry->second.mtime.tv_sec == info.st_mtim.tv_sec
+             and entry->second.mtime.tv_nsec == info.st_mtim.tv_nsec;
+    if (cached)
+        return entry->second.raytracer.get();
+
+    unique_ptr<Raytracer> raytracer(new Raytracer);
+    if (!raytracer->readScene(path))
+        return nullptr;
+
+    // built once here, the jobs render from it as it is
+    raytracer->prepare(d_pool);
+
+    CachedScene &slot = d_scenes[path];
+    slot.mtime = info.st_mtim;
+    slot.raytracer = move(raytracer);
+    return slot.raytracer.get();
+}
@@ -0,0 +1,51 @@
+#ifndef RENDERSERVER_H_
+#define RENDERSERVER_H_
+
+#include "raytracer.h"
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+
+class ThreadPool;
+
+// Long running render daemon. Listens on a Unix domain socket, keeps every
+// parsed scene resident (keyed by path and modification time) and renders
+// the requested jobs on a shared thread pool.
+//
+// One request per connection, a single line of text:
+//     render <scene.json> <out.png> [width=N] [height=N] [samples=N]
+//            [depth=N] [shadows=0|1] [denoise=0|1] [budget_ms=N]
+//            [region=x,y,w,h ...] [patch=0|1]
+//     quit
+// The reply is a single line starting with "ok" or "error". Connections
+// are served one at a time; a client that sends nothing for a few seconds
+// is answered with an error and dropped.
+class RenderServer
+{
+    struct CachedScene
+    {
+        timespec mtime;
+        std::unique_ptr<Raytracer> raytracer;
+    };
+
+    std::string d_socketPath;
+    ThreadPool &d_pool;
+    std::map<std::string, CachedScene> d_scenes;
+
+    public:
+        RenderServer(std::string const &socketPath, ThreadPool &pool);
+
+        // serve requests until a quit request arrives
+        // returns false if the socket could not be set up
+        bool run();
+
+    private:
+        std::string handleRequest(std::string const &request, bool &quit);
+
+        // returns the resident scene, (re)loading it when the file changed
+        Raytracer const *loadScene(std::string const &path, bool &cached);
+};
+
+#endif
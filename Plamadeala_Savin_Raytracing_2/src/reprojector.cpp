@@ -0,0 +1,203 @@
+#include "reprojector.h"
+
+#include "ray.h"
+#include "scene.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    unsigned const TILE_SIZE = 16;
+
+    // every frame, tiles (index + frame) % REFRESH_PERIOD == 0 are retraced
+    unsigned const REFRESH_PERIOD = 8;
+
+    // a tile reusing less than this fraction of its object pixels is retraced
+    double const MIN_REUSE = 0.5;
+
+    // allowed difference in distance to the eye, relative
+    double const DEPTH_TOLERANCE = 0.01;
+
+    // largest color difference (per channel) with a neighbor off an edge
+    double const EDGE_THRESHOLD = 0.02;
+
+    // whether the 3x3 neighborhood of (x, y) sees more than one object
+    bool silhouette(vector<unsigned> const &object, unsigned w, unsigned h,
+                    unsigned x, unsigned y)
+    {
+        unsigned center = object[y * w + x];
+        for (unsigned ny = y == 0 ? 0 : y - 1; ny <= min(y + 1, h - 1); ++ny)
+        {
+            for (unsigned nx = x == 0 ? 0 : x - 1; nx <= min(x + 1, w - 1); ++nx)
+            {
+                if (object[ny * w + nx] != center)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // whether the color of (x, y) differs much from a 4-neighbor
+    bool edge(Image const &img, unsigned x, unsigned y)
+    {
+        Color const &center = img(x, y);
+        int const offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for (auto const &offset : offsets)
+        {
+            int nx = static_cast<int>(x) + offset[0];
+            int ny = static_cast<int>(y) + offset[1];
+            if (nx < 0 or ny < 0 or nx >= static_cast<int>(img.width())
+                or ny >= static_cast<int>(img.height()))
+                continue;
+
+            Color delta = img(nx, ny) - center;
+            if (max(abs(delta.r), max(abs(delta.g), abs(delta.b)))
+                > EDGE_THRESHOLD)
+                return true;
+        }
+        return false;
+    }
+}
+
+Reprojector::Stats Reprojector::render(Scene &scene, Image &img,
+                                       ThreadPool &pool,
+                                       vector<bool> const &reusable)
+{
+    unsigned const w = img.width();
+    unsigned const h = img.height();
+    unsigned const none = scene.getNumObject();
+    Point const eye = scene.getEye();
+    scene.prepare(pool);
+
+    // First hits through the pixel centers, the same rays as Scene::render
+    // traces without supersampling.
+    vector<Point> hit(w * h);
+    vector<unsigned> object(w * h);
+    pool.parallelFor(h, [&](unsigned y)
+    {
+        for (unsigned x = 0; x != w; ++x)
+        {
+            unsigned index = y * w + x;
+            Point pixel(x + 0.5, h - 1 - y + 0.5, 0);
+            Ray ray(eye, (pixel - eye).normalized());
+            double t;
+            object[index] = scene.visibleObject(ray, t);
+            hit[index] = object[index] == none ? eye : ray.at(t);
+        }
+    });
+
+    vector<bool> trace(w * h, true);
+    Stats stats;
+    if (d_valid and d_width == w and d_height == h)
+    {
+        // Project the old hits onto the image plane z = 0, keeping the
+        // one nearest to the eye per pixel.
+        vector<double> nearest(w * h, numeric_limits<double>::infinity());
+        vector<unsigned> source(w * h, w * h);
+        for (unsigned index = 0; index != w * h; ++index)
+        {
+            unsigned obj = d_object[index];
+            Point const &point = d_hit[index];
+            if (obj >= reusable.size() or not reusable[obj]
+                or point.z >= eye.z)
+                continue;
+
+            double scale = eye.z / (eye.z - point.z);
+            double px = eye.x + (point.x - eye.x) * scale;
+            double py = eye.y + (point.y - eye.y) * scale;
+            if (px < 0.0 or py < 0.0 or px >= w or py >= h)
+                continue;
+
+            unsigned target = (h - 1 - static_cast<unsigned>(py)) * w
+                              + static_cast<unsigned>(px);
+            double dist = (point - eye).length();
+            if (dist < nearest[target])
+            {
+                nearest[target] = dist;
+                source[target] = index;
+            }
+        }
+
+        // Copying shifts the shading by up to half a pixel, so pixels on
+        // silhouettes and on shadow or texture edges are traced.
+        vector<bool> reuse(w * h, false);
+        for (unsigned y = 0; y != h; ++y)
+        {
+            for (unsigned x = 0; x != w; ++x)
+            {
+                unsigned index = y * w + x;
+                unsigned from = source[index];
+                if (from == w * h or d_object[from] != object[index]
+                    or silhouette(object, w, h, x, y)
+                    or edge(d_color, from % w, from / w))
+                    continue;
+
+                double dist = (hit[index] - eye).length();
+                reuse[index] = abs(nearest[index] - dist)
+                               <= DEPTH_TOLERANCE * dist;
+            }
+        }
+
+        // Decide per tile: copy the reusable pixels, or trace all of it.
+        unsigned tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+        unsigned tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+        for (unsigned tile = 0; tile != tilesX * tilesY; ++tile)
+        {
+            unsigned x0 = tile % tilesX * TILE_SIZE;
+            unsigned y0 = tile / tilesX * TILE_SIZE;
+            unsigned x1 = min(w, x0 + TILE_SIZE);
+            unsigned y1 = min(h, y0 + TILE_SIZE);
+
+            unsigned covered = 0;
+            unsigned reused = 0;
+            for (unsigned y = y0; y != y1; ++y)
+            {
+                for (unsigned x = x0; x != x1; ++x)
+                {
+                    covered += object[y * w + x] != none;
+                    reused += reuse[y * w + x];
+                }
+            }
+
+            if ((tile + d_frame) % REFRESH_PERIOD == 0
+                or reused < MIN_REUSE * covered)
+                continue;
+
+            for (unsigned y = y0; y != y1; ++y)
+            {
+                for (unsigned x = x0; x != x1; ++x)
+                {
+                    unsigned index = y * w + x;
+                    if (not reuse[index])
+                        continue;
+
+                    img(x, y) = d_color(source[index] % w, source[index] / w);
+                    trace[index] = false;
+                    ++stats.reused;
+                }
+            }
+        }
+    }
+
+    stats.traced = w * h - stats.reused;
+    scene.render(img, pool, trace);
+
+    d_width = w;
+    d_height = h;
+    d_color = img;
+    d_hit.swap(hit);
+    d_object.swap(object);
+    d_valid = true;
+    ++d_frame;
+    return stats;
+}
+
+void Reprojector::reset()
+{
+    d_valid = false;
+}
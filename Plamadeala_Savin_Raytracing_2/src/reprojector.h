@@ -0,0 +1,51 @@
+#ifndef REPROJECTOR_H_
+#define REPROJECTOR_H_
+
+#include "image.h"
+#include "triple.h"
+
+#include <vector>
+
+class Scene;
+class ThreadPool;
+
+// Reuses the previous frame of an animation where it is still valid.
+//
+// For every pixel the first hit along the ray through its center is kept.
+// The hits of the previous frame are projected into the current camera
+// (nearest hit wins), and a pixel copies its old color when the current
+// center ray sees the same object at the same distance and the object is
+// reusable: it did not move and its shading does not depend on the view.
+// All other pixels (disocclusions, moved or specular objects, background)
+// are traced again. A 16x16 tile in which less than half of the pixels
+// showing an object can be reused is traced completely, and every frame
+// one in eight tiles is traced regardless, so reused colors never drift
+// for long.
+class Reprojector
+{
+    unsigned d_width = 0;
+    unsigned d_height = 0;
+    Image d_color;                      // the previous frame
+    std::vector<Point> d_hit;           // its first hit per pixel
+    std::vector<unsigned> d_object;     // the object hit, or the object count
+    unsigned d_frame = 0;               // frames rendered, for the refresh
+    bool d_valid = false;
+
+    public:
+        struct Stats
+        {
+            unsigned reused = 0;        // pixels copied from the last frame
+            unsigned traced = 0;
+        };
+
+        // Render the current pose of scene into img. reusable[i] tells
+        // whether object i may be taken from the previous frame; pass all
+        // false when the lighting changed.
+        Stats render(Scene &scene, Image &img, ThreadPool &pool,
+                     std::vector<bool> const &reusable);
+
+        // forget the previous frame
+        void reset();
+};
+
+#endif
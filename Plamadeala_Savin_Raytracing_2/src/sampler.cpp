@@ -0,0 +1,163 @@
+#include "sampler.h"
+
+#include <cmath>
+
+using namespace std;
+
+namespace
+{
+    // SplitMix64 finaliser: a cheap hash where every input bit affects
+    // every output bit.
+    uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    double toUnit(uint64_t bits)           // top 53 bits -> [0, 1)
+    {
+        return (bits >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double toUnit(uint32_t bits)           // [0, 1)
+    {
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    double fraction(double value)
+    {
+        return value - floor(value);
+    }
+
+    // First two dimensions of the Sobol sequence: the van der Corput
+    // sequence in base 2 (the bit reversed index) and the dimension using
+    // the primitive polynomial x + 1.
+    uint32_t sobol0(uint32_t index)
+    {
+        index = (index << 16) | (index >> 16);
+        index = ((index & 0x00ff00ff) << 8) | ((index & 0xff00ff00) >> 8);
+        index = ((index & 0x0f0f0f0f) << 4) | ((index & 0xf0f0f0f0) >> 4);
+        index = ((index & 0x33333333) << 2) | ((index & 0xcccccccc) >> 2);
+        index = ((index & 0x55555555) << 1) | ((index & 0xaaaaaaaa) >> 1);
+        return index;
+    }
+
+    uint32_t sobol1(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    // Roberts' R2 sequence, based on the plastic number.
+    double const R2_A1 = 0.7548776662466927;    // 1 / g
+    double const R2_A2 = 0.5698402909980532;    // 1 / g^2
+
+    // Dither masks with a blue noise like spectrum: the R2 sequence over the
+    // pixel grid, and Jimenez' interleaved gradient noise.
+    double blueNoise0(unsigned x, unsigned y)
+    {
+        return fraction(R2_A1 * x + R2_A2 * y);
+    }
+
+    double blueNoise1(unsigned x, unsigned y)
+    {
+        return fraction(52.9829189 * fraction(0.06711056 * x + 0.00583715 * y));
+    }
+}
+
+// --- Rng ---------------------------------------------------------------------
+
+Rng::Rng(uint32_t pixel, uint32_t sample, uint32_t dimension)
+:
+    d_pixel(pixel),
+    d_sample(sample),
+    d_dimension(dimension)
+{}
+
+double Rng::next()
+{
+    return at(d_pixel, d_sample, d_dimension++);
+}
+
+double Rng::at(uint32_t pixel, uint32_t sample, uint32_t dimension)
+{
+    return toUnit(bits(pixel, sample, dimension));
+}
+
+uint64_t Rng::bits(uint32_t pixel, uint32_t sample, uint32_t dimension)
+{
+    uint64_t key = (static_cast<uint64_t>(pixel) << 32) | sample;
+    return mix(key ^ mix(dimension + 0x9e3779b97f4a7c15ull));
+}
+
+// --- Sampler -----------------------------------------------------------------
+
+Sampler::Sampler(Pattern pattern, unsigned factor)
+:
+    d_pattern(pattern),
+    d_factor(factor),
+    d_gridStep(1 / ((double) factor + 1))
+{}
+
+unsigned Sampler::count() const
+{
+    return d_factor * d_factor;
+}
+
+void Sampler::offset(unsigned x, unsigned y, uint32_t pixel, unsigned sample,
+                     double &dx, double &dy) const
+{
+    switch (d_pattern)
+    {
+        case Pattern::Grid:
+            dx = d_gridStep * (sample % d_factor + 1);
+            dy = d_gridStep * (sample / d_factor + 1);
+            break;
+
+        case Pattern::Random:
+            dx = Rng::at(pixel, sample, 0);
+            dy = Rng::at(pixel, sample, 1);
+            break;
+
+        case Pattern::R2:       // the shift is shared by all samples of a pixel
+            dx = fraction(0.5 + R2_A1 * sample + Rng::at(pixel, 0, 0));
+            dy = fraction(0.5 + R2_A2 * sample + Rng::at(pixel, 0, 1));
+            break;
+
+        case Pattern::Sobol:    // xor scrambling keeps the stratification
+        {
+            uint64_t scramble = Rng::bits(pixel, 0, 0);
+            dx = toUnit(sobol0(sample) ^ static_cast<uint32_t>(scramble));
+            dy = toUnit(sobol1(sample) ^ static_cast<uint32_t>(scramble >> 32));
+            break;
+        }
+
+        case Pattern::BlueNoise:
+            dx = fraction(toUnit(sobol0(sample)) + blueNoise0(x, y));
+            dy = fraction(toUnit(sobol1(sample)) + blueNoise1(x, y));
+            break;
+    }
+}
+
+bool Sampler::parse(string const &name, Pattern &pattern)
+{
+    if (name == "grid")
+        pattern = Pattern::Grid;
+    else if (name == "random")
+        pattern = Pattern::Random;
+    else if (name == "r2")
+        pattern = Pattern::R2;
+    else if (name == "sobol")
+        pattern = Pattern::Sobol;
+    else if (name == "bluenoise")
+        pattern = Pattern::BlueNoise;
+    else
+        return false;
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <cstdint>
+#include <string>
+
+// Counter based random numbers. Every value is a hash of the pixel, the
+// sample within that pixel and the dimension (the how-manieth number drawn
+// for that sample), so an image never depends on which thread traced what
+// or in which order.
+class Rng
+{
+    uint32_t d_pixel;
+    uint32_t d_sample;
+    uint32_t d_dimension;
+
+    public:
+        Rng(uint32_t pixel, uint32_t sample, uint32_t dimension = 0);
+
+        // uniform in [0, 1), advances to the next dimension
+        double next();
+
+        static double at(uint32_t pixel, uint32_t sample, uint32_t dimension);
+        static uint64_t bits(uint32_t pixel, uint32_t sample, uint32_t dimension);
+};
+
+// Where the supersamples of a pixel are placed.
+//     Grid:      regular factor x factor grid (the classic behaviour)
+//     Random:    independent uniform jitter
+//     R2:        Roberts' R2 sequence, randomly shifted per pixel
+//     Sobol:     (0, 2)-sequence, randomly scrambled per pixel
+//     BlueNoise: Sobol, shifted by a blue noise dither mask over the image
+//                so the error of neighbouring pixels does not correlate
+class Sampler
+{
+    public:
+        enum class Pattern
+        {
+            Grid,
+            Random,
+            R2,
+            Sobol,
+            BlueNoise
+        };
+
+    private:
+    Pattern d_pattern;
+    unsigned d_factor;
+    double d_gridStep;
+
+    public:
+        // factor * factor samples per pixel
+        Sampler(Pattern pattern, unsigned factor);
+
+        unsigned count() const;
+
+        // offset of sample inside pixel (x, y), both coordinates in [0, 1)
+        void offset(unsigned x, unsigned y, uint32_t pixel, unsigned sample,
+                    double &dx, double &dy) const;
+
+        // "grid", "random", "r2", "sobol" or "bluenoise"
+        static bool parse(std::string const &name, Pattern &pattern);
+};
+
+#endif
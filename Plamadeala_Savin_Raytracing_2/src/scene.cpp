@@ -1,41 +1,228 @@
 #include "scene.h"
 
+#include "denoiser.h"
 #include "hit.h"
 #include "image.h"
 #include "material.h"
 #include "ray.h"
+#include "threadpool.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <iostream>
 #include <limits>
 
 using namespace std;
 
-pair<ObjectPtr, Hit> Scene::castRay(Ray const &ray) const {
-    // Find hit object and distance
-    Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != objects.size(); ++idx) {
-        Hit hit(objects[idx]->intersect(ray));
-        if (hit.t < min_hit.t) {
-            min_hit = hit;
-            obj = objects[idx];
+namespace {
+    // Reflected and refracted ray at a transparent surface, and the fraction
+    // of the light that is reflected (Schlick's approximation).
+    struct Transmission {
+        Ray reflected;
+        Ray refracted;
+        double kr;
+    };
+
+    Transmission transmit(Ray const &ray, Point const &hit, Vector N,
+                          Vector shadingN, double nt, double epsilon) {
+        Vector reflectDir = reflect(ray.D, shadingN);
+        Ray reflectRay(hit + (epsilon * shadingN), reflectDir);
+
+        double DdotN = ray.D.dot(N);
+        double ni = 1.0;
+        int outside = 0;
+
+        if (DdotN < 0) {
+            DdotN = -DdotN;
+            outside = 1;
+        } else {
+            shadingN = -shadingN;
+            N = -N;
+            std::swap(nt, ni);
         }
+
+        double refRatio = ni / nt;
+        double k = 1 - refRatio * refRatio * (1 - DdotN * DdotN);
+
+        Vector refractDir;
+        if (k < 0) {
+            refractDir = Vector(0);
+        } else {
+            refractDir = refRatio * ray.D + (refRatio * DdotN - sqrt(k)) * N;
+        }
+        refractDir.normalize();
+
+        Vector refractRayFrom;
+        if (outside == 1) {
+            refractRayFrom = hit - (epsilon * shadingN);
+        } else {
+            refractRayFrom = hit + (epsilon * shadingN);
+        }
+
+        //Schlick's approximation to determine the ratio between the two.
+        double kr0 = ((ni - nt) / (ni + nt)) * ((ni - nt) / (ni + nt));
+        double kr = kr0 + (1.0 - kr0) * pow(1.0 - DdotN, 5);
+
+        return Transmission{reflectRay, Ray(refractRayFrom, refractDir), kr};
+    }
+
+    // Direction around N with a density proportional to the cosine with N.
+    Vector cosineSample(Vector const &N, double u1, double u2) {
+        // Any vector not parallel to N gives an orthonormal basis.
+        Vector helper = std::abs(N.x) > 0.5 ? Vector(0, 1, 0) : Vector(1, 0, 0);
+        Vector T = N.cross(helper).normalized();
+        Vector B = N.cross(T);
+
+        double r = sqrt(u1);
+        double phi = 2 * M_PI * u2;
+        return (T * (r * cos(phi)) + B * (r * sin(phi)) +
+                N * sqrt(std::max(0.0, 1 - u1))).normalized();
+    }
+
+    double maxComponent(Color const &color) {
+        return std::max(color.r, std::max(color.g, color.b));
+    }
+
+    double luminance(Color const &color) {
+        return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
     }
 
-    return pair<ObjectPtr, Hit>(obj, min_hit);
+    // Square block of pixels that gets samples as a unit in renderWithin.
+    struct Tile {
+        unsigned x0;
+        unsigned y0;
+        unsigned x1;            // exclusive
+        unsigned y1;
+        unsigned samples;       // per pixel so far
+        double error;           // mean variance of the pixel estimates
+
+        unsigned pixels() const {
+            return (x1 - x0) * (y1 - y0);
+        }
+    };
+
+    unsigned const TILE_SIZE = 16;
+
+    // With Acceleration::Auto, scenes of at most LINEAR_OBJECTS bounded
+    // objects test them all, and a grid is only considered from
+    // GRID_OBJECTS on; below that it traces slower than a BVH and its
+    // faster build does not make up for it.
+    unsigned const LINEAR_OBJECTS = 6;
+    unsigned const GRID_OBJECTS = 1000;
+}
+
+unsigned Scene::closestObject(Ray const &ray, double &t, unsigned &primitive) const {
+    // Find hit object and distance. The objects vector owns the objects,
+    // only the index of the closest one is handed out. On equal distances
+    // the first object wins, whatever order they are visited in.
+    t = numeric_limits<double>::infinity();
+    unsigned closest = objects.size();
+    auto test = [&](unsigned idx, double &tmax) {
+        unsigned part = 0;
+        double dist = objects[idx]->distance(ray, part);
+        if (dist < tmax or (dist == tmax and idx < closest)) {
+            tmax = dist;
+            primitive = part;
+            closest = idx;
+        }
+    };
+
+    if (activeAcceleration == Acceleration::Linear) {
+        for (unsigned idx = 0; idx != objects.size(); ++idx)
+            test(idx, t);
+        return closest;
+    }
+
+    for (unsigned idx : unbounded)
+        test(idx, t);
+
+    if (activeAcceleration == Acceleration::Grid)
+        grid.traverse(ray, t, test);
+    else if (bvhWidth == 4 and bvhQuantized)
+        bvh4q.traverse(ray, t, test);
+    else if (bvhWidth == 4)
+        bvh4.traverse(ray, t, test);
+    else if (bvhWidth == 8 and bvhQuantized)
+        bvh8q.traverse(ray, t, test);
+    else if (bvhWidth == 8)
+        bvh8.traverse(ray, t, test);
+    else
+        bvh.traverse(ray, t, test);
+
+    return closest;
+}
+
+pair<Object *, Hit> Scene::castRay(Ray const &ray) const {
+    double t;
+    unsigned primitive = 0;
+    unsigned idx = closestObject(ray, t, primitive);
+    if (idx == objects.size())
+        return pair<Object *, Hit>(nullptr, Hit(t, Vector()));
+
+    // The normal is only computed for the winning hit.
+    Object *obj = objects[idx].get();
+    return pair<Object *, Hit>(obj, Hit(t, obj->normal(ray, t, primitive)));
 }
 
-Color Scene::trace(Ray const &ray, unsigned depth) {
-    pair<ObjectPtr, Hit> mainhit = castRay(ray);
-    ObjectPtr obj = mainhit.first;
-    Hit min_hit = mainhit.second;
+Color Scene::trace(Ray const &ray, unsigned depth, bool shadows,
+                   Features *first) const {
+    double t;
+    unsigned primitive = 0;
+    unsigned idx = closestObject(ray, t, primitive);
 
     // No hit? Return background color.
-    if (!obj)
+    if (idx == objects.size())
         return Color(0.0, 0.0, 0.0);
 
-    Material const &material = obj->material;
+    Object &obj = *objects[idx];
+    Hit min_hit(t, obj.normal(ray, t, primitive));
+    if (first)
+        *first = features(ray, obj, t, min_hit.N);
+    return (this->*kernels[idx][2 * shadows + (depth > 0)])(ray, obj, min_hit,
+                                                           depth, shadows);
+}
+
+bool Scene::occluded(Point const &hit, Vector const &shadingN, Vector const &L,
+                     Light const &light) const {
+    Ray shadow(hit + (epsilon * shadingN), L);
+    double t;
+    unsigned primitive;
+    closestObject(shadow, t, primitive);
+    return t < (light.position - hit).length();
+}
+
+void Scene::addPhong(Color &color, Light const &light, Vector const &L,
+                     Vector const &shadingN, Vector const &V,
+                     Material const &material, Color const &matColor,
+                     double diffuseScale) const {
+    // Add diffuse.
+    double dotNormal = shadingN.dot(L);
+    double diffuse = diffuseScale * std::max(dotNormal, 0.0);
+    color += diffuse * material.kd * light.color * matColor;
+
+    // Add specular.
+    if (dotNormal > 0) {
+        Vector reflectDir = reflect(-L, shadingN); // Note: reflect(..) is not given in the framework.
+        double specAngle = std::max(reflectDir.dot(V), 0.0);
+        double specular = std::pow(specAngle, material.n);
+
+        color += specular * material.ks * light.color;
+    }
+}
+
+template <bool Shadows, bool Textured, bool Transparent, bool Reflective,
+          bool Recurse, bool Generic>
+Color Scene::shade(Ray const &ray, Object &obj, Hit const &min_hit, unsigned depth,
+                   bool renderShadows) const {
+    Material const &material = obj.material;
+
+    // Constants unless Generic, so the tests below fold away.
+    bool const shadows = Generic ? renderShadows : Shadows;
+    bool const textured = Generic ? material.hasTexture : Textured;
+    bool const transparent = Generic ? material.isTransparent : Transparent;
+    bool const reflective = Generic ? material.ks > 0.0 : Reflective;
+    bool const recurse = Generic ? depth > 0 : Recurse;
     Point hit = ray.at(min_hit.t);
     Vector V = -ray.D;
 
@@ -52,9 +239,9 @@ Color Scene::trace(Ray const &ray, unsigned depth) {
 
     Color matColor = material.color;
 
-    if (material.hasTexture) {
-        Point p = obj->toUV(hit);
-        matColor = material.texture.colorAt(p.x, 1 - p.y);
+    if (textured) {
+        Point p = obj.toUV(hit);
+        matColor = material.texture->colorAt(p.x, 1 - p.y);
     }
 
     // Add ambient once, regardless of the number of lights.
@@ -65,103 +252,584 @@ Color Scene::trace(Ray const &ray, unsigned depth) {
         Vector L = (light->position - hit).normalized();
 
         //Render shadows
-        if (renderShadows) {
-            Ray shadow(hit + (epsilon * shadingN), L);
-            pair<ObjectPtr, Hit> s_hit = castRay(shadow);
-            if (s_hit.second.t < (light->position - hit).length()) {
-                continue;
-            }
-        }
-
-        // Add diffuse.
-        double dotNormal = shadingN.dot(L);
-        double diffuse = std::max(dotNormal, 0.0);
-        color += diffuse * material.kd * light->color * matColor;
+        if (shadows and occluded(hit, shadingN, L, *light))
+            continue;
 
-        // Add specular.
-        if (dotNormal > 0) {
-            Vector reflectDir = reflect(-L, shadingN); // Note: reflect(..) is not given in the framework.
-            double specAngle = std::max(reflectDir.dot(V), 0.0);
-            double specular = std::pow(specAngle, material.n);
-
-            color += specular * material.ks * light->color;
-        }
+        addPhong(color, *light, L, shadingN, V, material, matColor);
     }
 
-    if (depth > 0 and material.isTransparent) {
+    if (recurse and transparent) {
         // The object is transparent, and thus refracts and reflects light.
+        Transmission split = transmit(ray, hit, N, shadingN, material.nt, epsilon);
+        color += trace(split.reflected, depth - 1, shadows) * split.kr +
+            trace(split.refracted, depth - 1, shadows) * (1.0 - split.kr);
+    } else if (recurse and reflective) {
+        // The object is not transparent, but opaque.
         Vector reflectDir = reflect(ray.D, shadingN);
         Ray reflectRay(hit + (epsilon * shadingN), reflectDir);
+        color += material.ks * trace(reflectRay, depth - 1, shadows);
+    }
 
-        double DdotN = ray.D.dot(N);
-        double ni = 1.0;
-        double nt = material.nt;
-        int outside = 0;
+    return color;
+}
 
-        if (DdotN < 0) {
-            DdotN = -DdotN;
-            outside = 1;
+// Iterative form of the Whitted recursion where every bounce picks a single
+// continuation at random: reflection or refraction by the Fresnel ratio at
+// transparent surfaces, a diffuse bounce or the mirror direction otherwise.
+// Direct light comes from next-event estimation towards one light chosen
+// uniformly, long paths are cut short by Russian roulette.
+Color Scene::tracePath(Ray ray, Rng &rng, bool shadows,
+                       Features *first) const {
+    Color radiance(0.0, 0.0, 0.0);
+    Color throughput(1.0, 1.0, 1.0);
+
+    for (unsigned bounce = 0; bounce != maxPathLength; ++bounce) {
+        double t;
+        unsigned primitive = 0;
+        unsigned idx = closestObject(ray, t, primitive);
+        if (idx == objects.size())
+            break;
+
+        Object &obj = *objects[idx];
+        Material const &material = obj.material;
+        Point hit = ray.at(t);
+        Vector V = -ray.D;
+        Vector N = obj.normal(ray, t, primitive);
+        Vector shadingN = N.dot(V) >= 0.0 ? N : -N;
+
+        Color matColor = material.color;
+        if (material.hasTexture) {
+            Point p = obj.toUV(hit);
+            matColor = material.texture->colorAt(p.x, 1 - p.y);
+        }
+        if (first and bounce == 0)
+            *first = Features{matColor, shadingN, t};
+
+        Color local = material.ka * matColor;
+
+        // Next-event estimation: with the light picked with probability
+        // 1 / lights.size(), the direct light is estimated by
+        //   lights.size() * (kd * matColor / pi * max(0, N.L) + specular) * I
+        // where kd * matColor / pi is the Lambertian BRDF. The diffuse
+        // bounce below samples the same BRDF with pdf max(0, N.L) / pi, so
+        // its throughput weight BRDF * N.L / pdf is kd * matColor.
+        if (not lights.empty()) {
+            unsigned pick = std::min<unsigned>(rng.next() * lights.size(),
+                                               lights.size() - 1);
+            Light const &light = *lights[pick];
+            Vector L = (light.position - hit).normalized();
+
+            if (not (shadows and occluded(hit, shadingN, L, light))) {
+                Color direct(0.0, 0.0, 0.0);
+                addPhong(direct, light, L, shadingN, V, material, matColor,
+                         M_1_PI);
+                local += direct * lights.size();
+            }
+        }
+        radiance += throughput * local;
+
+        if (material.isTransparent) {
+            Transmission split = transmit(ray, hit, N, shadingN, material.nt, epsilon);
+            ray = rng.next() < split.kr ? split.reflected : split.refracted;
         } else {
-            shadingN = -shadingN;
-            N = -N;
-            std::swap(nt, ni);
+            // Pick a lobe in proportion to how much light it carries on.
+            double diffuseWeight = material.kd * maxComponent(matColor);
+            double mirrorWeight = material.ks;
+            double total = diffuseWeight + mirrorWeight;
+            if (total <= 0.0)
+                break;
+
+            if (rng.next() * total < diffuseWeight) {
+                double u1 = rng.next();
+                double u2 = rng.next();
+                ray = Ray(hit + (epsilon * shadingN), cosineSample(shadingN, u1, u2));
+                throughput = throughput * (material.kd * matColor) * (total / diffuseWeight);
+            } else {
+                ray = Ray(hit + (epsilon * shadingN), reflect(ray.D, shadingN));
+                throughput *= material.ks * (total / mirrorWeight);
+            }
         }
 
-        double refRatio = ni / nt;
-        double k = 1 - refRatio * refRatio * (1 - DdotN * DdotN);
+        if (bounce >= 2) {
+            double survive = std::min(0.95, maxComponent(throughput));
+            if (rng.next() >= survive)
+                break;
+            throughput /= survive;
+        }
+    }
 
-        Vector refractDir;
-        if (k < 0) {
-            refractDir = Vector(0);
-        } else {
-            refractDir = refRatio * ray.D + (refRatio * DdotN - sqrt(k)) * N;
+    return radiance;
+}
+
+void Scene::prepare(ThreadPool &pool) {
+    if (accelerationStale) {
+        vector<Box> bounds;
+        vector<unsigned> bounded;
+        unbounded.clear();
+        for (unsigned idx = 0; idx != objects.size(); ++idx) {
+            Box box = objects[idx]->bounds();
+            if (box.bounded() and not box.empty()) {
+                bounds.push_back(box);
+                bounded.push_back(idx);
+            } else {
+                unbounded.push_back(idx);
+            }
         }
-        refractDir.normalize();
 
-        Vector refractRayFrom;
-        if (outside == 1) {
-            refractRayFrom = hit - (epsilon * shadingN);
+        accelerationStale = false;
+        activeAcceleration = acceleration;
+        if (acceleration == Acceleration::Auto) {
+            activeAcceleration = chooseAcceleration(bounds);
+            cout << "Acceleration: " << name(activeAcceleration)
+                 << " (auto) for " << bounds.size() << " bounded objects\n";
+        }
+
+        if (activeAcceleration == Acceleration::Linear) {
+            // no structure to keep up to date
+            bvh = Bvh();
+            grid = Grid();
+        } else if (activeAcceleration == Acceleration::Grid) {
+            bvh = Bvh();
+            Grid::Stats const &stats = grid.build(bounds, bounded);
+            cout << "Built grid over " << bounds.size() << " objects in "
+                 << stats.buildMs << " ms: " << stats.cells[0] << 'x'
+                 << stats.cells[1] << 'x' << stats.cells[2] << " cells, "
+                 << stats.references << " references\n";
         } else {
-            refractRayFrom = hit + (epsilon * shadingN);
+            grid = Grid();
+            Bvh::Stats const &stats = bvh.build(bounds, bvhMethod, pool);
+            bvh.remap(bounded);
+            cout << "Built " << Bvh::name(bvhMethod) << " BVH over "
+                 << bounds.size() << " objects in " << stats.buildMs << " ms: "
+                 << stats.nodes << " nodes, depth " << stats.depth
+                 << ", SAH cost " << stats.sahCost;
+
+            unsigned wideNodes = 0;
+            unsigned nodeBytes = 0;
+            if (bvhWidth == 4 and bvhQuantized) {
+                bvh4q.build(bvh);
+                wideNodes = bvh4q.nodeCount();
+                nodeBytes = bvh4q.nodeBytes();
+            } else if (bvhWidth == 4) {
+                bvh4.build(bvh);
+                wideNodes = bvh4.nodeCount();
+                nodeBytes = bvh4.nodeBytes();
+            } else if (bvhWidth == 8 and bvhQuantized) {
+                bvh8q.build(bvh);
+                wideNodes = bvh8q.nodeCount();
+                nodeBytes = bvh8q.nodeBytes();
+            } else if (bvhWidth == 8) {
+                bvh8.build(bvh);
+                wideNodes = bvh8.nodeCount();
+                nodeBytes = bvh8.nodeBytes();
+            }
+            if (wideNodes != 0)
+                cout << "; " << bvhWidth << "-wide" << (bvhQuantized ? " quantized" : "")
+                     << ": " << wideNodes << " nodes of " << nodeBytes << " bytes";
+            cout << '\n';
+            bvh.clearChanges();
         }
+    } else if (bvh.changed()) {
+        auto start = chrono::steady_clock::now();
+        unsigned rebuilt = bvh.rebuildDegraded(pool);
+        if (bvhWidth == 4 and bvhQuantized)
+            bvh4q.update(bvh);
+        else if (bvhWidth == 4)
+            bvh4.update(bvh);
+        else if (bvhWidth == 8 and bvhQuantized)
+            bvh8q.update(bvh);
+        else if (bvhWidth == 8)
+            bvh8.update(bvh);
+        bvh.clearChanges();
+
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        cout << "Updated BVH in " << elapsed.count() << " ms";
+        if (rebuilt != 0)
+            cout << ", rebuilt " << rebuilt << " degraded subtrees";
+        cout << '\n';
+    }
 
-        //Schlick's approximation to determine the ratio between the two.
-        double kr0 = ((ni - nt) / (ni + nt)) * ((ni - nt) / (ni + nt));
-        double kr = kr0 + (1.0 - kr0) * pow(1.0 - DdotN, 5);
+    // Settings may have changed since the objects were added.
+    if (kernelsStale) {
+        selectKernels();
+        kernelsStale = false;
+    }
+}
 
-        Ray refractRay(refractRayFrom, refractDir);
+unsigned Scene::visibleObject(Ray const &ray, double &t) const {
+    unsigned primitive = 0;
+    return closestObject(ray, t, primitive);
+}
 
-        color += trace(reflectRay, depth - 1) * kr +
-            trace(refractRay, depth - 1) * (1.0 - kr);
-    } else if (depth > 0 and material.ks > 0.0) {
-        // The object is not transparent, but opaque.
-        Vector reflectDir = reflect(ray.D, shadingN);
-        Ray reflectRay(hit + (epsilon * shadingN), reflectDir);
-        color += material.ks * trace(reflectRay, depth - 1);
+Scene::Features Scene::features(Ray const &ray, Object &obj, double t,
+                                Vector const &N) const {
+    Material const &material = obj.material;
+    Features features{material.color, N, t};
+    if (N.dot(ray.D) > 0.0)
+        features.normal = -N;
+
+    if (material.hasTexture) {
+        Point p = obj.toUV(ray.at(t));
+        features.albedo = material.texture->colorAt(p.x, 1 - p.y);
     }
+    return features;
+}
 
-    return color;
+// Turns runtime feature flags into a pointer to the matching instantiation
+// of Scene::shade, fixing one flag per step.
+template <unsigned Remaining, bool ...Flags>
+struct KernelTable {
+    static Scene::ShadeKernel select(bool const *flags) {
+        return *flags ?
+            KernelTable<Remaining - 1, Flags..., true>::select(flags + 1) :
+            KernelTable<Remaining - 1, Flags..., false>::select(flags + 1);
+    }
+};
+
+template <bool ...Flags>
+struct KernelTable<0, Flags...> {
+    static Scene::ShadeKernel select(bool const *) {
+        return &Scene::shade<Flags...>;
+    }
+};
+
+void Scene::selectKernels() {
+    kernels.resize(objects.size());
+    for (unsigned idx = 0; idx != objects.size(); ++idx)
+        kernels[idx] = kernelsFor(objects[idx]->material);
 }
 
-void Scene::render(Image &img) {
+array<Scene::ShadeKernel, 4> Scene::kernelsFor(Material const &material) const {
+    if (not specialisedShading) {
+        ShadeKernel generic = &Scene::shade<true, true, true, true, true, true>;
+        return {{generic, generic, generic, generic}};
+    }
+
+    array<ShadeKernel, 4> selected;
+    for (bool shadows : {false, true}) {
+        for (bool recurse : {false, true}) {
+            bool const flags[] = {
+                shadows,
+                material.hasTexture,
+                material.isTransparent,
+                material.ks > 0.0,
+                recurse
+            };
+            selected[2 * shadows + recurse] = KernelTable<5>::select(flags);
+        }
+    }
+    return selected;
+}
+
+bool Scene::bounded(unsigned idx) const {
+    return find(unbounded.begin(), unbounded.end(), idx) == unbounded.end();
+}
+
+Scene::Acceleration Scene::chooseAcceleration(vector<Box> const &bounds) {
+    if (bounds.size() <= LINEAR_OBJECTS)
+        return Acceleration::Linear;
+    if (bounds.size() >= GRID_OBJECTS and Grid::suits(bounds))
+        return Acceleration::Grid;
+    return Acceleration::Bvh;
+}
+
+bool Scene::updatesInPlace() {
+    // Only the BVH is updated; the grid is cheap to build again, and the
+    // linear loop has nothing to update.
+    if (activeAcceleration != Acceleration::Bvh)
+        accelerationStale = true;
+    return not accelerationStale;
+}
+
+Ray Scene::primaryRay(Sampler const &sampler, unsigned x, unsigned y,
+                      unsigned h, unsigned index, unsigned sample) const {
+    double dx;
+    double dy;
+    sampler.offset(x, y, index, sample, dx, dy);
+
+    Point pixel(x + dx, h - 1 - y + dy, 0);
+    return Ray(eye, (pixel - eye).normalized());
+}
+
+Color Scene::radiance(Ray const &ray, unsigned index, unsigned sample,
+                      Settings const &settings, Features *first) const {
+    if (integrator == Integrator::Path) {
+        // dimensions 0 and 1 went to the pixel offset
+        Rng rng(index, sample, 2);
+        return tracePath(ray, rng, settings.renderShadows, first);
+    }
+    return trace(ray, settings.recursionDepth, settings.renderShadows, first);
+}
+
+void Scene::render(Image &img, ThreadPool &pool, AuxBuffers *aux) {
+    prepare(pool);
+    render(img, pool, settings, aux);
+}
+
+void Scene::render(Image &img, ThreadPool &pool,
+                   vector<Region> const &regions, AuxBuffers *aux) {
+    prepare(pool);
+    render(img, pool, settings, regions, aux);
+}
+
+void Scene::render(Image &img, ThreadPool &pool, vector<bool> const &mask,
+                   AuxBuffers *aux) {
+    prepare(pool);
+    render(img, pool, settings, mask, aux);
+}
+
+double Scene::renderWithin(Image &img, ThreadPool &pool, double seconds,
+                           function<void(Image const &)> const &update) {
+    prepare(pool);
+    return renderWithin(img, pool, settings, seconds, update);
+}
+
+void Scene::render(Image &img, ThreadPool &pool, Settings const &settings,
+                   AuxBuffers *aux) const {
+    render(img, pool, settings, {Region(0, 0, img.width(), img.height())}, aux);
+}
+
+void Scene::render(Image &img, ThreadPool &pool, Settings const &settings,
+                   vector<Region> const &regions, AuxBuffers *aux) const {
+    unsigned w = img.width();
+    unsigned h = img.height();
+
+    // Overlapping regions are traced once.
+    vector<bool> mask(w * h, false);
+    for (Region const &region : regions) {
+        Region clipped = region.clipped(w, h);
+        for (unsigned y = clipped.y0; y < clipped.y1; ++y)
+            fill(mask.begin() + y * w + clipped.x0,
+                 mask.begin() + y * w + clipped.x1, true);
+    }
+    render(img, pool, settings, mask, aux);
+}
+
+void Scene::render(Image &img, ThreadPool &pool, Settings const &settings,
+                   vector<bool> const &mask, AuxBuffers *aux) const {
     unsigned w = img.width();
     unsigned h = img.height();
-    double add = 1 / ((double) supersamplingFactor + 1);
+    Sampler sampler(samplePattern, settings.supersamplingFactor);
+    unsigned samples = sampler.count();
 
-    for (unsigned y = 0; y < h; ++y)
+    // Rows are independent, so hand them out to the pool one at a time.
+    pool.parallelFor(h, [&](unsigned y) {
         for (unsigned x = 0; x < w; ++x) {
+            unsigned index = y * w + x;
+            if (not mask[index])
+                continue;
+
             Color col = Color(0, 0, 0);
-            for (unsigned i = 0; i < supersamplingFactor; ++i) {
-                for (unsigned j = 0; j < supersamplingFactor; ++j) {
-                    Point pixel(x + add * (j + 1), h - 1 - y + add * (i + 1), 0);
-                    Ray ray(eye, (pixel - eye).normalized());
-                    col += trace(ray, recursionDepth);
+            for (unsigned sample = 0; sample != samples; ++sample) {
+                Ray ray = primaryRay(sampler, x, y, h, index, sample);
+                Features first;
+                col += radiance(ray, index, sample, settings,
+                                aux ? &first : nullptr);
+
+                if (aux) {
+                    double depth = first.depth;
+                    aux->albedo(x, y) += first.albedo / samples;
+                    aux->normal(x, y) += first.normal / samples;
+                    aux->depth(x, y) += Color(depth, depth, depth) / samples;
                 }
             }
-            col = col / (supersamplingFactor * supersamplingFactor);
+            col = col / samples;
             col.clamp();
             img(x, y) = col;
         }
+    });
+}
+
+// First gives every pixel one sample, which also measures how fast this
+// scene traces. Then, while time is left, the tiles with the largest
+// estimated error (variance of the pixel means) double their sample count,
+// as many of them as fit in half of the remaining time. Tiles need two
+// samples before their error is known; tiles without any variance, like
+// empty background, are done.
+double Scene::renderWithin(Image &img, ThreadPool &pool,
+                           Settings const &settings, double seconds,
+                           function<void(Image const &)> const &update) const {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point const deadline = Clock::now() +
+        chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+
+    unsigned w = img.width();
+    unsigned h = img.height();
+
+    // The regular grid has a fixed number of samples, keep adding Sobol
+    // points instead.
+    Sampler sampler(samplePattern == Sampler::Pattern::Grid ?
+                    Sampler::Pattern::Sobol : samplePattern, 1);
+
+    vector<Tile> tiles;
+    for (unsigned y = 0; y < h; y += TILE_SIZE) {
+        for (unsigned x = 0; x < w; x += TILE_SIZE) {
+            tiles.push_back(Tile{x, y, std::min(x + TILE_SIZE, w),
+                                 std::min(y + TILE_SIZE, h), 0,
+                                 numeric_limits<double>::infinity()});
+        }
+    }
+
+    // running sums per pixel
+    vector<Color> sum(w * h);
+    vector<double> sumLum2(w * h, 0.0);
+
+    // add extra[i] samples to tile batch[i]
+    auto addSamples = [&](vector<unsigned> const &batch,
+                          vector<unsigned> const &extra) {
+        pool.parallelFor(batch.size(), [&](unsigned idx) {
+            Tile &tile = tiles[batch[idx]];
+            unsigned first = tile.samples;
+            unsigned count = first + extra[idx];
+            double error = 0.0;
+
+            for (unsigned y = tile.y0; y != tile.y1; ++y) {
+                for (unsigned x = tile.x0; x != tile.x1; ++x) {
+                    unsigned index = y * w + x;
+                    for (unsigned sample = first; sample != count; ++sample) {
+                        Ray ray = primaryRay(sampler, x, y, h, index, sample);
+                        Color col = radiance(ray, index, sample, settings,
+                                             nullptr);
+                        double lum = luminance(col);
+                        sum[index] += col;
+                        sumLum2[index] += lum * lum;
+                    }
+
+                    Color mean = sum[index] / count;
+                    double meanLum = luminance(mean);
+                    double variance = std::max(sumLum2[index] / count - meanLum * meanLum, 0.0);
+                    error += variance / count;
+
+                    mean.clamp();
+                    img(x, y) = mean;
+                }
+            }
+
+            tile.samples = count;
+            tile.error = count < 2 ? numeric_limits<double>::infinity()
+                                   : error / tile.pixels();
+        });
+    };
+
+    // First pass, one sample everywhere.
+    Clock::time_point start = Clock::now();
+    vector<unsigned> batch(tiles.size());
+    for (unsigned idx = 0; idx != tiles.size(); ++idx)
+        batch[idx] = idx;
+    addSamples(batch, vector<unsigned>(tiles.size(), 1));
+    update(img);
+
+    // lower bound against a zero duration on coarse clocks
+    double const minSecondsPerSample = 1e-9;
+
+    double traced = w * h;
+    double secondsPerSample = std::max(minSecondsPerSample,
+        chrono::duration<double>(Clock::now() - start).count() / traced);
+
+    vector<unsigned> order(tiles.size());
+    for (unsigned idx = 0; idx != tiles.size(); ++idx)
+        order[idx] = idx;
+
+    while (true) {
+        double remaining = chrono::duration<double>(deadline - Clock::now()).count();
+        double affordable = 0.5 * remaining / secondsPerSample;    // samples
+        if (affordable < 1.0)
+            break;
+
+        sort(order.begin(), order.end(), [&](unsigned lhs, unsigned rhs) {
+            return tiles[lhs].error > tiles[rhs].error;
+        });
+
+        batch.clear();
+        vector<unsigned> extra;
+        for (unsigned idx : order) {
+            Tile const &tile = tiles[idx];
+            if (tile.error <= 0.0)
+                break;                          // the rest has converged
+
+            unsigned wanted = tile.samples;     // doubles the sample count
+            unsigned fits = static_cast<unsigned>(affordable / tile.pixels());
+            if (fits == 0)
+                break;
+
+            batch.push_back(idx);
+            extra.push_back(std::min(wanted, fits));
+            affordable -= extra.back() * static_cast<double>(tile.pixels());
+        }
+
+        if (batch.empty())
+            break;
+
+        double samples = 0.0;
+        for (unsigned idx = 0; idx != batch.size(); ++idx)
+            samples += extra[idx] * static_cast<double>(tiles[batch[idx]].pixels());
+
+        start = Clock::now();
+        addSamples(batch, extra);
+        update(img);
+        traced += samples;
+
+        // the update is part of the cost of a round
+        secondsPerSample = std::max(minSecondsPerSample,
+            chrono::duration<double>(Clock::now() - start).count() / samples);
+    }
+
+    return traced / (w * h);
+}
+
+// --- Edits -------------------------------------------------------------------
+
+// Before the first prepare() there is nothing to update.
+
+bool Scene::moveObject(unsigned idx, Vector const &offset) {
+    if (not objects[idx]->translate(offset))
+        return false;
+    if (updatesInPlace() and bounded(idx))
+        bvh.move(idx, objects[idx]->bounds());
+    return true;
+}
+
+void Scene::replaceObject(unsigned idx, ObjectPtr obj) {
+    objects[idx] = obj;
+    if (not kernelsStale)
+        kernels[idx] = kernelsFor(obj->material);
+    if (not updatesInPlace())
+        return;
+
+    Box box = obj->bounds();
+    bool fits = box.bounded() and not box.empty();
+    bool wasBounded = bounded(idx);
+    if (fits and wasBounded) {
+        bvh.move(idx, box);
+    } else if (fits) {
+        unbounded.erase(find(unbounded.begin(), unbounded.end(), idx));
+        bvh.insert(idx, box);
+    } else if (wasBounded) {
+        bvh.remove(idx);
+        unbounded.push_back(idx);
+    }
+}
+
+void Scene::removeObject(unsigned idx) {
+    objects.erase(objects.begin() + idx);
+    if (not kernelsStale)
+        kernels.erase(kernels.begin() + idx);
+    if (not updatesInPlace())
+        return;
+
+    unbounded.erase(remove(unbounded.begin(), unbounded.end(), idx),
+                    unbounded.end());
+    for (unsigned &other : unbounded) {
+        if (other > idx)
+            --other;
+    }
+    bvh.erase(idx);
+}
+
+void Scene::setMaterial(unsigned idx, Material const &material) {
+    objects[idx]->material = material;
+    if (not kernelsStale)
+        kernels[idx] = kernelsFor(material);
 }
 
 // --- Misc functions ----------------------------------------------------------
@@ -169,19 +837,65 @@ void Scene::render(Image &img) {
 // Defaults
 Scene::Scene()
     :
+    arena(Arena::create()),
     objects(),
     lights(),
     eye(),
-    renderShadows(false),
-    recursionDepth(0),
-    supersamplingFactor(1) {}
+    settings{false, 0, 1},
+    samplePattern(Sampler::Pattern::Grid),
+    integrator(Integrator::Whitted),
+    maxPathLength(16),
+    acceleration(Acceleration::Auto),
+    activeAcceleration(Acceleration::Linear),
+    grid(),
+    bvh(),
+    bvhMethod(Bvh::Method::Sah),
+    bvhWidth(4),
+    bvhQuantized(false),
+    unbounded(),
+    accelerationStale(true),
+    kernels(),
+    kernelsStale(true),
+    specialisedShading(true) {}
 
 void Scene::addObject(ObjectPtr obj) {
     objects.push_back(obj);
+    unsigned idx = objects.size() - 1;
+    if (not kernelsStale)
+        kernels.push_back(kernelsFor(obj->material));
+    if (not updatesInPlace())
+        return;
+
+    Box box = obj->bounds();
+    if (box.bounded() and not box.empty())
+        bvh.insert(idx, box);
+    else
+        unbounded.push_back(idx);
+}
+
+void Scene::setAcceleration(Acceleration type) {
+    acceleration = type;
+    accelerationStale = true;
+}
+
+void Scene::setBvhMethod(Bvh::Method method) {
+    bvhMethod = method;
+    accelerationStale = true;
+}
+
+void Scene::setBvhWidth(unsigned width, bool quantized) {
+    bvhWidth = width;
+    bvhQuantized = quantized;
+    accelerationStale = true;
 }
 
 void Scene::addLight(Light const &light) {
-    lights.push_back(LightPtr(new Light(light)));
+    lights.push_back(make<Light>(light));
+}
+
+void Scene::setLightPosition(unsigned idx, Point const &position) {
+    // moved in place, as objects are, so animating takes no arena memory
+    lights[idx]->position = position;
 }
 
 void Scene::setEye(Triple const &position) {
@@ -196,14 +910,78 @@ unsigned Scene::getNumLights() {
     return lights.size();
 }
 
+Point const &Scene::getEye() const {
+    return eye;
+}
+
+bool Scene::getRenderShadows() const {
+    return settings.renderShadows;
+}
+
+Scene::Settings const &Scene::getSettings() const {
+    return settings;
+}
+
+Scene::Integrator Scene::getIntegrator() const {
+    return integrator;
+}
+
+Scene::Acceleration Scene::getAcceleration() const {
+    return activeAcceleration;
+}
+
+bool Scene::parse(string const &name, Acceleration &acceleration) {
+    if (name == "auto")
+        acceleration = Acceleration::Auto;
+    else if (name == "linear")
+        acceleration = Acceleration::Linear;
+    else if (name == "grid")
+        acceleration = Acceleration::Grid;
+    else if (name == "bvh")
+        acceleration = Acceleration::Bvh;
+    else
+        return false;
+    return true;
+}
+
+char const *Scene::name(Acceleration acceleration) {
+    switch (acceleration) {
+        case Acceleration::Linear:
+            return "linear";
+        case Acceleration::Grid:
+            return "grid";
+        case Acceleration::Bvh:
+            return "bvh";
+        default:
+            return "auto";
+    }
+}
+
 void Scene::setRenderShadows(bool shadows) {
-    renderShadows = shadows;
+    settings.renderShadows = shadows;
 }
 
 void Scene::setRecursionDepth(unsigned depth) {
-    recursionDepth = depth;
+    settings.recursionDepth = depth;
 }
 
 void Scene::setSuperSample(unsigned factor) {
-    supersamplingFactor = factor;
+    settings.supersamplingFactor = factor;
+}
+
+void Scene::setSpecialisedShading(bool specialised) {
+    specialisedShading = specialised;
+    kernelsStale = true;
+}
+
+void Scene::setSamplePattern(Sampler::Pattern pattern) {
+    samplePattern = pattern;
+}
+
+void Scene::setIntegrator(Integrator type) {
+    integrator = type;
+}
+
+void Scene::setMaxPathLength(unsigned length) {
+    maxPathLength = length;
 }
@@ -1,25 +1,102 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "arena.h"
+#include "bvh.h"
+#include "grid.h"
 #include "light.h"
 #include "object.h"
+#include "region.h"
+#include "sampler.h"
 #include "triple.h"
+#include "widebvh.h"
 
+#include <array>
+#include <functional>
+#include <string>
 #include <vector>
 #include <utility>
 
 // Forward declarations
+struct AuxBuffers;
 class Ray;
 class Image;
+class ThreadPool;
 
 class Scene
 {
+    public:
+        // Whitted: deterministic Phong + mirror/refraction recursion.
+        // Path: Monte Carlo path tracing, one light sampled per bounce.
+        enum class Integrator
+        {
+            Whitted,
+            Path
+        };
+
+        // How rays find the objects they hit:
+        // Linear: every object is tested, best for a handful of objects.
+        // Grid: a uniform grid, for many objects of similar size.
+        // Bvh: a bounding volume hierarchy, for anything else.
+        // Auto: one of these picked from the number and sizes of the
+        // objects whenever the structure is built.
+        enum class Acceleration
+        {
+            Auto,
+            Linear,
+            Grid,
+            Bvh
+        };
+
+        // What a render may be asked to do differently without changing
+        // the scene, so that renders with other settings can share it.
+        struct Settings
+        {
+            bool renderShadows;
+            unsigned recursionDepth;
+            unsigned supersamplingFactor;
+        };
+
+        // What the denoiser needs of the first hit along a primary ray:
+        // its albedo, its normal facing the ray and its distance, all
+        // zero if nothing is hit.
+        struct Features
+        {
+            Color albedo;
+            Vector normal;
+            double depth = 0.0;
+        };
+
+    private:
+    // The objects and lights made with make() share its arena. Objects
+    // may also come from elsewhere.
+    std::shared_ptr<Arena> arena;
     std::vector<ObjectPtr> objects;
     std::vector<LightPtr> lights;
     Point eye;
-    bool renderShadows;
-    unsigned recursionDepth;
-    unsigned supersamplingFactor;
+    Settings settings;
+    Sampler::Pattern samplePattern;
+    Integrator integrator;
+    unsigned maxPathLength;
+
+    // Acceleration structure over the bounded objects, the others are
+    // tested against every ray. Built by prepare() when stale. The BVH is
+    // updated incrementally as objects are edited afterwards, the grid is
+    // built again. With a width of 4 or 8 the binary tree is collapsed
+    // into one of the wide ones, which is then used for tracing.
+    Acceleration acceleration;
+    Acceleration activeAcceleration;    // the one built, never Auto
+    Grid grid;
+    Bvh bvh;
+    Bvh::Method bvhMethod;
+    unsigned bvhWidth;
+    bool bvhQuantized;
+    WideBvh<4, false> bvh4;
+    WideBvh<4, true> bvh4q;
+    WideBvh<8, false> bvh8;
+    WideBvh<8, true> bvh8q;
+    std::vector<unsigned> unbounded;
+    bool accelerationStale;
 
     // Offset multiplier. Before casting a new ray from a hit point,
     // move the hit point in the direction of the normal with this offset
@@ -27,28 +104,197 @@ class Scene
     // floating point inaccuracies. This prevents shadow acne, among other problems.
     double const epsilon = 1E-3;
 
+    // Shading for one hit, specialised on the scene and material features
+    // it uses (see shade below).
+    typedef Color (Scene::*ShadeKernel)(Ray const &ray, Object &obj,
+                                        Hit const &hit, unsigned depth,
+                                        bool shadows) const;
+
+    // Per object, the kernels without and with shadows, each at
+    // depth == 0 and at depth > 0: kernels[idx][2 * shadows + (depth > 0)].
+    // Filled in by selectKernels() when rendering starts, and kept up to
+    // date by the edits after that.
+    std::vector<std::array<ShadeKernel, 4>> kernels;
+    bool kernelsStale;
+
+    // if false, every object gets the generic kernel instead
+    bool specialisedShading;
+
+    // index of the closest object along the ray, objects.size() if none.
+    // No hit attributes are computed.
+    unsigned closestObject(Ray const &ray, double &t, unsigned &primitive) const;
+
+    // Phong shading plus reflection/refraction. The flags are known when
+    // the scene is set up, so each combination gets its own copy without
+    // the branches for features it does not use. The Generic copy ignores
+    // them and tests renderShadows and the material at run time.
+    template <bool Shadows, bool Textured, bool Transparent, bool Reflective,
+              bool Recurse, bool Generic = false>
+    Color shade(Ray const &ray, Object &obj, Hit const &hit, unsigned depth,
+                bool renderShadows) const;
+
+    // true if something blocks the light seen from hit in direction L
+    bool occluded(Point const &hit, Vector const &shadingN, Vector const &L,
+                  Light const &light) const;
+
+    // add the Phong diffuse and specular terms of one light to color,
+    // the diffuse one scaled by diffuseScale
+    void addPhong(Color &color, Light const &light, Vector const &L,
+                  Vector const &shadingN, Vector const &V,
+                  Material const &material, Color const &matColor,
+                  double diffuseScale = 1.0) const;
+
+    // radiance along ray estimated by a single random path; first, if
+    // given, receives the features of the path's first hit
+    Color tracePath(Ray ray, Rng &rng, bool shadows,
+                    Features *first = nullptr) const;
+
+    // the features of obj hit at distance t with normal N
+    Features features(Ray const &ray, Object &obj, double t,
+                      Vector const &N) const;
+
+    // camera ray through the given sample of pixel (x, y), index is the
+    // pixel's number in an image of height h
+    Ray primaryRay(Sampler const &sampler, unsigned x, unsigned y,
+                   unsigned h, unsigned index, unsigned sample) const;
+
+    // color seen along a primary ray, using the selected integrator;
+    // first, if given, receives the features of the first hit
+    Color radiance(Ray const &ray, unsigned index, unsigned sample,
+                   Settings const &settings, Features *first) const;
+
+    // pick the shade instantiation for every object, or for one material
+    void selectKernels();
+    std::array<ShadeKernel, 4> kernelsFor(Material const &material) const;
+
+    // whether object idx is in the acceleration structure
+    bool bounded(unsigned idx) const;
+
+    // Whether edits are applied to the acceleration structure, otherwise
+    // it is marked stale
+    bool updatesInPlace();
+
+    // the acceleration to use for the bounded objects' boxes
+    static Acceleration chooseAcceleration(std::vector<Box> const &bounds);
+
+    template <unsigned Remaining, bool ...Flags>
+    friend struct KernelTable;
+
     public:
         Scene();
 
-        // determine closest hit (if any)
-        std::pair<ObjectPtr, Hit> castRay(Ray const &ray) const;
+        // The wide BVHs point into the binary one, which a copy would
+        // leave pointing into this scene.
+        Scene(Scene const &other) = delete;
+        Scene &operator=(Scene const &other) = delete;
+
+        // determine closest hit (if any), the object pointer is non-owning
+        std::pair<Object *, Hit> castRay(Ray const &ray) const;
+
+        // trace a ray into the scene and return the color; first, if
+        // given, receives the features of the first hit. Requires
+        // prepare().
+        Color trace(Ray const &ray, unsigned depth, bool shadows,
+                    Features *first = nullptr) const;
+
+        // render the scene to the given image, spreading rows over pool.
+        // aux, if given, receives the first hit features for the denoiser
+        // and must have the size of img.
+        void render(Image &img, ThreadPool &pool, AuxBuffers *aux = nullptr);
 
-        // trace a ray into the scene and return the color
-        Color trace(Ray const &ray, unsigned depth);
+        // as render, but only trace the pixels inside the regions, the
+        // other pixels of img are left as they are
+        void render(Image &img, ThreadPool &pool,
+                    std::vector<Region> const &regions,
+                    AuxBuffers *aux = nullptr);
 
-        // render the scene to the given image
-        void render(Image &img);
+        // as render, but only trace pixel (x, y) if mask[y * width + x]
+        void render(Image &img, ThreadPool &pool,
+                    std::vector<bool> const &mask,
+                    AuxBuffers *aux = nullptr);
 
+        // index of the object seen along ray, getNumObject() if none.
+        // Requires prepare().
+        unsigned visibleObject(Ray const &ray, double &t) const;
+
+        // Build the acceleration structure, or bring it up to date with
+        // the edits since the last call, and pick the shading kernels. The
+        // render functions call this themselves.
+        void prepare(ThreadPool &pool);
+
+        // render progressively for about the given time, spending extra
+        // samples on the noisiest tiles. update is called with a complete
+        // image after every pass. Returns the mean samples per pixel.
+        double renderWithin(Image &img, ThreadPool &pool, double seconds,
+                            std::function<void(Image const &)> const &update);
+
+        // The render functions with the given settings instead of the
+        // scene's own. They leave the scene as it is, so one prepared
+        // scene can serve renders with different settings. Requires
+        // prepare().
+        void render(Image &img, ThreadPool &pool, Settings const &settings,
+                    AuxBuffers *aux = nullptr) const;
+        void render(Image &img, ThreadPool &pool, Settings const &settings,
+                    std::vector<Region> const &regions,
+                    AuxBuffers *aux = nullptr) const;
+        void render(Image &img, ThreadPool &pool, Settings const &settings,
+                    std::vector<bool> const &mask,
+                    AuxBuffers *aux = nullptr) const;
+        double renderWithin(Image &img, ThreadPool &pool,
+                            Settings const &settings, double seconds,
+                            std::function<void(Image const &)> const &update) const;
+
+
+        // a new T, from args, in the memory of the scene, which is
+        // released as a whole once the scene and all of these pointers
+        // are gone
+        template <typename T, typename ...Args>
+        std::shared_ptr<T> make(Args &&...args)
+        {
+            return arena->make<T>(std::forward<Args>(args)...);
+        }
 
         void addObject(ObjectPtr obj);
+
+        // Edits after the scene was set up, for animation and interactive
+        // tools. moveObject returns false if the object cannot be moved;
+        // other transformations replace the object by a transformed one.
+        // removeObject moves the objects after idx down by one.
+        bool moveObject(unsigned idx, Vector const &offset);
+        void replaceObject(unsigned idx, ObjectPtr obj);
+        void removeObject(unsigned idx);
+        void setMaterial(unsigned idx, Material const &material);
         void addLight(Light const &light);
+        void setLightPosition(unsigned idx, Point const &position);
         void setEye(Triple const &position);
         void setRenderShadows(bool renderShadows);
         void setRecursionDepth(unsigned depth);
         void setSuperSample(unsigned factor);
+        void setSamplePattern(Sampler::Pattern pattern);
+        void setIntegrator(Integrator integrator);
+        void setMaxPathLength(unsigned length);
+        void setAcceleration(Acceleration acceleration);
+        void setBvhMethod(Bvh::Method method);
+        // width 2, 4 or 8, quantized only applies to 4 and 8
+        void setBvhWidth(unsigned width, bool quantized);
+
+        // Whether shading uses the kernels specialised on the features of
+        // each object (the default), or one generic kernel for all. Both
+        // give the same image; see bench/shadebench.cpp.
+        void setSpecialisedShading(bool specialised);
 
         unsigned getNumObject();
         unsigned getNumLights();
+        Point const &getEye() const;
+        bool getRenderShadows() const;
+        Settings const &getSettings() const;
+        Integrator getIntegrator() const;
+        // the acceleration used since the last prepare()
+        Acceleration getAcceleration() const;
+
+        // "auto", "linear", "grid" or "bvh"
+        static bool parse(std::string const &name, Acceleration &acceleration);
+        static char const *name(Acceleration acceleration);
 };
 
 #endif
@@ -7,18 +7,18 @@
  *  First find the intersection with the plane the quad is in,
  *  then determine whether the point of intersection is within the quad.
  */
-Hit Quad::intersect(Ray const &ray)
+double Quad::distance(Ray const &ray, unsigned &primitive)
 {
     // Catch the case where the ray is parallel to the plane, i.e. no intersection.
     double DdotN = (-ray.D).dot(N);
     if (std::abs(DdotN) < std::numeric_limits<double>::epsilon())
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
 
     // Find the point of intersection with the plane.
     double t = -N.dot(ray.O - v0) / N.dot(ray.D);
 
     if (t < 0.0)
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
 
     Point hit = ray.at(t);
 
@@ -27,9 +27,34 @@ Hit Quad::intersect(Ray const &ray)
     double v = (hit - v0).dot(v3 - v0);
     if (0.0 <= u and u <= (v1 - v0).length_2() and
         0.0 <= v and v <= (v3 - v0).length_2())
-        return Hit(t, N);
+        return t;
 
-    return Hit::NO_HIT();
+    return NO_DISTANCE;
+}
+
+Vector Quad::normal(Ray const &ray, double t, unsigned primitive)
+{
+    return N;
+}
+
+bool Quad::translate(Vector const &offset)
+{
+    // the normal does not change
+    v0 += offset;
+    v1 += offset;
+    v2 += offset;
+    v3 += offset;
+    return true;
+}
+
+Box Quad::bounds() const
+{
+    Box box;
+    box.extend(v0);
+    box.extend(v1);
+    box.extend(v2);
+    box.extend(v3);
+    return box;
 }
 
 Vector Quad::toUV(Point const &hit)
@@ -11,13 +11,16 @@ class Quad: public Object
              Point const &v2,
              Point const &v3);
 
-        Hit intersect(Ray const &ray) override;
+        double distance(Ray const &ray, unsigned &primitive) override;
+        Vector normal(Ray const &ray, double t, unsigned primitive) override;
         Vector toUV(Point const &hit) override;
+        bool translate(Vector const &offset) override;
+        Box bounds() const override;
 
-        Point const v0;
-        Point const v1;
-        Point const v2;
-        Point const v3;
+        Point v0;
+        Point v1;
+        Point v2;
+        Point v3;
 
         Vector const N;
 };
@@ -5,7 +5,7 @@
 
 using namespace std;
 
-Hit Sphere::intersect(Ray const &ray) {
+double Sphere::distance(Ray const &ray, unsigned &primitive) {
     // Sphere formula: ||x - position||^2 = r^2
     // Line formula:   x = ray.O + t * ray.D
 
@@ -17,24 +17,33 @@ Hit Sphere::intersect(Ray const &ray) {
     double t0;
     double t1;
     if (not Solvers::quadratic(a, b, c, t0, t1))
-        return Hit::NO_HIT();
+        return NO_DISTANCE;
 
     // t0 is closest hit
     if (t0 < 0.0)  // check if it is not behind the camera
     {
         t0 = t1;    // try t1
         if (t0 < 0.0) // both behind the camera
-            return Hit::NO_HIT();
+            return NO_DISTANCE;
     }
 
-    // calculate normal
-    Point hit = ray.at(t0);
-    Vector N = (hit - position).normalized();
+    return t0;
+}
 
+Vector Sphere::normal(Ray const &ray, double t, unsigned primitive) {
     // Note that the direction of the normal is not changed here,
     // but in scene.cpp - if necessary.
+    return (ray.at(t) - position).normalized();
+}
+
+bool Sphere::translate(Vector const &offset) {
+    position += offset;
+    return true;
+}
 
-    return Hit(t0, N);
+Box Sphere::bounds() const {
+    Vector extent(r, r, r);
+    return Box(position - extent, position + extent);
 }
 
 Vector Sphere::toUV(Point const &hit) {
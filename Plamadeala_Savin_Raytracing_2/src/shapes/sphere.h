@@ -11,10 +11,13 @@ class Sphere: public Object
         Sphere(Point const &pos, double radius,
                Vector const& axis = Vector(0.0, 1.0, 0.0), double angle = 0.0);
 
-        Hit intersect(Ray const &ray) override;
+        double distance(Ray const &ray, unsigned &primitive) override;
+        Vector normal(Ray const &ray, double t, unsigned primitive) override;
         Vector toUV(Point const &hit) override;
+        bool translate(Vector const &offset) override;
+        Box bounds() const override;
 
-        Point const position;
+        Point position;
         double const r;
         Vector const axis;
         double const angle;
@@ -0,0 +1,29 @@
+#ifndef TEXTURE_H_
+#define TEXTURE_H_
+
+#include "image.h"
+#include "triple.h"
+
+// The colors of a material, looked up at normalized coordinates
+// (0...1, 0...1).
+class Texture
+{
+    public:
+        virtual ~Texture() = default;
+
+        virtual Color colorAt(float x, float y) const = 0;
+};
+
+// A texture decoded into memory as a whole
+class ImageTexture: public Texture
+{
+    public:
+        Image image;
+
+        Color colorAt(float x, float y) const override
+        {
+            return image.colorAt(x, y);
+        }
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "texturecache.h"
+
+#include "lode/lodepng.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    char const MAGIC[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '2'};
+    unsigned const TILE = 64;           // texels along a side of a tile
+    unsigned const CHANNELS = 3;
+    unsigned const LOCAL_TILES = 16;    // per thread, a power of 2
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint32_t tileSize;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // A thread's most recently used tiles, indexed by a hash of the key.
+    // serial tells which cache the entry belongs to, 0 for none.
+    struct LocalTile
+    {
+        unsigned serial = 0;
+        uint64_t key = 0;
+        shared_ptr<TextureCache::Tile const> tile;
+    };
+
+    thread_local LocalTile t_tiles[LOCAL_TILES];
+
+    atomic<unsigned> s_serials(0);
+
+    // Decoding a texture at full size takes more memory than all tiles
+    // of a modest budget, so textures are converted one at a time.
+    mutex s_convertMutex;
+
+    unsigned slot(uint64_t key)
+    {
+        return (key * 0x9E3779B97F4A7C15ull) >> 60 & (LOCAL_TILES - 1);
+    }
+
+    uint32_t tilesAlong(unsigned size)
+    {
+        return (size + TILE - 1) / TILE;
+    }
+
+    bool upToDate(string const &tileFile, struct stat const &source)
+    {
+        ifstream in(tileFile, ios::binary);
+        Header header;
+        return in.read(reinterpret_cast<char *>(&header), sizeof header)
+               and memcmp(header.magic, MAGIC, sizeof MAGIC) == 0
+               and header.sourceSize == static_cast<uint64_t>(source.st_size)
+               and header.sourceTime == static_cast<int64_t>(source.st_mtime)
+               and header.tileSize == TILE;
+    }
+}
+
+// -- TextureCache -------------------------------------------------------------
+
+TextureCache::TextureCache(size_t budget)
+:
+    d_serial(++s_serials),
+    d_textures(0),
+    d_budget(budget)
+{}
+
+void TextureCache::setBudget(size_t budget)
+{
+    lock_guard<mutex> lock(d_mutex);
+    d_budget = budget;
+    evict();
+}
+
+unsigned TextureCache::add()
+{
+    return d_textures++;
+}
+
+unsigned char const *TextureCache::tile(TiledTexture const &texture,
+                                        unsigned id, uint32_t idx)
+{
+    uint64_t key = static_cast<uint64_t>(id) << 32 | idx;
+    LocalTile &local = t_tiles[slot(key)];
+    if (local.serial == d_serial and local.key == key)
+        return local.tile->data();
+
+    shared_ptr<Tile const> found;
+    {
+        lock_guard<mutex> lock(d_mutex);
+        ++d_stats.lookups;
+        auto entry = d_tiles.find(key);
+        if (entry != d_tiles.end())
+        {
+            d_uses.splice(d_uses.begin(), d_uses, entry->second.use);
+            found = entry->second.tile;
+        }
+    }
+
+    if (!found)
+    {
+        // read without holding the lock; should another thread read the
+        // same tile meanwhile, its copy is used
+        auto read = make_shared<Tile>(TiledTexture::tileBytes());
+        if (!texture.readTile(idx, read->data()))
+            for (size_t texel = 0; texel != read->size(); texel += CHANNELS)
+            {
+                (*read)[texel] = 255;       // magenta
+                (*read)[texel + 1] = 0;
+                (*read)[texel + 2] = 255;
+            }
+
+        lock_guard<mutex> lock(d_mutex);
+        ++d_stats.reads;
+        auto inserted = d_tiles.emplace(key, Entry());
+        Entry &entry = inserted.first->second;
+        if (inserted.second)
+        {
+            d_uses.push_front(key);
+            entry.tile = read;
+            entry.use = d_uses.begin();
+            d_stats.bytes += read->size();
+            d_stats.peakBytes = max(d_stats.peakBytes, d_stats.bytes);
+        }
+        found = entry.tile;
+        evict();
+    }
+
+    local.serial = d_serial;
+    local.key = key;
+    local.tile = move(found);
+    return local.tile->data();
+}
+
+TextureCache::Stats TextureCache::stats()
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_stats;
+}
+
+void TextureCache::evict()
+{
+    // the most recently used tile is kept whatever the budget
+    while (d_budget != 0 and d_stats.bytes > d_budget and d_uses.size() > 1)
+    {
+        auto entry = d_tiles.find(d_uses.back());
+        d_stats.bytes -= entry->second.tile->size();
+        d_tiles.erase(entry);
+        d_uses.pop_back();
+        ++d_stats.evictions;
+    }
+}
+
+// -- TiledTexture -------------------------------------------------------------
+
+TiledTexture::TiledTexture(shared_ptr<TextureCache> const &cache)
+:
+    d_cache(cache),
+    d_id(cache->add())
+{}
+
+TiledTexture::~TiledTexture()
+{
+    if (d_fd >= 0)
+        close(d_fd);
+}
+
+bool TiledTexture::convert(string const &pngFile, string const &tileFile,
+                           bool &converted)
+{
+    converted = false;
+    struct stat source;
+    if (stat(pngFile.c_str(), &source) != 0)
+        return false;
+    if (upToDate(tileFile, source))
+        return true;
+
+    lock_guard<mutex> lock(s_convertMutex);
+    vector<unsigned char> texels;
+    unsigned width;
+    unsigned height;
+    if (lodepng::decode(texels, width, height, pngFile, LCT_RGB, 8) != 0
+        or width == 0 or height == 0)
+        return false;
+
+    // written aside and renamed, so an interrupted conversion never
+    // leaves a tile file that looks complete
+    string tmpFile = tileFile + ".tmp";
+    ofstream out(tmpFile, ios::binary);
+    if (!out)
+        return false;
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.sourceSize = source.st_size;
+    header.sourceTime = source.st_mtime;
+    header.tileSize = TILE;
+    header.width = width;
+    header.height = height;
+    out.write(reinterpret_cast<char const *>(&header), sizeof header);
+
+    vector<unsigned char> tile(tileBytes());
+    for (unsigned ty = 0; ty != tilesAlong(height); ++ty)
+        for (unsigned tx = 0; tx != tilesAlong(width); ++tx)
+        {
+            // texels past the edge of the texture stay 0
+            fill(tile.begin(), tile.end(), 0);
+            unsigned columns = min(TILE, width - tx * TILE);
+            for (unsigned row = 0; row != TILE; ++row)
+            {
+                unsigned y = ty * TILE + row;
+                if (y >= height)
+                    break;
+                memcpy(&tile[row * TILE * CHANNELS],
+                       &texels[(y * width + tx * TILE) * CHANNELS],
+                       columns * CHANNELS);
+            }
+            out.write(reinterpret_cast<char const *>(tile.data()),
+                      tile.size());
+        }
+
+    out.close();
+    if (!out or rename(tmpFile.c_str(), tileFile.c_str()) != 0)
+    {
+        remove(tmpFile.c_str());
+        return false;
+    }
+    converted = true;
+    return true;
+}
+
+bool TiledTexture::open(string const &tileFile)
+{
+    int fd = ::open(tileFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    Header header;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header
+        or memcmp(header.magic, MAGIC, sizeof MAGIC) != 0
+        or header.tileSize != TILE or header.width == 0
+        or header.height == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (d_fd >= 0)
+        close(d_fd);
+    d_fd = fd;
+    d_width = header.width;
+    d_height = header.height;
+    d_tilesX = tilesAlong(d_width);
+    return true;
+}
+
+unsigned TiledTexture::width() const
+{
+    return d_width;
+}
+
+unsigned TiledTexture::height() const
+{
+    return d_height;
+}
+
+Color TiledTexture::colorAt(float x, float y) const
+{
+    if (d_width == 0)
+        return Color(1, 0, 1);
+
+    // the texel Image::colorAt picks, clamped to the texture
+    x = min(max(x, 0.0f), 1.0f);
+    y = min(max(y, 0.0f), 1.0f);
+    unsigned px = static_cast<unsigned>(x * (d_width - 1));
+    unsigned py = static_cast<unsigned>(y * (d_height - 1));
+
+    uint32_t idx = (py / TILE) * d_tilesX + px / TILE;
+    unsigned char const *texel = d_cache->tile(*this, d_id, idx)
+                                 + ((py % TILE) * TILE + px % TILE) * CHANNELS;
+    return Color(texel[0] / 255.0, texel[1] / 255.0, texel[2] / 255.0);
+}
+
+bool TiledTexture::readTile(uint32_t idx, unsigned char *data) const
+{
+    size_t bytes = tileBytes();
+    return pread(d_fd, data, bytes, sizeof(Header) + uint64_t(idx) * bytes)
+           == static_cast<ssize_t>(bytes);
+}
+
+size_t TiledTexture::tileBytes()
+{
+    return TILE * TILE * CHANNELS;
+}
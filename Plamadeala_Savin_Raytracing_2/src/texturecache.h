@@ -0,0 +1,124 @@
+#ifndef TEXTURECACHE_H_
+#define TEXTURECACHE_H_
+
+#include "texture.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TiledTexture;
+
+// The tiles of tiled textures read in so far, shared by all of them and
+// kept under a memory budget by releasing the least recently used ones.
+//
+// Every thread looking up tiles first checks a small cache of its own,
+// which holds on to the last tiles it used (so they stay valid while it
+// reads them, even if the shared cache released them meanwhile). Only
+// when that misses is the shared cache locked, and only when that misses
+// too is the tile read from its file.
+class TextureCache
+{
+    public:
+        typedef std::vector<unsigned char> Tile;
+
+        struct Stats
+        {
+            uint64_t lookups = 0;       // past the per thread caches
+            uint64_t reads = 0;         // tiles read from file
+            uint64_t evictions = 0;
+            size_t bytes = 0;           // tiles in the shared cache
+            size_t peakBytes = 0;
+        };
+
+    private:
+        struct Entry
+        {
+            std::shared_ptr<Tile const> tile;
+            std::list<uint64_t>::iterator use;
+        };
+
+        unsigned const d_serial;        // tells caches apart in threads
+        std::atomic<unsigned> d_textures;
+
+        std::mutex d_mutex;             // guards the members below
+        size_t d_budget;
+        std::unordered_map<uint64_t, Entry> d_tiles;
+        std::list<uint64_t> d_uses;     // keys, most recently used first
+        Stats d_stats;
+
+    public:
+        // budget in bytes, 0 for no limit
+        explicit TextureCache(size_t budget);
+
+        TextureCache(TextureCache const &) = delete;
+        TextureCache &operator=(TextureCache const &) = delete;
+
+        void setBudget(size_t budget);
+
+        // identifies a new texture
+        unsigned add();
+
+        // The texels of tile idx of texture id, read in if needed. They
+        // stay valid until the calling thread's next lookup.
+        unsigned char const *tile(TiledTexture const &texture, unsigned id,
+                                  uint32_t idx);
+
+        Stats stats();
+
+    private:
+        // release tiles until the budget is met; call with d_mutex locked
+        void evict();
+};
+
+// A texture in a tiled file, of which only the tiles looked up are in
+// memory (in a TextureCache).
+//
+// The file holds the texture cut into square tiles of 8 bit RGB texels,
+// row by row. It is converted from a PNG file once and converted again
+// when that changes.
+class TiledTexture: public Texture
+{
+    std::shared_ptr<TextureCache> d_cache;
+    unsigned d_id;
+    int d_fd = -1;
+    unsigned d_width = 0;           // 0 until opened
+    unsigned d_height = 0;
+    unsigned d_tilesX = 0;
+
+    public:
+        explicit TiledTexture(std::shared_ptr<TextureCache> const &cache);
+        ~TiledTexture();
+
+        TiledTexture(TiledTexture const &) = delete;
+        TiledTexture &operator=(TiledTexture const &) = delete;
+
+        // Write tileFile for pngFile unless it is up to date; converted
+        // tells whether it had to be. Returns false on failure.
+        static bool convert(std::string const &pngFile,
+                            std::string const &tileFile, bool &converted);
+
+        // Returns false if tileFile cannot be read. Until opened, the
+        // texture is magenta.
+        bool open(std::string const &tileFile);
+
+        unsigned width() const;
+        unsigned height() const;
+
+        // nearest texel, as Image::colorAt
+        Color colorAt(float x, float y) const override;
+
+        // tile idx (row by row) into data; returns false if it could not
+        // be read
+        bool readTile(uint32_t idx, unsigned char *data) const;
+
+        static size_t tileBytes();
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned numThreads)
+:
+    d_stop(false)
+{
+    if (numThreads == 0)
+        numThreads = max(thread::hardware_concurrency(), 1u);
+
+    d_workers.reserve(numThreads);
+    for (unsigned idx = 0; idx != numThreads; ++idx)
+        d_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_stop = true;
+    }
+    d_wakeup.notify_all();
+
+    for (thread &worker : d_workers)
+        worker.join();
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_tasks.push_back(move(task));
+    }
+    d_wakeup.notify_one();
+}
+
+void ThreadPool::parallelFor(unsigned count,
+                             function<void(unsigned)> const &body)
+{
+    if (count == 0)
+        return;
+
+    // Shared between the caller and the helper tasks. Helpers may still be
+    // queued after the caller returned; they then find no work left and
+    // never touch body.
+    struct Batch
+    {
+        atomic<unsigned> next{0};
+        unsigned finished = 0;
+        mutex lock;
+        condition_variable done;
+    };
+    auto batch = make_shared<Batch>();
+    auto const *work = &body;
+
+    auto drain = [batch, work, count]
+    {
+        unsigned completed = 0;
+        for (unsigned idx = batch->next++; idx < count; idx = batch->next++)
+        {
+            (*work)(idx);
+            ++completed;
+        }
+
+        if (completed == 0)
+            return;
+
+        lock_guard<mutex> lock(batch->lock);
+        batch->finished += completed;
+        if (batch->finished == count)
+            batch->done.notify_all();
+    };
+
+    unsigned helpers = min<unsigned>(d_workers.size(), count - 1);
+    for (unsigned idx = 0; idx != helpers; ++idx)
+        submit(drain);
+
+    drain();
+
+    unique_lock<mutex> lock(batch->lock);
+    batch->done.wait(lock, [&]{ return batch->finished == count; });
+}
+
+unsigned ThreadPool::size() const
+{
+    return d_workers.size();
+}
+
+// --- Private -----------------------------------------------------------------
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(d_mutex);
+            d_wakeup.wait(lock, [this]{ return d_stop or not d_tasks.empty(); });
+
+            if (d_tasks.empty())    // stopping and nothing left to do
+                return;
+
+            task = move(d_tasks.front());
+            d_tasks.pop_front();
+        }
+        task();
+    }
+}
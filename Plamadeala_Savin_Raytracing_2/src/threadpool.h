@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+    std::vector<std::thread> d_workers;
+    std::deque<std::function<void()>> d_tasks;
+    std::mutex d_mutex;
+    std::condition_variable d_wakeup;
+    bool d_stop;
+
+    public:
+        // numThreads == 0 uses one worker per hardware thread
+        explicit ThreadPool(unsigned numThreads = 0);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        // queue a task for execution on one of the workers
+        void submit(std::function<void()> task);
+
+        // run body(0) ... body(count - 1) on the workers and wait for all
+        // of them. The calling thread helps out, so nested or concurrent
+        // calls from several threads are fine.
+        void parallelFor(unsigned count,
+                         std::function<void(unsigned)> const &body);
+
+        unsigned size() const;
+
+    private:
+        void workerLoop();
+};
+
+#endif
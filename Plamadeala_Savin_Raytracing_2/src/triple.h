@@ -3,8 +3,112 @@
 
 #include "json/json_fwd.h"
 
+#include <cmath>
 #include <iosfwd>
 
+// The arithmetic below works on four lanes: x, y, z and a padding lane.
+// With AVX a Triple fits a single register, with SSE2 (always available on
+// x86-64) two of them. Other targets use plain scalar code.
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace simd
+{
+#if defined(__AVX__)
+
+    typedef __m256d Reg;
+
+    inline Reg load(double const *p)        { return _mm256_loadu_pd(p); }
+    inline void store(double *p, Reg a)     { _mm256_storeu_pd(p, a); }
+    inline Reg broadcast(double f)          { return _mm256_set1_pd(f); }
+    inline Reg add(Reg a, Reg b)            { return _mm256_add_pd(a, b); }
+    inline Reg sub(Reg a, Reg b)            { return _mm256_sub_pd(a, b); }
+    inline Reg mul(Reg a, Reg b)            { return _mm256_mul_pd(a, b); }
+    inline Reg min(Reg a, Reg b)            { return _mm256_min_pd(a, b); }
+
+#elif defined(__SSE2__)
+
+    struct Reg
+    {
+        __m128d lo;
+        __m128d hi;
+    };
+
+    inline Reg load(double const *p)
+    {
+        return Reg{_mm_loadu_pd(p), _mm_loadu_pd(p + 2)};
+    }
+    inline void store(double *p, Reg a)
+    {
+        _mm_storeu_pd(p, a.lo);
+        _mm_storeu_pd(p + 2, a.hi);
+    }
+    inline Reg broadcast(double f)
+    {
+        return Reg{_mm_set1_pd(f), _mm_set1_pd(f)};
+    }
+    inline Reg add(Reg a, Reg b)
+    {
+        return Reg{_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+    }
+    inline Reg sub(Reg a, Reg b)
+    {
+        return Reg{_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+    }
+    inline Reg mul(Reg a, Reg b)
+    {
+        return Reg{_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+    }
+    inline Reg min(Reg a, Reg b)
+    {
+        return Reg{_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)};
+    }
+
+#else
+
+    struct Reg
+    {
+        double v[4];
+    };
+
+    inline Reg load(double const *p)    { return Reg{{p[0], p[1], p[2], p[3]}}; }
+    inline void store(double *p, Reg a)
+    {
+        for (int idx = 0; idx != 4; ++idx)
+            p[idx] = a.v[idx];
+    }
+    inline Reg broadcast(double f)      { return Reg{{f, f, f, f}}; }
+    inline Reg add(Reg a, Reg b)
+    {
+        for (int idx = 0; idx != 4; ++idx)
+            a.v[idx] += b.v[idx];
+        return a;
+    }
+    inline Reg sub(Reg a, Reg b)
+    {
+        for (int idx = 0; idx != 4; ++idx)
+            a.v[idx] -= b.v[idx];
+        return a;
+    }
+    inline Reg mul(Reg a, Reg b)
+    {
+        for (int idx = 0; idx != 4; ++idx)
+            a.v[idx] *= b.v[idx];
+        return a;
+    }
+    inline Reg min(Reg a, Reg b)        // same NaN handling as minpd
+    {
+        for (int idx = 0; idx != 4; ++idx)
+            a.v[idx] = a.v[idx] < b.v[idx] ? a.v[idx] : b.v[idx];
+        return a;
+    }
+
+#endif
+}
+
 // Color, Point and Vector are all Triples (name them so)
 class Triple;
 typedef Triple Color;
@@ -18,8 +122,9 @@ class Triple
 
         // union to acces the same elements by
         // x, y, z, or r, g, b or data[index]
+        // data[3] only pads a Triple to four lanes and is never read
         union {
-            double data[3];
+            double data[4];
             struct {
                 double x;
                 double y;
@@ -34,7 +139,7 @@ class Triple
 
 // --- Constructors ------------------------------------------------------------
 
-        explicit Triple(double X = 0, double Y = 0, double Z = 0);
+        constexpr explicit Triple(double X = 0, double Y = 0, double Z = 0);
         explicit Triple(nlohmann::json const &node);    // json -> Triple
 
 // --- Operators ---------------------------------------------------------------
@@ -84,6 +189,9 @@ class Triple
 
         Triple &clamp(double maxValue = 1.0);      // clamp: fmin(val, maxValue)
 
+    private:
+        simd::Reg reg() const;
+        static Triple fromReg(simd::Reg reg);
 };
 
 // --- Free Operators ----------------------------------------------------------
@@ -100,4 +208,191 @@ Triple reflect(Triple const &incident, Triple const &normal);
 std::istream &operator>>(std::istream &is, Triple &t);
 std::ostream &operator<<(std::ostream &os, Triple const &t);
 
+// =============================================================================
+// -- Inline implementation ----------------------------------------------------
+// =============================================================================
+
+// Everything but the JSON and stream IO is defined here so the tracer's hot
+// loops get the operators inlined instead of a call per operation.
+
+constexpr Triple::Triple(double X, double Y, double Z)
+:
+    data{X, Y, Z, 0.0}
+{}
+
+inline simd::Reg Triple::reg() const
+{
+    return simd::load(data);
+}
+
+inline Triple Triple::fromReg(simd::Reg reg)
+{
+    Triple t;
+    simd::store(t.data, reg);
+    return t;
+}
+
+// --- Operators ---------------------------------------------------------------
+
+inline Triple Triple::operator+(Triple const &t) const
+{
+    return fromReg(simd::add(reg(), t.reg()));
+}
+
+inline Triple Triple::operator+(double f) const
+{
+    return fromReg(simd::add(reg(), simd::broadcast(f)));
+}
+
+inline Triple Triple::operator-() const
+{
+    return fromReg(simd::mul(reg(), simd::broadcast(-1.0)));
+}
+
+inline Triple Triple::operator-(Triple const &t) const
+{
+    return fromReg(simd::sub(reg(), t.reg()));
+}
+
+inline Triple Triple::operator-(double f) const
+{
+    return fromReg(simd::sub(reg(), simd::broadcast(f)));
+}
+
+inline Triple Triple::operator*(Triple const &t) const
+{
+    return fromReg(simd::mul(reg(), t.reg()));
+}
+
+inline Triple Triple::operator*(double f) const
+{
+    return fromReg(simd::mul(reg(), simd::broadcast(f)));
+}
+
+inline Triple Triple::operator/(double f) const
+{
+    return (*this) * (1.0 / f);
+}
+
+// --- Compound operators ------------------------------------------------------
+
+inline Triple &Triple::operator+=(Triple const &t)
+{
+    return *this = *this + t;
+}
+
+inline Triple &Triple::operator+=(double f)
+{
+    return *this = *this + f;
+}
+
+inline Triple &Triple::operator-=(Triple const &t)
+{
+    return *this = *this - t;
+}
+
+inline Triple &Triple::operator-=(double f)
+{
+    return *this = *this - f;
+}
+
+inline Triple &Triple::operator*=(double f)
+{
+    return *this = *this * f;
+}
+
+inline Triple &Triple::operator/=(double f)
+{
+    return *this = *this / f;
+}
+
+// --- Vector Operators --------------------------------------------------------
+
+// The three-lane reductions stay scalar: a horizontal add costs more than
+// it saves, and this keeps the summation order (and results) unchanged.
+
+inline double Triple::dot(Triple const &t) const
+{
+    return x * t.x + y * t.y + z * t.z;
+}
+
+inline Triple Triple::cross(Triple const &t) const
+{
+    return Triple(y*t.z - z*t.y,
+                  z*t.x - x*t.z,
+                  x*t.y - y*t.x);
+}
+
+inline double Triple::length() const
+{
+    return std::sqrt(length_2());
+}
+
+inline double Triple::length_2() const
+{
+    return x * x + y * y + z * z;
+}
+
+inline Triple Triple::normalized() const
+{
+    return (*this) * (1.0 / length());
+}
+
+inline void Triple::normalize()
+{
+    *this = normalized();
+}
+
+// --- Color functions ---------------------------------------------------------
+
+inline void Triple::set(double f)
+{
+    set(f, f, f);
+}
+
+inline void Triple::set(double f, double maxValue)
+{
+    set(f / maxValue);
+}
+
+inline void Triple::set(double red, double green, double blue)
+{
+    r = red;
+    g = green;
+    b = blue;
+}
+
+inline void Triple::set(double red, double green, double blue, double maxValue)
+{
+    set(red / maxValue, green / maxValue, blue / maxValue);
+}
+
+inline Triple &Triple::clamp(double maxValue)
+{
+    return *this = fromReg(simd::min(reg(), simd::broadcast(maxValue)));
+}
+
+// --- Free Operators ----------------------------------------------------------
+
+inline Triple operator+(double f, Triple const &t)
+{
+    return t + f;
+}
+
+inline Triple operator-(double f, Triple const &t)
+{
+    return Triple(f, f, f) - t;
+}
+
+inline Triple operator*(double f, Triple const &t)
+{
+    return t * f;
+}
+
+inline Triple reflect(Triple const &incident, Triple const &normal)
+{
+    // single scale and subtract instead of building 2 * normal first
+    return incident - normal * (2.0 * normal.dot(incident));
+}
+
 #endif
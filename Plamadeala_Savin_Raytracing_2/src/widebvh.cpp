@@ -0,0 +1,331 @@
+#include "widebvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    float const INF = numeric_limits<float>::infinity();
+
+    // home of binary nodes not collapsed yet
+    unsigned const NONE = ~0u;
+
+    // the nearest float at or below value, and at or above it
+    float floatBelow(double value)
+    {
+        float rounded = static_cast<float>(value);
+        return rounded > value ? nextafter(rounded, -INF) : rounded;
+    }
+
+    float floatAbove(double value)
+    {
+        float rounded = static_cast<float>(value);
+        return rounded < value ? nextafter(rounded, INF) : rounded;
+    }
+
+    // Lanes 0 ... count - 1 sorted near to far for rays in the octant,
+    // packed bits per lane, the nearest in the lowest bits. Unused lanes
+    // come last.
+    uint32_t octantOrder(Box const *boxes, unsigned count, unsigned width,
+                         unsigned octant, unsigned bits)
+    {
+        Vector dir((octant & 1) ? -1 : 1, (octant & 2) ? -1 : 1,
+                   (octant & 4) ? -1 : 1);
+        unsigned lanes[8];
+        for (unsigned idx = 0; idx != width; ++idx)
+            lanes[idx] = idx;
+        stable_sort(lanes, lanes + count, [&](unsigned lhs, unsigned rhs)
+        {
+            return boxes[lhs].centroid().dot(dir)
+                   < boxes[rhs].centroid().dot(dir);
+        });
+
+        uint32_t order = 0;
+        for (unsigned k = 0; k != width; ++k)
+            order |= lanes[k] << k * bits;
+        return order;
+    }
+
+    // Exponent of the quantization step along one axis: 253 steps must
+    // span the extent, leaving a step of slack on either side, and a step
+    // must be at least 4 float ulps of the coordinates, so decoding
+    // rounds by less than the slack.
+    int stepExponent(double origin, double high)
+    {
+        int exponent;
+        frexp(max(high - origin, 0.0) / 253.0, &exponent);
+
+        int magnitude;
+        frexp(max(abs(origin), abs(high)), &magnitude);
+        exponent = max(exponent, magnitude - 22);
+        return min(max(exponent, -100), 100);
+    }
+
+    uint8_t quantizeBelow(double value, double origin, double step)
+    {
+        return max(floor((value - origin) / step) - 1.0, 0.0);
+    }
+
+    uint8_t quantizeAbove(double value, double origin, double step)
+    {
+        return min(ceil((value - origin) / step) + 1.0, 255.0);
+    }
+}
+
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::build(Bvh const &binary)
+{
+    d_binary = &binary;
+    d_nodes.clear();
+    d_roots.clear();
+    d_sources.clear();
+    d_homes.assign(binary.nodes().size(), Home{NONE, Width});
+    d_deadNodes = 0;
+    if (binary.empty())
+        return;
+
+    d_nodes.emplace_back();
+    d_roots.emplace_back();
+    d_sources.emplace_back();
+    d_homes[0] = Home{0, Width};
+    collapse(0, 0);
+}
+
+// A replaced binary node that is a child of a wide node gets a new
+// reference there. One that was opened in a wide node makes that node be
+// collapsed again, in place for the root, and otherwise as a new child of
+// its parent. The wide nodes below become unused. Nodes with a refitted
+// child store their boxes again.
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::update(Bvh const &binary)
+{
+    Bvh::Changes const &changes = binary.changes();
+    if (changes.relaid or d_nodes.empty() or binary.empty())
+    {
+        build(binary);
+        return;
+    }
+
+    d_homes.resize(binary.nodes().size(), Home{NONE, Width});
+    vector<unsigned> refitted;
+    for (unsigned node : changes.restructured)
+    {
+        // nodes added since the last update are covered by their parents
+        if (not binary.alive(node) or d_homes[node].node == NONE)
+            continue;
+
+        Home home = d_homes[node];
+        if (home.lane == Width and home.node == 0)
+        {
+            d_deadNodes += subtreeSize(0) - 1;
+            collapse(0, 0);
+            continue;
+        }
+        if (home.lane == Width)
+        {
+            // a replaced ancestor covers it if the root is gone
+            node = d_roots[home.node];
+            if (not binary.alive(node))
+                continue;
+            home = d_homes[node];
+        }
+
+        uint32_t old = d_nodes[home.node].child[home.lane];
+        if ((old & 7) == 0)
+            d_deadNodes += subtreeSize(old >> 3);
+        uint32_t ref = reference(node);
+        d_nodes[home.node].child[home.lane] = ref;
+        refitted.push_back(home.node);
+    }
+
+    for (unsigned node : changes.refitted)
+    {
+        if (binary.alive(node) and d_homes[node].node != NONE
+            and d_homes[node].lane != Width)
+            refitted.push_back(d_homes[node].node);
+    }
+
+    sort(refitted.begin(), refitted.end());
+    refitted.erase(unique(refitted.begin(), refitted.end()), refitted.end());
+    for (unsigned index : refitted)
+        encode(index);
+
+    if (d_deadNodes > d_nodes.size() / 2)
+        build(binary);
+}
+
+template <unsigned Width, bool Quantized>
+bool WideBvh<Width, Quantized>::empty() const
+{
+    return d_nodes.empty();
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::nodeCount() const
+{
+    return d_nodes.size();
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::nodeBytes()
+{
+    return sizeof(Node);
+}
+
+// --- Private -----------------------------------------------------------------
+
+template <unsigned Width, bool Quantized>
+uint32_t WideBvh<Width, Quantized>::reference(unsigned binaryNode)
+{
+    Bvh::Node const &node = d_binary->nodes()[binaryNode];
+    if (node.count != 0)
+        return node.offset << 3 | node.count;
+
+    unsigned index = d_nodes.size();
+    d_nodes.emplace_back();
+    d_roots.emplace_back();
+    d_sources.emplace_back();
+    collapse(index, binaryNode);
+    return index << 3;
+}
+
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::collapse(unsigned index, unsigned root)
+{
+    vector<Bvh::Node> const &nodes = d_binary->nodes();
+
+    // Open the inner child with the largest box until the node is full.
+    unsigned children[Width];
+    unsigned count = 0;
+    if (nodes[root].count != 0)
+        children[count++] = root;
+    else
+    {
+        children[count++] = nodes[root].offset;
+        children[count++] = nodes[root].offset + 1;
+    }
+
+    while (count != Width)
+    {
+        unsigned largest = count;
+        double largestArea = -1.0;
+        for (unsigned idx = 0; idx != count; ++idx)
+        {
+            Bvh::Node const &child = nodes[children[idx]];
+            if (child.count == 0 and child.box.area() > largestArea)
+            {
+                largest = idx;
+                largestArea = child.box.area();
+            }
+        }
+        if (largest == count)
+            break;
+
+        unsigned opened = children[largest];
+        d_homes[opened] = Home{index, Width};
+        children[largest] = nodes[opened].offset;
+        children[count++] = nodes[opened].offset + 1;
+    }
+
+    d_roots[index] = root;
+    for (unsigned idx = 0; idx != count; ++idx)
+    {
+        d_sources[index][idx] = children[idx];
+        d_homes[children[idx]] = Home{index, idx};
+    }
+
+    // Children are added after their parent, so the root ends up first.
+    uint32_t refs[Width];
+    for (unsigned idx = 0; idx != count; ++idx)
+        refs[idx] = reference(children[idx]);
+
+    Node &node = d_nodes[index];
+    node.count = count;
+    for (unsigned idx = 0; idx != Width; ++idx)
+        node.child[idx] = idx < count ? refs[idx] : 0;
+    encode(index);
+}
+
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::encode(unsigned index)
+{
+    Node &node = d_nodes[index];
+    Box boxes[Width];
+    for (unsigned idx = 0; idx != node.count; ++idx)
+        boxes[idx] = d_binary->nodes()[d_sources[index][idx]].box;
+
+    for (unsigned octant = 0; octant != 8; ++octant)
+        node.order[octant] = octantOrder(boxes, node.count, Width, octant,
+                                         ORDER_BITS);
+    encode(node, boxes, node.count);
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::subtreeSize(unsigned index) const
+{
+    unsigned size = 0;
+    vector<unsigned> stack(1, index);
+    while (not stack.empty())
+    {
+        Node const &node = d_nodes[stack.back()];
+        stack.pop_back();
+        ++size;
+        for (unsigned idx = 0; idx != node.count; ++idx)
+        {
+            if ((node.child[idx] & 7) == 0)
+                stack.push_back(node.child[idx] >> 3);
+        }
+    }
+    return size;
+}
+
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::encode(FloatNode &node, Box const *boxes,
+                                       unsigned count)
+{
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        for (unsigned idx = 0; idx != Width; ++idx)
+        {
+            // unused lanes get an empty box
+            node.lo[axis][idx] = idx < count ?
+                floatBelow(boxes[idx].lo.data[axis]) : INF;
+            node.hi[axis][idx] = idx < count ?
+                floatAbove(boxes[idx].hi.data[axis]) : -INF;
+        }
+    }
+}
+
+template <unsigned Width, bool Quantized>
+void WideBvh<Width, Quantized>::encode(QuantizedNode &node, Box const *boxes,
+                                       unsigned count)
+{
+    Box bounds;
+    for (unsigned idx = 0; idx != count; ++idx)
+        bounds.extend(boxes[idx]);
+
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        node.origin[axis] = floatBelow(bounds.lo.data[axis]);
+        node.exponent[axis] = stepExponent(node.origin[axis],
+                                           bounds.hi.data[axis]);
+        double step = ldexp(1.0, node.exponent[axis]);
+
+        for (unsigned idx = 0; idx != Width; ++idx)
+        {
+            // unused lanes get lo > hi, they are masked out anyway
+            node.lo[axis][idx] = idx < count ? quantizeBelow(
+                boxes[idx].lo.data[axis], node.origin[axis], step) : 255;
+            node.hi[axis][idx] = idx < count ? quantizeAbove(
+                boxes[idx].hi.data[axis], node.origin[axis], step) : 0;
+        }
+    }
+}
+
+template class WideBvh<4, false>;
+template class WideBvh<4, true>;
+template class WideBvh<8, false>;
+template class WideBvh<8, true>;
@@ -0,0 +1,311 @@
+#ifndef WIDEBVH_H_
+#define WIDEBVH_H_
+
+#include "bvh.h"
+#include "ray.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bounding volume hierarchy with Width (4 or 8) children per node, made by
+// collapsing a binary Bvh: a node adopts the children of its largest inner
+// children until it has Width of them.
+//
+// The child boxes of a node are stored per axis (structure of arrays) in
+// floats, rounded outwards, so four of them are tested with one SSE slab
+// test. With Quantized, each child bound is a byte: a multiple of a power
+// of two step from the node's corner. A 4-wide node then takes one 64 byte
+// cache line instead of 124 bytes, an 8-wide one two instead of 260 bytes.
+//
+// The hit children are visited near to far in an order fixed per node for
+// each of the eight octants of ray directions, so no sorting is needed
+// while tracing.
+//
+// The leaves refer to the indices of the binary tree, which must outlive
+// the wide one. After incremental updates of the binary tree, update()
+// refits the nodes holding changed children and collapses the replaced
+// parts again.
+template <unsigned Width, bool Quantized>
+class WideBvh
+{
+    static_assert(Width == 4 or Width == 8, "nodes have 4 or 8 children");
+
+    // per octant, the lanes of the children from near to far, packed in
+    // ORDER_BITS bits each
+    typedef typename std::conditional<Width == 4, uint8_t, uint32_t>::type
+        Order;
+    static unsigned const ORDER_BITS = Width == 4 ? 2 : 3;
+
+    // Child references: an inner node is (index << 3), a leaf is
+    // (first << 3 | count) with count 1 ... 4 indices from first on.
+    // The children are in lanes 0 ... count - 1.
+    struct FloatNode
+    {
+        float lo[3][Width];
+        float hi[3][Width];
+        uint32_t child[Width];
+        Order order[8];
+        uint8_t count;
+    };
+
+    struct QuantizedNode
+    {
+        float origin[3];
+        int8_t exponent[3];     // the bytes count steps of 2^exponent
+        uint8_t count;
+        uint8_t lo[3][Width];
+        uint8_t hi[3][Width];
+        uint32_t child[Width];
+        Order order[8];
+    };
+
+    typedef typename std::conditional<Quantized, QuantizedNode,
+                                      FloatNode>::type Node;
+
+    // the ray in floats
+    struct RayLanes
+    {
+        float origin[3];
+        float invD[3];
+        unsigned octant;        // bit per axis, set if D is negative
+    };
+
+    // where a binary node went: the wide node it is a child of, in lane,
+    // or the one it was opened in (lane == Width)
+    struct Home
+    {
+        unsigned node;
+        unsigned lane;
+    };
+
+    std::vector<Node> d_nodes;
+    Bvh const *d_binary = nullptr;
+
+    // For update(): per node, the binary node it was collapsed from and
+    // the binary nodes of its children; per binary node, its home.
+    std::vector<unsigned> d_roots;
+    std::vector<std::array<unsigned, Width>> d_sources;
+    std::vector<Home> d_homes;
+    unsigned d_deadNodes = 0;
+
+    public:
+        // collapse a built binary hierarchy
+        void build(Bvh const &binary);
+
+        // follow the changes of binary, the tree built from, since its
+        // last clearChanges()
+        void update(Bvh const &binary);
+
+        bool empty() const;
+        unsigned nodeCount() const;
+        static unsigned nodeBytes();
+
+        // As Bvh::traverse. If visited is given, it is incremented for
+        // every node whose children are tested.
+        template <typename Test>
+        void traverse(Ray const &ray, double &t, Test const &test,
+                      unsigned *visited = nullptr) const;
+
+    private:
+        // the child reference for a binary node, adding nodes for inner ones
+        uint32_t reference(unsigned binaryNode);
+        // collapse the binary subtree at root into node index
+        void collapse(unsigned index, unsigned root);
+        // store the boxes and the orders of the children of node index
+        void encode(unsigned index);
+        // number of nodes from index down
+        unsigned subtreeSize(unsigned index) const;
+
+        // store the boxes of the node's children
+        static void encode(FloatNode &node, Box const *boxes, unsigned count);
+        static void encode(QuantizedNode &node, Box const *boxes,
+                           unsigned count);
+
+        // bit i of the result is set if child i is hit before tmax
+        static unsigned intersect(FloatNode const &node, RayLanes const &ray,
+                                  float tmax);
+        static unsigned intersect(QuantizedNode const &node,
+                                  RayLanes const &ray, float tmax);
+        static unsigned intersect(float const (&lo)[3][Width],
+                                  float const (&hi)[3][Width],
+                                  RayLanes const &ray, float tmax);
+};
+
+// --- Inline implementation ---------------------------------------------------
+
+namespace wide
+{
+    // Relative slack on the far distance, covering the rounding of the
+    // ray and box coordinates to floats.
+    float const ROBUST = 1.0f + 1e-4f;
+
+    // Slab test of four boxes, given their near and far planes per axis.
+    // NaNs (a ray in the plane of a flat box) leave a bound unchanged.
+    inline unsigned slabs(float const *near[3], float const *far[3],
+                          float const origin[3], float const invD[3],
+                          float tmax)
+    {
+#if defined(__SSE2__)
+        __m128 tnear = _mm_setzero_ps();
+        __m128 tfar = _mm_set1_ps(tmax);
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            __m128 o = _mm_set1_ps(origin[axis]);
+            __m128 inv = _mm_set1_ps(invD[axis]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near[axis]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far[axis]), o), inv);
+            tnear = _mm_max_ps(t0, tnear);      // the second operand on NaN
+            tfar = _mm_min_ps(t1, tfar);
+        }
+        tfar = _mm_mul_ps(tfar, _mm_set1_ps(ROBUST));
+        return _mm_movemask_ps(_mm_cmple_ps(tnear, tfar));
+#else
+        unsigned mask = 0;
+        for (int idx = 0; idx != 4; ++idx)
+        {
+            float tnear = 0.0f;
+            float tfar = tmax;
+            for (int axis = 0; axis != 3; ++axis)
+            {
+                float t0 = (near[axis][idx] - origin[axis]) * invD[axis];
+                float t1 = (far[axis][idx] - origin[axis]) * invD[axis];
+                tnear = t0 > tnear ? t0 : tnear;
+                tfar = t1 < tfar ? t1 : tfar;
+            }
+            if (tnear <= tfar * ROBUST)
+                mask |= 1u << idx;
+        }
+        return mask;
+#endif
+    }
+}
+
+template <unsigned Width, bool Quantized>
+template <typename Test>
+void WideBvh<Width, Quantized>::traverse(Ray const &ray, double &t,
+                                         Test const &test,
+                                         unsigned *visited) const
+{
+    if (d_nodes.empty())
+        return;
+
+    std::vector<unsigned> const &indices = d_binary->indices();
+    RayLanes lanes;
+    lanes.octant = 0;
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        lanes.origin[axis] = ray.O.data[axis];
+        lanes.invD[axis] = 1.0f / static_cast<float>(ray.D.data[axis]);
+        lanes.octant |= (ray.D.data[axis] < 0.0) << axis;
+    }
+
+    // at most Width - 1 siblings wait per level, the depth is below 100
+    uint32_t stack[100 * Width];
+    unsigned top = 0;
+    stack[top++] = 0;
+    while (top != 0)
+    {
+        uint32_t ref = stack[--top];
+        if (ref & 7)
+        {
+            for (unsigned idx = 0; idx != (ref & 7); ++idx)
+                test(indices[(ref >> 3) + idx], t);
+            continue;
+        }
+
+        Node const &node = d_nodes[ref >> 3];
+        if (visited)
+            ++*visited;
+        unsigned mask = intersect(node, lanes, static_cast<float>(t))
+                        & ((1u << node.count) - 1);
+
+        // Push far to near, so the nearest child is popped first.
+        Order order = node.order[lanes.octant];
+        for (unsigned k = Width; k-- != 0; )
+        {
+            unsigned child = order >> k * ORDER_BITS & (Width - 1);
+            if (mask >> child & 1)
+                stack[top++] = node.child[child];
+        }
+    }
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::intersect(FloatNode const &node,
+                                              RayLanes const &ray, float tmax)
+{
+    return intersect(node.lo, node.hi, ray, tmax);
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::intersect(QuantizedNode const &node,
+                                              RayLanes const &ray, float tmax)
+{
+    float lo[3][Width];
+    float hi[3][Width];
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        // 2^exponent from its bits; q * 2^exponent is exact in a float
+        uint32_t bits = static_cast<uint32_t>(node.exponent[axis] + 127) << 23;
+        float step;
+        std::memcpy(&step, &bits, sizeof step);
+#if defined(__SSE2__)
+        __m128 origin = _mm_set1_ps(node.origin[axis]);
+        __m128 scale = _mm_set1_ps(step);
+        __m128i zero = _mm_setzero_si128();
+        for (unsigned group = 0; group != Width / 4; ++group)
+        {
+            int32_t packed[2];
+            std::memcpy(&packed[0], node.lo[axis] + 4 * group, 4);
+            std::memcpy(&packed[1], node.hi[axis] + 4 * group, 4);
+            __m128i bytes = _mm_unpacklo_epi8(
+                _mm_set_epi32(0, 0, packed[1], packed[0]), zero);
+            __m128 qlo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(bytes, zero));
+            __m128 qhi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(bytes, zero));
+            _mm_storeu_ps(lo[axis] + 4 * group,
+                          _mm_add_ps(origin, _mm_mul_ps(qlo, scale)));
+            _mm_storeu_ps(hi[axis] + 4 * group,
+                          _mm_add_ps(origin, _mm_mul_ps(qhi, scale)));
+        }
+#else
+        for (unsigned idx = 0; idx != Width; ++idx)
+        {
+            lo[axis][idx] = node.origin[axis] + node.lo[axis][idx] * step;
+            hi[axis][idx] = node.origin[axis] + node.hi[axis][idx] * step;
+        }
+#endif
+    }
+    return intersect(lo, hi, ray, tmax);
+}
+
+template <unsigned Width, bool Quantized>
+unsigned WideBvh<Width, Quantized>::intersect(float const (&lo)[3][Width],
+                                              float const (&hi)[3][Width],
+                                              RayLanes const &ray, float tmax)
+{
+    unsigned mask = 0;
+    for (unsigned group = 0; group != Width / 4; ++group)
+    {
+        // a ray going in the negative direction enters at hi
+        float const *near[3];
+        float const *far[3];
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            bool negative = ray.octant >> axis & 1;
+            near[axis] = (negative ? hi : lo)[axis] + 4 * group;
+            far[axis] = (negative ? lo : hi)[axis] + 4 * group;
+        }
+        mask |= wide::slabs(near, far, ray.origin, ray.invD, tmax) << 4 * group;
+    }
+    return mask;
+}
+
+#endif